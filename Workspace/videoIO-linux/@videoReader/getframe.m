@@ -16,6 +16,8 @@ function frame = getframe(vr)
 %SEE ALSO
 %  videoReader
 %  videoReader/get
+%  videoReader/getframeinto
+%  videoReader/getframes
 %  videoReader/getnext
 %  videoReader/next
 %  videoReader/seek
@@ -0,0 +1,53 @@
+function frame = getframeinto(vr, frame, mode)
+%FRAME=GETFRAMEINTO(VR,FRAME)
+%FRAME=GETFRAMEINTO(VR,FRAME,'inplace')
+%  Like GETFRAME, but checks that FRAME, a uint8 array of the video's
+%  frame size (height x width x depth), matches the current frame of
+%  video VR.  With two arguments the frame is returned in a new array,
+%  exactly like FRAME=GETFRAME(VR), so FRAME may be shared freely.
+%
+%  With 'inplace', the mex plugins write the frame directly into FRAME's
+%  memory instead of allocating a new array on every call, so long reads
+%  no longer spend time allocating and freeing large arrays.  This
+%  bypasses Matlab's copy-on-write: FRAME must not share its data with
+%  another variable (e.g. after "buf2 = frame;"), or that variable will
+%  change too.  Allocate it with ZEROS and only update it through 
+%  GETFRAMEINTO, as in the example.  The popen2 plugins still receive 
+%  each frame in a temporary array and copy it into FRAME.
+%
+%  Example:
+%    vr    = videoReader(...);
+%    info  = get(vr);
+%    frame = zeros([info.height info.width 3], 'uint8');
+%    while (next(vr))
+%      frame = getframeinto(vr, frame, 'inplace');
+%      % ...do something...
+%    end
+%    vr = close(vr);
+%
+%SEE ALSO
+%  videoReader
+%  videoReader/getframe
+%  videoReader/getframes
+%  videoReader/next
+%
+%Copyright (c) 2006 Gerald Dalley
+%See "MIT.txt" in the installation directory for licensing details (especially
+%when using this library on GNU/Linux). 
+
+inplace = (nargin >= 3);
+if inplace && ~strcmpi(mode, 'inplace')
+  error('The only mode getframeinto accepts is ''inplace''.');
+end
+
+if inplace && ~isMFileWithCode(which([vr.plugin '.m']))
+  feval(vr.plugin, 'getframeinto', vr.handle, frame);
+else
+  % M-file plugins don't implement a native getframeinto.
+  newFrame = getframe(vr);
+  if ~isequal(size(newFrame), size(frame)) || ~isa(frame, class(newFrame))
+    error('The frame buffer must be a %s array of size %s.', ...
+          class(newFrame), mat2str(size(newFrame)));
+  end
+  frame = newFrame;
+end
@@ -0,0 +1,65 @@
+function [frames,frameNums] = getframes(vr, n, stride)
+%[FRAMES,FRAMENUMS]=GETFRAMES(VR,N)
+%[FRAMES,FRAMENUMS]=GETFRAMES(VR,N,STRIDE)
+%  Reads up to N frames from video VR in a single call, where N is a
+%  positive integer.  This is equivalent to calling NEXT (or 
+%  STEP(VR,STRIDE) if STRIDE is given) followed by GETFRAME, N times, but
+%  it is much faster for plugins that run in a separate process (e.g. 
+%  ffmpegPopen2) because only one request is sent to the plugin.  N may
+%  be larger than the number of frames left.
+%
+%  FRAMES is an H x W x D x N uint8 array where FRAMES(:,:,:,i) is the ith
+%  frame read.  FRAMENUMS is a 1 x N vector of the 0-indexed frame numbers
+%  of those frames.  If the end of the video is reached before N frames
+%  have been read, FRAMES and FRAMENUMS only contain the frames that were
+%  read.  As with NEXT, the video is left positioned at the last frame 
+%  read.
+%
+%  Example:
+%    vr = videoReader(fullfile(videoIODir, 'tests/numbers.uncompressed.avi'));
+%    % read every 5th frame, 10 frames at a time
+%    while true
+%      [frames, frameNums] = getframes(vr, 10, 5);
+%      if isempty(frameNums), break; end
+%      for i=1:size(frames,4)
+%        imshow(frames(:,:,:,i)); title(sprintf('frame %d', frameNums(i)));
+%        drawnow;
+%      end
+%    end
+%    vr = close(vr);
+%
+%SEE ALSO
+%  videoReader
+%  videoReader/getframe
+%  videoReader/getnext
+%  videoReader/next
+%  videoReader/step
+%
+%Copyright (c) 2008 Gerald Dalley
+%See "MIT.txt" in the installation directory for licensing details (especially
+%when using this library on GNU/Linux). 
+
+if nargin < 3, stride = 1; end
+if ~isnumeric(n) || ~isscalar(n) || ~isfinite(n) || n < 1 || n ~= floor(n)
+  error('The number of frames must be a positive integer.');
+end
+
+if isMFileWithCode(which([vr.plugin '.m']))
+  % M-file plugins don't implement a native getframes.
+  frames    = [];
+  frameNums = zeros(1,0);
+  for i=1:n
+    if stride == 1, worked = next(vr); else worked = step(vr, stride); end
+    if ~worked, break; end
+    frame = getframe(vr);
+    if isempty(frames)
+      frames = zeros([size(frame,1) size(frame,2) size(frame,3) n], ...
+                     class(frame));
+    end
+    frames(:,:,:,i) = frame;
+    frameNums(i)    = get(vr, 'approxFrameNum');
+  end
+  frames = frames(:,:,:,1:numel(frameNums));
+else
+  [frames,frameNums] = feval(vr.plugin, 'getframes', vr.handle, n, stride);
+end
@@ -24,6 +24,7 @@ function frame = getnext(vr)
 %SEE ALSO
 %  videoReader
 %  videoReader/getframe
+%  videoReader/getframes
 %  videoReader/get
 %  videoReader/next
 %  videoReader/seek
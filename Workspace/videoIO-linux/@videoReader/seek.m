@@ -31,6 +31,7 @@ function worked = seek(vr,fnum)
 %  videoReader/get
 %  videoReader/getnext
 %  videoReader/next
+%  videoReader/seektime
 %  videoReader/step
 %
 %Copyright (c) 2006 Gerald Dalley
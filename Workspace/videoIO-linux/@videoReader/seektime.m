@@ -0,0 +1,38 @@
+function worked = seektime(vr,t)
+%WORKED=SEEKTIME(VR,T)
+%  Attempts to go to the frame of video VR that is displayed T seconds 
+%  after the first frame.  Returns 0 if T is negative or if it is past the
+%  end of the video.  
+%
+%  Most plugins convert T to a frame number assuming a constant frame rate.
+%  The ffmpeg plugins use the presentation timestamp of every frame when
+%  they have a keyframe index (see the keyframeIndex and packetFrameCount 
+%  options), so variable frame rate videos are handled exactly.
+%
+%  After the videoReader constructor is called, NEXT, SEEK, SEEKTIME, or 
+%  STEP should be called at least once before GETFRAME is called. 
+%
+%  Example:
+%    % show the frame displayed 2.5 seconds into the video
+%    vr = videoReader(fullfile(videoIODir, 'tests/numbers.uncompressed.avi'));
+%    if (~seektime(vr,2.5)), error('the video is shorter than 2.5s'); end
+%    imshow(getframe(vr));
+%    vr = close(vr);
+%
+%SEE ALSO
+%  videoReader
+%  videoReader/getframe
+%  videoReader/get
+%  videoReader/seek
+%  videoReader/step
+%
+%Copyright (c) 2008 Gerald Dalley
+%See "MIT.txt" in the installation directory for licensing details (especially
+%when using this library on GNU/Linux). 
+
+if isMFileWithCode(which([vr.plugin '.m']))
+  % M-file plugins don't implement a native seektime.
+  worked = (t >= 0) && seek(vr, floor(t * get(vr, 'fps') + 1e-6));
+else
+  worked = logical(feval(vr.plugin, 'seektime', vr.handle, t));
+end
@@ -113,10 +113,13 @@ function vr = videoReader(url, varargin)
 %
 %   videoReader/close
 %   videoReader/getframe
+%   videoReader/getframeinto
+%   videoReader/getframes
 %   videoReader/get
 %   videoReader/getnext
 %   videoReader/next
 %   videoReader/seek
+%   videoReader/seektime
 %   videoReader/step
 %
 %Copyright (c) 2006 Gerald Dalley
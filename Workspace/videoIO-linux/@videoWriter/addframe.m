@@ -99,6 +99,7 @@ function addframe(vw,varargin)
 %
 %   SEE ALSO
 %     videoWriter
+%     videoWriter/addframes
 %     videoWriter/close
 %     avifile/addframe
 %     tests/addFrameDemo
@@ -148,8 +149,9 @@ return;
 
 % ------------------------------------------------------------------------
 function addSingleDataFrame(vw,img)
-% Handles type conversion, rescaling, and grayscale->RGB conversion, as
-% necessary.  Then, the backend is called to add the frame.
+% Handles type conversion and rescaling, as necessary.  Then, the backend
+% is called to add the frame.  Grayscale frames are passed through as-is;
+% the plugins expand or convert them themselves.
 
 [h,w,d] = size(img);
 
@@ -178,10 +180,6 @@ else
   error('Invalid image type.');
 end
 
-if (d == 1)
-  img = repmat(img, [1 1 3]);
-end
-
 feval(vw.plugin, 'addframe', vw.handle, img);
 return;
 
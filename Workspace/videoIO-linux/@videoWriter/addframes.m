@@ -0,0 +1,56 @@
+function nBytes = addframes(vw,frames)
+%NBYTES=ADDFRAMES(VW,FRAMES)
+%  Appends every frame in FRAMES, an H-by-W-by-3-by-N (truecolor) or 
+%  H-by-W-by-1-by-N (grayscale) array, to the VIDEOWRITER stream VW.  The
+%  types and ranges are interpreted as in ADDFRAME.  All N frames are sent
+%  to the plugin in a single request, which is much cheaper than calling
+%  ADDFRAME N times, especially for the ffmpegPopen2 plugin.
+%
+%  NBYTES is a 1-by-N vector giving the number of bytes written to the
+%  file for each frame.  It can be used to monitor the bit rate.  A 0
+%  means the encoder buffered the frame (e.g. to produce B-frames later);
+%  its bytes are counted with a later frame.  -1 means the number is not
+%  known, e.g. when 'asyncEncode' is on.
+%
+%  If the frames are not the size of the video, they are resized one at a
+%  time by ADDFRAME instead, and NBYTES is all -1.
+%
+%  Example:
+%    vw = videoWriter('example.avi', 'width',320, 'height',240);
+%    frames = uint8(255*rand(240, 320, 3, 10));
+%    nBytes = addframes(vw, frames);
+%    vw = close(vw);
+%
+%SEE ALSO
+%  videoWriter
+%  videoWriter/addframe
+%  videoWriter/close
+%
+%Copyright (c) 2008 Gerald Dalley
+%See "MIT.txt" in the installation directory for licensing details (especially
+%when using this library on GNU/Linux). 
+
+if ~isa(vw,'videoWriter')
+  error('First input must be an videoWriter object.');
+end
+
+[h,w,d,n] = size(frames);
+if d ~= 1 && d ~= 3
+  error('Frames must be H-by-W-by-3-by-N or H-by-W-by-1-by-N arrays.');
+end
+
+if (vw.w >= 0 && w ~= vw.w) || (vw.h >= 0 && h ~= vw.h)
+  for i=1:n
+    addframe(vw, frames(:,:,:,i));
+  end
+  nBytes = -ones(1,n);
+  return;
+end
+
+if isa(frames, 'double') || islogical(frames)
+  frames = uint8(255*frames);
+elseif ~isa(frames, 'uint8')
+  error('Invalid image type.');
+end
+
+nBytes = feval(vw.plugin, 'addframes', vw.handle, frames);
@@ -90,6 +90,7 @@ function vw = videoWriter(url, varargin)
 %   videoWriter_ffmpegPopen2
 %
 %   videoWriter/addframe
+%   videoWriter/addframes
 %   videoWriter/close
 %   videoWriter/get
 %
@@ -0,0 +1,407 @@
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include "ColorConversionKernels.h"
+#include <string.h>
+#include <vector>
+
+namespace VideoIO 
+{
+
+  // See ColorConversionKernels.h for how these are used.
+  //                                       yMul  yOff     vr    ug     vg     ub  ubExtra
+  static YuvCoeffs const MPEG_COEFFS = { 38155, 1192, 26149, 6419, 13320,   282, true  };
+  static YuvCoeffs const JPEG_COEFFS = { 32768,    0, 22970, 5638, 11700, 29032, false };
+
+  static inline int sat16(int v) {
+    return (v < -32768) ? -32768 : ((v > 32767) ? 32767 : v);
+  }
+
+  static inline unsigned char packChannel(int v) {
+    v = sat16(v + 32) >> 6;
+    return (unsigned char)((v < 0) ? 0 : ((v > 255) ? 255 : v));
+  }
+
+  static inline void yuvPixel(YuvCoeffs const &k, int Y, int U, int V,
+                              unsigned char &r, unsigned char &g, 
+                              unsigned char &b)
+  {
+    int const yt = (int)(((unsigned)(Y << 7) * (unsigned)k.yMul) >> 16) - 
+                   k.yOff;
+    int const us = (U - 128) * 256;
+    int const vs = (V - 128) * 256;
+    r = packChannel(sat16(yt + ((vs * k.vr) >> 16)));
+    g = packChannel(sat16(sat16(yt - ((us * k.ug) >> 16)) - 
+                          ((vs * k.vg) >> 16)));
+    int bb = sat16(yt + ((us * k.ub) >> 16));
+    if (k.ubExtra) bb = sat16(bb + (us >> 1));
+    b = packChannel(bb);
+  }
+
+  //                                   r      g      b  off
+  static RgbCoeffs const MPEG_Y = {  4207,  8260,  1604,  16 };
+  static RgbCoeffs const MPEG_U = { -2428, -4768,  7196, 128 };
+  static RgbCoeffs const MPEG_V = {  7196, -6026, -1170, 128 };
+  static RgbCoeffs const JPEG_Y = {  4899,  9617,  1868,   0 };
+  static RgbCoeffs const JPEG_U = { -2765, -5427,  8192, 128 };
+  static RgbCoeffs const JPEG_V = {  8192, -6860, -1332, 128 };
+
+  static inline unsigned char rgbSample(RgbCoeffs const &k, 
+                                        int r, int g, int b, int shift)
+  {
+    int const v = (k.r*r + k.g*g + k.b*b + (k.off << shift) + 
+                   (1 << (shift-1))) >> shift;
+    return (unsigned char)((v > 255) ? 255 : v);
+  }
+
+  /** Scalar conversion of the rectangle [x0,x1) x [y0,y1).  Pixels are 
+   *  visited in column-major order so that the writes are sequential. */
+  static void yuvToMatlabScalar(unsigned char *out, int w, int h,
+                                unsigned char const *const planes[3], 
+                                int const strides[3],
+                                YuvSubsampling subsampling, 
+                                YuvCoeffs const &k,
+                                int x0, int x1, int y0, int y1)
+  {
+    int const sx = chromaShiftX(subsampling);
+    int const sy = chromaShiftY(subsampling);
+    int const planeSize = w*h;
+    for (int x=x0; x<x1; x++) {
+      unsigned char *r = out + x*h;
+      unsigned char *g = r + planeSize;
+      unsigned char *b = g + planeSize;
+      for (int y=y0; y<y1; y++) {
+        yuvPixel(k, 
+                 planes[0][y*strides[0] + x],
+                 planes[1][(y>>sy)*strides[1] + (x>>sx)],
+                 planes[2][(y>>sy)*strides[2] + (x>>sx)],
+                 r[y], g[y], b[y]);
+      }
+    }
+  }
+
+  /** Scalar, cache-blocked version of planeToMatlab for the rectangle 
+   *  [x0,x1) x [y0,y1). */
+  static void planeToMatlabScalar(unsigned char *out, unsigned char const *in,
+                                  int h, int inStride,
+                                  int x0, int x1, int y0, int y1)
+  {
+    for (int x=x0; x<x1; x++) {
+      unsigned char       *o = out + x*h + y0;
+      unsigned char const *i = in + y0*inStride + x;
+      for (int y=y0; y<y1; y++) {
+        *o++ = *i;
+        i   += inStride;
+      }
+    }
+  }
+
+  /** Scalar version of packedToMatlab for the rectangle [x0,x1) x [y0,y1). */
+  static void packedToMatlabScalar(unsigned char *out, unsigned char const *in,
+                                   int w, int h, int d, int inStride, 
+                                   bool reverseChannels,
+                                   int x0, int x1, int y0, int y1)
+  {
+    for (int c=0; c<d; c++) {
+      int const inC = reverseChannels ? (d-1-c) : c;
+      for (int x=x0; x<x1; x++) {
+        unsigned char       *o = out + (c*w + x)*h + y0;
+        unsigned char const *i = in + y0*inStride + x*d + inC;
+        for (int y=y0; y<y1; y++) {
+          *o++ = *i;
+          i   += inStride;
+        }
+      }
+    }
+  }
+
+  /** Scalar conversion of the luma of the rectangle [x0,x1) x [y0,y1).  
+   *  rgb[0..2] are the Matlab planes (all the same for grayscale input). */
+  static void matlabToLumaScalar(unsigned char *yPlane, int yStride,
+                                 unsigned char const *const rgb[3], int h,
+                                 RgbCoeffs const &k,
+                                 int x0, int x1, int y0, int y1)
+  {
+    for (int y=y0; y<y1; y++) {
+      unsigned char *o = yPlane + y*yStride;
+      for (int x=x0; x<x1; x++) {
+        int const i = x*h + y;
+        o[x] = rgbSample(k, rgb[0][i], rgb[1][i], rgb[2][i], 14);
+      }
+    }
+  }
+
+  /** Scalar conversion of the chroma samples [cx0,cx1) x [cy0,cy1). */
+  static void matlabToChromaScalar(unsigned char *const planes[3], 
+                                   int const strides[3],
+                                   unsigned char const *const rgb[3], 
+                                   int w, int h, YuvSubsampling subsampling,
+                                   RgbCoeffs const &ku, RgbCoeffs const &kv,
+                                   int cx0, int cx1, int cy0, int cy1)
+  {
+    int const sx    = chromaShiftX(subsampling);
+    int const sy    = chromaShiftY(subsampling);
+    int const shift = 14 + sx + sy;
+    for (int cy=cy0; cy<cy1; cy++) {
+      for (int cx=cx0; cx<cx1; cx++) {
+        int r = 0, g = 0, b = 0;
+        for (int dy=0; dy<(1<<sy); dy++) {
+          int const y = ((cy<<sy) + dy < h) ? (cy<<sy) + dy : h-1;
+          for (int dx=0; dx<(1<<sx); dx++) {
+            int const x = ((cx<<sx) + dx < w) ? (cx<<sx) + dx : w-1;
+            int const i = x*h + y;
+            r += rgb[0][i];
+            g += rgb[1][i];
+            b += rgb[2][i];
+          }
+        }
+        planes[1][cy*strides[1] + cx] = rgbSample(ku, r, g, b, shift);
+        planes[2][cy*strides[2] + cx] = rgbSample(kv, r, g, b, shift);
+      }
+    }
+  }
+
+  /*************************************************************************
+   * Runtime dispatch
+   *************************************************************************/
+
+  static bool detectSimd()
+  {
+    if (!sse2KernelsBuilt()) return false;
+#if defined(__x86_64__)
+    return true; // every x86_64 CPU has SSE2
+#elif defined(__i386__)
+    // cpuid clobbers ebx, which holds the GOT pointer in PIC code
+    unsigned int a, b, c, d;
+    __asm__ __volatile__("pushl %%ebx\n\t"
+                         "cpuid\n\t"
+                         "movl %%ebx, %1\n\t"
+                         "popl %%ebx"
+                         : "=a"(a), "=r"(b), "=c"(c), "=d"(d)
+                         : "a"(1));
+    return ((d >> 26) & 1) != 0;
+#else
+    return false;
+#endif
+  }
+
+  static bool const simdAvailable = detectSimd();
+  static bool       simdEnabled   = simdAvailable;
+
+  bool colorConversionSimdAvailable() { return simdAvailable; }
+
+  bool colorConversionUsesSimd() { return simdEnabled; }
+
+  bool setColorConversionSimd(bool enable) 
+  {
+    simdEnabled = enable && simdAvailable;
+    return simdEnabled;
+  }
+
+  /*************************************************************************
+   * Public entry points
+   *************************************************************************/
+
+  void yuvToMatlab(unsigned char *out, int w, int h,
+                   unsigned char const *const planes[3], int const strides[3],
+                   YuvSubsampling subsampling, YuvRange range)
+  {
+    YuvCoeffs const &k = 
+      (range == YUV_JPEG_RANGE) ? JPEG_COEFFS : MPEG_COEFFS;
+    int const wTiled = w - (w % TILE);
+    int const hTiled = h - (h % TILE);
+
+    if (simdEnabled) {
+      yuvToMatlabTilesSse2(out, w, h, planes, strides, subsampling, k,
+                           wTiled, hTiled);
+      // Ragged right and bottom edges
+      yuvToMatlabScalar(out, w, h, planes, strides, subsampling, k,
+                        wTiled, w, 0, hTiled);
+      yuvToMatlabScalar(out, w, h, planes, strides, subsampling, k,
+                        0, w, hTiled, h);
+      return;
+    }
+
+    for (int y0=0; y0<h; y0+=TILE) {
+      int const y1 = (y0+TILE < h) ? y0+TILE : h;
+      for (int x0=0; x0<w; x0+=TILE) {
+        int const x1 = (x0+TILE < w) ? x0+TILE : w;
+        yuvToMatlabScalar(out, w, h, planes, strides, subsampling, k,
+                          x0, x1, y0, y1);
+      }
+    }
+  }
+
+  void matlabToYuv(unsigned char *const planes[3], int const strides[3],
+                   unsigned char const *in, int w, int h, int d,
+                   YuvSubsampling subsampling, YuvRange range)
+  {
+    bool const       jpeg = (range == YUV_JPEG_RANGE);
+    RgbCoeffs const &ky   = jpeg ? JPEG_Y : MPEG_Y;
+    RgbCoeffs const &ku   = jpeg ? JPEG_U : MPEG_U;
+    RgbCoeffs const &kv   = jpeg ? JPEG_V : MPEG_V;
+    int const sx = chromaShiftX(subsampling);
+    int const sy = chromaShiftY(subsampling);
+    int const cw = (w + (1<<sx) - 1) >> sx;
+    int const ch = (h + (1<<sy) - 1) >> sy;
+
+    // Grayscale images are treated as R=G=B, which always gives a chroma
+    // of 128, so we skip computing it.
+    bool const gray = (d == 1);
+    unsigned char const *const rgb[3] = 
+      { in, gray ? in : in + w*h, gray ? in : in + 2*w*h };
+    if (gray) {
+      for (int cy=0; cy<ch; cy++) {
+        memset(planes[1] + cy*strides[1], 128, cw);
+        memset(planes[2] + cy*strides[2], 128, cw);
+      }
+    }
+
+    int const wTiled = w - (w % TILE);
+    int const hTiled = h - (h % TILE);
+
+    if (simdEnabled) {
+      matlabToYuvTilesSse2(planes, strides, rgb, h, subsampling, !gray, 
+                           ky, ku, kv, wTiled, hTiled);
+      // Ragged right and bottom edges
+      matlabToLumaScalar(planes[0], strides[0], rgb, h, ky, 
+                         wTiled, w, 0, hTiled);
+      matlabToLumaScalar(planes[0], strides[0], rgb, h, ky, 
+                         0, w, hTiled, h);
+      if (!gray) {
+        matlabToChromaScalar(planes, strides, rgb, w, h, subsampling, ku, kv,
+                             wTiled >> sx, cw, 0, hTiled >> sy);
+        matlabToChromaScalar(planes, strides, rgb, w, h, subsampling, ku, kv,
+                             0, cw, hTiled >> sy, ch);
+      }
+      return;
+    }
+
+    for (int y0=0; y0<h; y0+=TILE) {
+      int const y1 = (y0+TILE < h) ? y0+TILE : h;
+      for (int x0=0; x0<w; x0+=TILE) {
+        int const x1 = (x0+TILE < w) ? x0+TILE : w;
+        matlabToLumaScalar(planes[0], strides[0], rgb, h, ky, x0, x1, y0, y1);
+        if (!gray) {
+          matlabToChromaScalar(planes, strides, rgb, w, h, subsampling, ku, kv,
+                               x0 >> sx, (x1 + (1<<sx) - 1) >> sx,
+                               y0 >> sy, (y1 + (1<<sy) - 1) >> sy);
+        }
+      }
+    }
+  }
+
+  void planeToMatlab(unsigned char *out, unsigned char const *in,
+                     int w, int h, int inStride)
+  {
+    int const wTiled = w - (w % TILE);
+    int const hTiled = h - (h % TILE);
+
+    if (simdEnabled) {
+      planeToMatlabTilesSse2(out, in, h, inStride, wTiled, hTiled);
+      planeToMatlabScalar(out, in, h, inStride, wTiled, w, 0, hTiled);
+      planeToMatlabScalar(out, in, h, inStride, 0, w, hTiled, h);
+      return;
+    }
+
+    for (int y0=0; y0<h; y0+=TILE) {
+      int const y1 = (y0+TILE < h) ? y0+TILE : h;
+      for (int x0=0; x0<w; x0+=TILE) {
+        int const x1 = (x0+TILE < w) ? x0+TILE : w;
+        planeToMatlabScalar(out, in, h, inStride, x0, x1, y0, y1);
+      }
+    }
+  }
+
+  void yuvPlanesToMatlab(unsigned char *out, int w, int h,
+                         unsigned char const *const planes[3], 
+                         int const strides[3], YuvSubsampling subsampling)
+  {
+    planeToMatlab(out, planes[0], w, h, strides[0]);
+    if (subsampling == YUV_444) {
+      planeToMatlab(out + w*h,   planes[1], w, h, strides[1]);
+      planeToMatlab(out + 2*w*h, planes[2], w, h, strides[2]);
+      return;
+    }
+
+    // Transpose each chroma plane at its own resolution, then stretch the
+    // columns.  Both passes read and write sequentially.
+    int const cw = (w + 1) / 2;
+    int const ch = (subsampling == YUV_420) ? (h + 1) / 2 : h;
+    int const vShift = (subsampling == YUV_420) ? 1 : 0;
+    std::vector<unsigned char> tmp(cw * ch);
+    for (int c=1; c<3; c++) {
+      planeToMatlab(&tmp[0], planes[c], cw, ch, strides[c]);
+      unsigned char *o = out + c*w*h;
+      for (int x=0; x<w; x++) {
+        unsigned char const *col = &tmp[(x >> 1) * ch];
+        for (int y=0; y<h; y++) *o++ = col[y >> vShift];
+      }
+    }
+  }
+
+  void packedToMatlab(unsigned char *out, unsigned char const *in,
+                      int w, int h, int d, int inStride, 
+                      bool reverseChannels)
+  {
+    if (d == 1) {
+      planeToMatlab(out, in, w, h, inStride);
+      return;
+    }
+
+    if (simdEnabled && d <= 4) {
+      int const wTiled = w - (w % TILE);
+      int const hTiled = h - (h % TILE);
+      packedToMatlabTilesSse2(out, in, w, h, d, inStride, reverseChannels,
+                              wTiled, hTiled);
+      packedToMatlabScalar(out, in, w, h, d, inStride, reverseChannels,
+                           wTiled, w, 0, hTiled);
+      packedToMatlabScalar(out, in, w, h, d, inStride, reverseChannels,
+                           0, w, hTiled, h);
+      return;
+    }
+
+    for (int y0=0; y0<h; y0+=TILE) {
+      int const y1 = (y0+TILE < h) ? y0+TILE : h;
+      for (int x0=0; x0<w; x0+=TILE) {
+        int const x1 = (x0+TILE < w) ? x0+TILE : w;
+        packedToMatlabScalar(out, in, w, h, d, inStride, reverseChannels,
+                             x0, x1, y0, y1);
+      }
+    }
+  }
+
+}; /* namespace VideoIO */
@@ -0,0 +1,116 @@
+#ifndef COLORCONVERSION_H
+#define COLORCONVERSION_H
+
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+namespace VideoIO 
+{
+
+  /** Chroma subsampling of a planar YUV image */
+  enum YuvSubsampling {
+    YUV_420, ///< chroma is subsampled 2x horizontally and 2x vertically
+    YUV_422, ///< chroma is subsampled 2x horizontally
+    YUV_444  ///< no chroma subsampling
+  };
+
+  /** Value range of a YUV image */
+  enum YuvRange {
+    YUV_MPEG_RANGE, ///< BT.601 "TV" range: Y in [16,235], U and V in [16,240]
+    YUV_JPEG_RANGE  ///< full range: Y, U, and V in [0,255] (the YUVJ formats)
+  };
+
+  /** Converts a planar YUV image into Matlab's layout for RGB images:
+   *  three w*h column-major planes (R, then G, then B) stored one after the
+   *  other in out.  The conversion and the row-major to column-major 
+   *  transpose are done in a single cache-blocked pass.
+   *
+   *  planes[0..2] point to the top-left pixel of the Y, U, and V planes,
+   *  and strides[0..2] give the number of bytes between their rows. */
+  void yuvToMatlab(unsigned char *out, int w, int h,
+                   unsigned char const *const planes[3], int const strides[3],
+                   YuvSubsampling subsampling, YuvRange range);
+
+  /** The inverse of yuvToMatlab, for the video writers: converts an 
+   *  image in Matlab's layout (d column-major w*h planes, with d == 3 for
+   *  RGB or d == 1 for grayscale) into a planar YUV image in a single 
+   *  cache-blocked pass.  Each chroma sample is computed from the average
+   *  color of the pixels it covers; pixels past the right or bottom edge
+   *  are taken to repeat the last row or column.
+   *
+   *  planes[0..2] point to the top-left sample of the Y, U, and V planes,
+   *  and strides[0..2] give the number of bytes between their rows. */
+  void matlabToYuv(unsigned char *const planes[3], int const strides[3],
+                   unsigned char const *in, int w, int h, int d,
+                   YuvSubsampling subsampling, YuvRange range);
+
+  /** Converts a row-major image with d interleaved channels per pixel into
+   *  d column-major Matlab planes.  If reverseChannels is true, the 
+   *  channels are stored in the opposite order (e.g. to turn BGR input into
+   *  RGB planes).  inStride is the number of bytes between rows. */
+  void packedToMatlab(unsigned char *out, unsigned char const *in,
+                      int w, int h, int d, int inStride, 
+                      bool reverseChannels);
+
+  /** Copies one row-major plane of bytes (e.g. the Y plane of a YUV image)
+   *  into a single column-major Matlab plane. */
+  void planeToMatlab(unsigned char *out, unsigned char const *in,
+                     int w, int h, int inStride);
+
+  /** Copies a planar YUV image into three column-major Matlab planes (Y,
+   *  then U, then V) without any color conversion.  The chroma planes are
+   *  upsampled to w*h by repeating samples.  planes and strides are as for
+   *  yuvToMatlab. */
+  void yuvPlanesToMatlab(unsigned char *out, int w, int h,
+                         unsigned char const *const planes[3], 
+                         int const strides[3], YuvSubsampling subsampling);
+
+  /** True if the SIMD (SSE2) kernels are compiled in and the CPU we're 
+   *  running on supports them. */
+  bool colorConversionSimdAvailable();
+
+  /** True if the SIMD kernels will be used for subsequent conversions */
+  bool colorConversionUsesSimd();
+
+  /** Enables or disables the SIMD kernels (they are enabled by default 
+   *  when available).  The scalar kernels produce bit-identical results, 
+   *  so this is mainly useful for benchmarking and debugging.  Returns the
+   *  new setting. */
+  bool setColorConversionSimd(bool enable);
+
+}; /* namespace VideoIO */
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef COLORCONVERSIONKERNELS_H
+#define COLORCONVERSIONKERNELS_H
+
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include "ColorConversion.h"
+
+/*
+ * Shared by ColorConversion.cpp and ColorConversionSSE2.cpp.  The SSE2 
+ * kernels have a translation unit of their own because it is the only one
+ * compiled with -msse2 (see SIMD_FLAGS in the makefile).  Code built with
+ * that flag may use SSE2 anywhere, so nothing that runs before the CPU 
+ * check may live there.  For the same reason, everything defined in this
+ * header is static: the linker must not be able to pick an SSE2 build of
+ * it for the other translation units.
+ */
+
+namespace VideoIO 
+{
+
+  /*************************************************************************
+   * Fixed-point YUV->RGB arithmetic
+   *
+   * The SIMD and scalar kernels use exactly the same 16-bit fixed-point 
+   * arithmetic (the scalar code mimics the SSE2 instructions one for one) 
+   * so that both produce bit-identical output.  For each pixel:
+   *
+   *   yt = ((Y << 7) * yMul) >> 16  - yOff     (unsigned multiply)
+   *   us = (U - 128) * 256,  vs = (V - 128) * 256
+   *   R  = sat(yt + (vs*vr >> 16))
+   *   G  = sat(sat(yt - (us*ug >> 16)) - (vs*vg >> 16))
+   *   B  = sat(yt + (us*ub >> 16) [+ (us >> 1)])
+   *   out = clamp((sat(X + 32)) >> 6, 0, 255)
+   *
+   * so every term carries 6 fractional bits.  sat() saturates to a signed 
+   * 16-bit value.  The BT.601 MPEG-range blue coefficient (2.017) is too 
+   * large for a signed 16-bit multiplier, so it's split into 2 + 0.017 
+   * with the 2 handled by the optional (us >> 1) term.
+   *************************************************************************/
+
+  struct YuvCoeffs {
+    int  yMul, yOff, vr, ug, vg, ub;
+    bool ubExtra;
+  };
+
+  /*************************************************************************
+   * Fixed-point RGB->YUV arithmetic
+   *
+   * Each output sample is computed from the sums R, G, and B over the n 
+   * pixels it covers (n = 1, 2, or 4, depending on the chroma subsampling)
+   * using coefficients with 14 fractional bits:
+   *
+   *   out = clamp((cr*R + cg*G + cb*B + (off << s) + (1 << (s-1))) >> s)
+   *
+   * where s = 14 + log2(n).  No intermediate value overflows 32 bits or 
+   * goes negative, and the SSE2 kernels evaluate the very same expression
+   * (with pmaddwd), so they produce bit-identical results.  The U and V 
+   * coefficients sum to zero, so gray pixels get a chroma of exactly 128.
+   *************************************************************************/
+
+  struct RgbCoeffs {
+    int r, g, b, off;
+  };
+
+  static inline int chromaShiftX(YuvSubsampling s) {
+    return (s == YUV_444) ? 0 : 1;
+  }
+  
+  static inline int chromaShiftY(YuvSubsampling s) {
+    return (s == YUV_420) ? 1 : 0;
+  }
+
+  /** Tiles are TILE x TILE pixels.  16 is the natural size for SSE2 (one
+   *  register holds a 16-pixel row of bytes) and a tile's worth of output
+   *  columns comfortably fits in L1 cache. */
+  static int const TILE = 16;
+
+  /** True iff ColorConversionSSE2.cpp was compiled with SSE2 enabled.  
+   *  Otherwise the functions below do nothing and must not be called. */
+  bool sse2KernelsBuilt();
+
+  /** SSE2 versions of the public conversions (see ColorConversion.h) that
+   *  only convert the whole tiles in the top-left wTiled x hTiled pixels.
+   *  The callers convert the ragged right and bottom edges themselves. */
+  void yuvToMatlabTilesSse2(unsigned char *out, int w, int h,
+                            unsigned char const *const planes[3], 
+                            int const strides[3], YuvSubsampling subsampling,
+                            YuvCoeffs const &k, int wTiled, int hTiled);
+
+  void matlabToYuvTilesSse2(unsigned char *const planes[3], 
+                            int const strides[3],
+                            unsigned char const *const rgb[3], int h,
+                            YuvSubsampling subsampling, bool doChroma,
+                            RgbCoeffs const &ky, RgbCoeffs const &ku,
+                            RgbCoeffs const &kv, int wTiled, int hTiled);
+
+  void planeToMatlabTilesSse2(unsigned char *out, unsigned char const *in,
+                              int h, int inStride, int wTiled, int hTiled);
+
+  void packedToMatlabTilesSse2(unsigned char *out, unsigned char const *in,
+                               int w, int h, int d, int inStride, 
+                               bool reverseChannels, int wTiled, int hTiled);
+
+}; /* namespace VideoIO */
+
+#endif
@@ -0,0 +1,386 @@
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include "ColorConversionKernels.h"
+
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace VideoIO 
+{
+
+#ifdef __SSE2__
+
+  /** Transposes a 16x16 block of bytes.  Row i of src (at src+i*srcStride)
+   *  becomes column i of dst, where column j of dst is stored at 
+   *  dst+j*dstStride. */
+  static inline void transpose16x16(unsigned char const *src, int srcStride,
+                                    unsigned char *dst, int dstStride)
+  {
+    __m128i a[16], b[16];
+    for (int i=0; i<16; i++) {
+      a[i] = _mm_loadu_si128((__m128i const*)(src + i*srcStride));
+    }
+    // b[2p+hh] = columns 8hh..8hh+7 of rows 2p and 2p+1, interleaved
+    for (int p=0; p<8; p++) {
+      b[2*p]   = _mm_unpacklo_epi8(a[2*p], a[2*p+1]);
+      b[2*p+1] = _mm_unpackhi_epi8(a[2*p], a[2*p+1]);
+    }
+    // a[4q+k] = columns 4k..4k+3 of rows 4q..4q+3
+    for (int q=0; q<4; q++) {
+      for (int hh=0; hh<2; hh++) {
+        __m128i const lo = b[2*(2*q)   + hh];
+        __m128i const hi = b[2*(2*q+1) + hh];
+        a[4*q + 2*hh]     = _mm_unpacklo_epi16(lo, hi);
+        a[4*q + 2*hh + 1] = _mm_unpackhi_epi16(lo, hi);
+      }
+    }
+    // b[8o+m] = columns 2m and 2m+1 of rows 8o..8o+7
+    for (int o=0; o<2; o++) {
+      for (int k=0; k<4; k++) {
+        __m128i const lo = a[4*(2*o)   + k];
+        __m128i const hi = a[4*(2*o+1) + k];
+        b[8*o + 2*k]     = _mm_unpacklo_epi32(lo, hi);
+        b[8*o + 2*k + 1] = _mm_unpackhi_epi32(lo, hi);
+      }
+    }
+    // column 2m and 2m+1 of all 16 rows
+    for (int m=0; m<8; m++) {
+      _mm_storeu_si128((__m128i*)(dst + (2*m)*dstStride),
+                       _mm_unpacklo_epi64(b[m], b[8+m]));
+      _mm_storeu_si128((__m128i*)(dst + (2*m+1)*dstStride),
+                       _mm_unpackhi_epi64(b[m], b[8+m]));
+    }
+  }
+
+  struct SimdCoeffs {
+    __m128i yMul, yOff, vr, ug, vg, ub, round;
+    bool    ubExtra;
+  };
+
+  static inline SimdCoeffs toSimd(YuvCoeffs const &k) {
+    SimdCoeffs s;
+    s.yMul    = _mm_set1_epi16((short)k.yMul);
+    s.yOff    = _mm_set1_epi16((short)k.yOff);
+    s.vr      = _mm_set1_epi16((short)k.vr);
+    s.ug      = _mm_set1_epi16((short)k.ug);
+    s.vg      = _mm_set1_epi16((short)k.vg);
+    s.ub      = _mm_set1_epi16((short)k.ub);
+    s.round   = _mm_set1_epi16(32);
+    s.ubExtra = k.ubExtra;
+    return s;
+  }
+
+  /** Converts 8 pixels held in 16-bit lanes: y7 = Y<<7, us = (U-128)*256, 
+   *  vs = (V-128)*256.  The results are 16-bit values, not yet packed. */
+  static inline void yuvPixels8(SimdCoeffs const &k, 
+                                __m128i y7, __m128i us, __m128i vs,
+                                __m128i &r, __m128i &g, __m128i &b)
+  {
+    __m128i const yt = _mm_sub_epi16(_mm_mulhi_epu16(y7, k.yMul), k.yOff);
+    r = _mm_adds_epi16(yt, _mm_mulhi_epi16(vs, k.vr));
+    g = _mm_subs_epi16(_mm_subs_epi16(yt, _mm_mulhi_epi16(us, k.ug)),
+                       _mm_mulhi_epi16(vs, k.vg));
+    b = _mm_adds_epi16(yt, _mm_mulhi_epi16(us, k.ub));
+    if (k.ubExtra) b = _mm_adds_epi16(b, _mm_srai_epi16(us, 1));
+    r = _mm_srai_epi16(_mm_adds_epi16(r, k.round), 6);
+    g = _mm_srai_epi16(_mm_adds_epi16(g, k.round), 6);
+    b = _mm_srai_epi16(_mm_adds_epi16(b, k.round), 6);
+  }
+
+  /** Converts one 16x16 tile whose top-left corner is (x0,y0). */
+  static inline void yuvTile16(unsigned char *out, int w, int h,
+                               unsigned char const *const planes[3], 
+                               int const strides[3],
+                               YuvSubsampling subsampling, 
+                               SimdCoeffs const &k, int x0, int y0)
+  {
+    unsigned char rt[TILE*TILE] __attribute__((aligned(16)));
+    unsigned char gt[TILE*TILE] __attribute__((aligned(16)));
+    unsigned char bt[TILE*TILE] __attribute__((aligned(16)));
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const bias = _mm_set1_epi8((char)0x80);
+    int const     sy   = chromaShiftY(subsampling);
+
+    for (int ty=0; ty<TILE; ty++) {
+      int const y = y0 + ty;
+      __m128i const yv = 
+        _mm_loadu_si128((__m128i const*)(planes[0] + y*strides[0] + x0));
+      __m128i uv, vv;
+      if (subsampling == YUV_444) {
+        uv = _mm_loadu_si128(
+          (__m128i const*)(planes[1] + (y>>sy)*strides[1] + x0));
+        vv = _mm_loadu_si128(
+          (__m128i const*)(planes[2] + (y>>sy)*strides[2] + x0));
+      } else {
+        // 8 chroma samples, each covering 2 pixels
+        uv = _mm_loadl_epi64(
+          (__m128i const*)(planes[1] + (y>>sy)*strides[1] + x0/2));
+        vv = _mm_loadl_epi64(
+          (__m128i const*)(planes[2] + (y>>sy)*strides[2] + x0/2));
+        uv = _mm_unpacklo_epi8(uv, uv);
+        vv = _mm_unpacklo_epi8(vv, vv);
+      }
+      // (C-128) as a signed byte, moved to the high byte of each 16-bit
+      // lane gives (C-128)*256.
+      uv = _mm_xor_si128(uv, bias);
+      vv = _mm_xor_si128(vv, bias);
+
+      __m128i rLo, gLo, bLo, rHi, gHi, bHi;
+      yuvPixels8(k, _mm_slli_epi16(_mm_unpacklo_epi8(yv, zero), 7),
+                 _mm_unpacklo_epi8(zero, uv), _mm_unpacklo_epi8(zero, vv),
+                 rLo, gLo, bLo);
+      yuvPixels8(k, _mm_slli_epi16(_mm_unpackhi_epi8(yv, zero), 7),
+                 _mm_unpackhi_epi8(zero, uv), _mm_unpackhi_epi8(zero, vv),
+                 rHi, gHi, bHi);
+      _mm_store_si128((__m128i*)(rt + ty*TILE), _mm_packus_epi16(rLo, rHi));
+      _mm_store_si128((__m128i*)(gt + ty*TILE), _mm_packus_epi16(gLo, gHi));
+      _mm_store_si128((__m128i*)(bt + ty*TILE), _mm_packus_epi16(bLo, bHi));
+    }
+
+    unsigned char *o = out + x0*h + y0;
+    transpose16x16(rt, TILE, o,         h);
+    transpose16x16(gt, TILE, o + w*h,   h);
+    transpose16x16(bt, TILE, o + 2*w*h, h);
+  }
+
+  struct SimdRgbCoeffs {
+    __m128i rg, b0, off, shift;
+  };
+
+  static inline SimdRgbCoeffs toSimd(RgbCoeffs const &k, int shift) {
+    SimdRgbCoeffs s;
+    s.rg    = _mm_set_epi16((short)k.g, (short)k.r, (short)k.g, (short)k.r,
+                            (short)k.g, (short)k.r, (short)k.g, (short)k.r);
+    s.b0    = _mm_set_epi16(0, (short)k.b, 0, (short)k.b, 
+                            0, (short)k.b, 0, (short)k.b);
+    s.off   = _mm_set1_epi32((k.off << shift) + (1 << (shift-1)));
+    s.shift = _mm_cvtsi32_si128(shift);
+    return s;
+  }
+
+  /** Evaluates rgbSample for 8 pixels (or sums of pixels) held in 16-bit
+   *  lanes.  The results are 16-bit values, not yet packed. */
+  static inline __m128i rgbSamples8(SimdRgbCoeffs const &k, 
+                                    __m128i r, __m128i g, __m128i b)
+  {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpacklo_epi16(r, g), k.rg),
+      _mm_madd_epi16(_mm_unpacklo_epi16(b, zero), k.b0));
+    __m128i hi = _mm_add_epi32(
+      _mm_madd_epi16(_mm_unpackhi_epi16(r, g), k.rg),
+      _mm_madd_epi16(_mm_unpackhi_epi16(b, zero), k.b0));
+    lo = _mm_sra_epi32(_mm_add_epi32(lo, k.off), k.shift);
+    hi = _mm_sra_epi32(_mm_add_epi32(hi, k.off), k.shift);
+    return _mm_packs_epi32(lo, hi);
+  }
+
+  /** Converts the 16x16 tile of Matlab planes whose top-left corner is 
+   *  (x0,y0).  The chroma planes are left alone unless doChroma is set. */
+  static inline void matlabTile16(unsigned char *const planes[3], 
+                                  int const strides[3],
+                                  unsigned char const *const rgb[3], int h,
+                                  YuvSubsampling subsampling, bool doChroma,
+                                  SimdRgbCoeffs const &ky, 
+                                  SimdRgbCoeffs const &ku, 
+                                  SimdRgbCoeffs const &kv, int x0, int y0)
+  {
+    unsigned char t[3][TILE*TILE] __attribute__((aligned(16)));
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const ones = _mm_set1_epi16(1);
+
+    // Transpose each channel into a row-major tile
+    for (int c=0; c<3; c++) {
+      transpose16x16(rgb[c] + x0*h + y0, h, t[c], TILE);
+    }
+
+    for (int ty=0; ty<TILE; ty++) {
+      __m128i const r = _mm_load_si128((__m128i const*)(t[0] + ty*TILE));
+      __m128i const g = _mm_load_si128((__m128i const*)(t[1] + ty*TILE));
+      __m128i const b = _mm_load_si128((__m128i const*)(t[2] + ty*TILE));
+      __m128i const rLo = _mm_unpacklo_epi8(r, zero);
+      __m128i const gLo = _mm_unpacklo_epi8(g, zero);
+      __m128i const bLo = _mm_unpacklo_epi8(b, zero);
+      __m128i const rHi = _mm_unpackhi_epi8(r, zero);
+      __m128i const gHi = _mm_unpackhi_epi8(g, zero);
+      __m128i const bHi = _mm_unpackhi_epi8(b, zero);
+      int const y = y0 + ty;
+      _mm_storeu_si128((__m128i*)(planes[0] + y*strides[0] + x0),
+                       _mm_packus_epi16(rgbSamples8(ky, rLo, gLo, bLo),
+                                        rgbSamples8(ky, rHi, gHi, bHi)));
+      if (doChroma && subsampling == YUV_444) {
+        _mm_storeu_si128((__m128i*)(planes[1] + y*strides[1] + x0),
+                         _mm_packus_epi16(rgbSamples8(ku, rLo, gLo, bLo),
+                                          rgbSamples8(ku, rHi, gHi, bHi)));
+        _mm_storeu_si128((__m128i*)(planes[2] + y*strides[2] + x0),
+                         _mm_packus_epi16(rgbSamples8(kv, rLo, gLo, bLo),
+                                          rgbSamples8(kv, rHi, gHi, bHi)));
+      }
+    }
+    if (!doChroma || subsampling == YUV_444) return;
+
+    // Subsampled chroma: sum the 1 or 2 rows each sample covers, then 
+    // add horizontal neighbors (pmaddwd with ones) to get 8 sums per row.
+    int const sy = chromaShiftY(subsampling);
+    for (int ty=0; ty<TILE; ty+=(1<<sy)) {
+      __m128i lo[3], hi[3], sums[3];
+      for (int c=0; c<3; c++) {
+        __m128i const a = _mm_load_si128((__m128i const*)(t[c] + ty*TILE));
+        lo[c] = _mm_unpacklo_epi8(a, zero);
+        hi[c] = _mm_unpackhi_epi8(a, zero);
+        if (sy) {
+          __m128i const a2 = 
+            _mm_load_si128((__m128i const*)(t[c] + (ty+1)*TILE));
+          lo[c] = _mm_add_epi16(lo[c], _mm_unpacklo_epi8(a2, zero));
+          hi[c] = _mm_add_epi16(hi[c], _mm_unpackhi_epi8(a2, zero));
+        }
+        sums[c] = _mm_packs_epi32(_mm_madd_epi16(lo[c], ones),
+                                  _mm_madd_epi16(hi[c], ones));
+      }
+      int const cy = (y0 + ty) >> sy;
+      __m128i const u = rgbSamples8(ku, sums[0], sums[1], sums[2]);
+      __m128i const v = rgbSamples8(kv, sums[0], sums[1], sums[2]);
+      _mm_storel_epi64((__m128i*)(planes[1] + cy*strides[1] + x0/2),
+                       _mm_packus_epi16(u, u));
+      _mm_storel_epi64((__m128i*)(planes[2] + cy*strides[2] + x0/2),
+                       _mm_packus_epi16(v, v));
+    }
+  }
+
+  bool sse2KernelsBuilt() { return true; }
+
+  void yuvToMatlabTilesSse2(unsigned char *out, int w, int h,
+                            unsigned char const *const planes[3], 
+                            int const strides[3], YuvSubsampling subsampling,
+                            YuvCoeffs const &k, int wTiled, int hTiled)
+  {
+    SimdCoeffs const sk = toSimd(k);
+    for (int y0=0; y0<hTiled; y0+=TILE) {
+      for (int x0=0; x0<wTiled; x0+=TILE) {
+        yuvTile16(out, w, h, planes, strides, subsampling, sk, x0, y0);
+      }
+    }
+  }
+
+  void matlabToYuvTilesSse2(unsigned char *const planes[3], 
+                            int const strides[3],
+                            unsigned char const *const rgb[3], int h,
+                            YuvSubsampling subsampling, bool doChroma,
+                            RgbCoeffs const &ky, RgbCoeffs const &ku,
+                            RgbCoeffs const &kv, int wTiled, int hTiled)
+  {
+    int const shift = 14 + chromaShiftX(subsampling) + 
+                      chromaShiftY(subsampling);
+    SimdRgbCoeffs const simdY = toSimd(ky, 14);
+    SimdRgbCoeffs const simdU = toSimd(ku, shift);
+    SimdRgbCoeffs const simdV = toSimd(kv, shift);
+    for (int y0=0; y0<hTiled; y0+=TILE) {
+      for (int x0=0; x0<wTiled; x0+=TILE) {
+        matlabTile16(planes, strides, rgb, h, subsampling, doChroma, 
+                     simdY, simdU, simdV, x0, y0);
+      }
+    }
+  }
+
+  void planeToMatlabTilesSse2(unsigned char *out, unsigned char const *in,
+                              int h, int inStride, int wTiled, int hTiled)
+  {
+    for (int y0=0; y0<hTiled; y0+=TILE) {
+      for (int x0=0; x0<wTiled; x0+=TILE) {
+        transpose16x16(in + y0*inStride + x0, inStride, out + x0*h + y0, h);
+      }
+    }
+  }
+
+  void packedToMatlabTilesSse2(unsigned char *out, unsigned char const *in,
+                               int w, int h, int d, int inStride, 
+                               bool reverseChannels, int wTiled, int hTiled)
+  {
+    unsigned char tiles[4][TILE*TILE] __attribute__((aligned(16)));
+    for (int y0=0; y0<hTiled; y0+=TILE) {
+      for (int x0=0; x0<wTiled; x0+=TILE) {
+        // Deinterleave the tile into one row-major buffer per channel...
+        for (int ty=0; ty<TILE; ty++) {
+          unsigned char const *i = in + (y0+ty)*inStride + x0*d;
+          if (d == 3) {
+            for (int tx=0; tx<TILE; tx++, i+=3) {
+              tiles[0][ty*TILE + tx] = i[0];
+              tiles[1][ty*TILE + tx] = i[1];
+              tiles[2][ty*TILE + tx] = i[2];
+            }
+          } else {
+            for (int tx=0; tx<TILE; tx++) {
+              for (int c=0; c<d; c++) tiles[c][ty*TILE + tx] = *i++;
+            }
+          }
+        }
+        // ...then transpose each channel into its Matlab plane.
+        for (int c=0; c<d; c++) {
+          int const outC = reverseChannels ? (d-1-c) : c;
+          transpose16x16(tiles[c], TILE, 
+                         out + (outC*w + x0)*h + y0, h);
+        }
+      }
+    }
+  }
+
+#else /* __SSE2__ */
+
+  // Built without SSE2 (SIMD_FLAGS was cleared, e.g. for a non-x86 
+  // machine), so the dispatcher in ColorConversion.cpp never calls these.
+  bool sse2KernelsBuilt() { return false; }
+
+  void yuvToMatlabTilesSse2(unsigned char *, int, int,
+                            unsigned char const *const [3], int const [3], 
+                            YuvSubsampling, YuvCoeffs const &, int, int) {}
+
+  void matlabToYuvTilesSse2(unsigned char *const [3], int const [3],
+                            unsigned char const *const [3], int,
+                            YuvSubsampling, bool, RgbCoeffs const &, 
+                            RgbCoeffs const &, RgbCoeffs const &, 
+                            int, int) {}
+
+  void planeToMatlabTilesSse2(unsigned char *, unsigned char const *,
+                              int, int, int, int) {}
+
+  void packedToMatlabTilesSse2(unsigned char *, unsigned char const *,
+                               int, int, int, int, bool, int, int) {}
+
+#endif /* __SSE2__ */
+
+}; /* namespace VideoIO */
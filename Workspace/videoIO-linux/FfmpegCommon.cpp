@@ -38,6 +38,7 @@ SOFTWARE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #if LIBAVUTIL_VERSION_INT < ((49<<16)+(2<<8)+0)
 // At svn revision 7614, the expanded log levels were introduced.  This 
@@ -70,25 +71,27 @@ namespace VideoIO
     }
   }
 
-  // This buffer is *not* threadsafe.  If any method or function in this file
-  // may be accessed from multiple threads, we need to associate an error
-  // buffer with each object instance and figure out how to get ffLog to stuff
-  // the data into the right object in a threadsafe manner.  Since this file
-  // is meant to be used from Matlab, this is not an issue at the moment.
-  char realBuffer[16384];
-  char * const ffBuffer = realBuffer;
+  // One buffer per thread: ffLog is called from whichever thread is
+  // running ffmpeg code at the moment, and FfRecoverableCheckMsg reads the
+  // buffer from that same thread.
+  __thread char ffBuffer[FF_BUFFER_SIZE];
+
+  static pthread_mutex_t codecMutex = PTHREAD_MUTEX_INITIALIZER;
+
+  FfmpegCodecLock::FfmpegCodecLock()  { pthread_mutex_lock(&codecMutex); }
+  FfmpegCodecLock::~FfmpegCodecLock() { pthread_mutex_unlock(&codecMutex); }
 
   // ffmpeg logging callback (see <ffmpeg/log.h>)
   static void ffLog(void *avcl, int level, const char *fmt, va_list ap) {
-    static int printPrefix = 1;
+    static __thread int printPrefix = 1;
     if (level < AV_LOG_VERBOSE) {
       AVClass* avc = avcl ? *(AVClass**)avcl : NULL;
       
-      char tmp[sizeof(realBuffer)];
+      char tmp[sizeof(ffBuffer)];
       tmp[sizeof(tmp)-1] = '\0';
       
       if (printPrefix && avc) {
-        strncat(realBuffer, "                       ", sizeof(realBuffer)-1);
+        strncat(ffBuffer, "                       ", sizeof(ffBuffer)-1);
         snprintf(tmp, sizeof(tmp)-1, "[%s @ %p] ", avc->item_name(avcl), avc);
       }
       
@@ -106,7 +109,7 @@ namespace VideoIO
         VERBOSE(tmp);
       }
 
-      strncat(realBuffer, tmp, sizeof(realBuffer)-1); 
+      strncat(ffBuffer, tmp, sizeof(ffBuffer)-1); 
     }
   }
   
@@ -264,15 +267,19 @@ namespace VideoIO
     return ocodecs;
   }
 
+  static void ffmpegInit()
+  {
+    av_register_all();
+    hijackLog();
+    enumerateFormats();
+  }
+
   void ffmpegInitIfNeeded()
   {
-    static bool registered = false;
-    if (!registered) {
-      av_register_all();
-      hijackLog();
-      enumerateFormats();
-      registered = true;
-    }
+    // Video objects may be constructed concurrently by server worker 
+    // threads, so registration must happen exactly once.
+    static pthread_once_t registered = PTHREAD_ONCE_INIT;
+    pthread_once(&registered, ffmpegInit);
   }
 
   AVCodecContext *getCodecFromStream(AVStream *s) { 
@@ -283,6 +290,21 @@ namespace VideoIO
 #endif
   }
   
+  bool getYuvLayout(PixelFormat fmt, 
+                    YuvSubsampling &subsampling, YuvRange &range)
+  {
+    switch (fmt) {
+    case PIX_FMT_YUV420P:  subsampling = YUV_420; range = YUV_MPEG_RANGE; break;
+    case PIX_FMT_YUVJ420P: subsampling = YUV_420; range = YUV_JPEG_RANGE; break;
+    case PIX_FMT_YUV422P:  subsampling = YUV_422; range = YUV_MPEG_RANGE; break;
+    case PIX_FMT_YUVJ422P: subsampling = YUV_422; range = YUV_JPEG_RANGE; break;
+    case PIX_FMT_YUV444P:  subsampling = YUV_444; range = YUV_MPEG_RANGE; break;
+    case PIX_FMT_YUVJ444P: subsampling = YUV_444; range = YUV_JPEG_RANGE; break;
+    default: return false;
+    }
+    return true;
+  }
+
 #if (!((LIBAVCODEC_VERSION_INT > 0x000409) || (LIBAVCODEC_VERSION_INT == 0x000409 && LIBAVCODEC_BUILD >= 4754)))
   // av_rescale_q was introduced in svn revision 4168
   int64_t av_rescale_q(int64_t a, AVRational bq, AVRational cq) {
@@ -38,6 +38,7 @@ SOFTWARE.
 */
 
 #include "debug.h"
+#include "ColorConversion.h"
 
 // FFMPEG Includes
 extern "C" {
@@ -86,14 +87,36 @@ namespace VideoIO {
 #define FfRecoverableCheck(testCond) \
   FfRecoverableCheckMsg(testCond, #testCond)
 
-  // Internal buffer: do not use directly.  Note: it's not threadsafe. 
-  extern char * const ffBuffer;
+  // Internal buffer: do not use directly.  Each thread has its own copy so
+  // that ffmpeg log messages end up in the error message of the thread that
+  // generated them.
+  static const int FF_BUFFER_SIZE = 16384;
+  extern __thread char ffBuffer[FF_BUFFER_SIZE];
+
+  // avcodec_open and avcodec_close (and therefore av_find_stream_info and 
+  // av_close_input_file, which may call them) are not reentrant in ffmpeg.
+  // Construct one of these on the stack around any such calls when video
+  // objects may be used from more than one thread (e.g. the multithreaded
+  // popen2 server).
+  class FfmpegCodecLock {
+  public:
+    FfmpegCodecLock();
+    ~FfmpegCodecLock();
+  private:
+    FfmpegCodecLock(FfmpegCodecLock const &);
+    FfmpegCodecLock &operator=(FfmpegCodecLock const &);
+  };
 
   // Different versions of ffmpeg have the codec context as either a 
   // part of the AVStream struct or as a pointer from AVStream.  This
   // function abstracts the version incompatibilities.
   extern AVCodecContext *getCodecFromStream(AVStream *s);
 
+  // Tells whether yuvToMatlab and matlabToYuv can work directly with a 
+  // pixel format, and if so, what the format's layout is.
+  extern bool getYuvLayout(PixelFormat fmt, 
+                           YuvSubsampling &subsampling, YuvRange &range);
+
 #if (!((LIBAVCODEC_VERSION_INT > 0x000409) || (LIBAVCODEC_VERSION_INT == 0x000409 && LIBAVCODEC_BUILD >= 4754)))
   // av_rescale_q was introduced in svn revision 4168
   // safe a*b/c computation
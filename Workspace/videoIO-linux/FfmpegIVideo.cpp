@@ -35,10 +35,15 @@ SOFTWARE.
 */
 
 #include <iostream>
+#include <algorithm>
 #include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "FfmpegIVideo.h"
+#include "ColorConversion.h"
 #include "registry.h"
 #include "parse.h"
+#include "cachedir.h"
 
 using namespace std;
 
@@ -59,178 +64,577 @@ namespace VideoIO
     vector<T>(v).swap(v);
   }
 
-  static inline int64_t frameToTimestamp(AVCodecContext const *pCodecCtx, 
+  /** Upper bound on the number of decoder threads we'll ask for when the
+   *  user lets us choose automatically. */
+  static const int MAX_AUTO_DECODE_THREADS = 16;
+
+  /** Upper bound on the number of delayed frames we will try to flush out
+   *  of a codec at the end of the file.  Real codecs hold at most a handful
+   *  (B-frame reordering plus one per frame-level thread); this just keeps
+   *  a misbehaving codec from producing frames forever. */
+  static const int MAX_DELAYED_FRAMES = 64;
+
+  // Versions of libavcodec that let us ask decoders to discard frames.
+  // The skip_* fields were introduced after 0.4.9-pre1 used for the Debian
+  // Sarge build, but before the version number was changed from 0.4.9 (svn
+  // revision 4440).
+#if (LIBAVCODEC_VERSION_INT > 0x000409) || (LIBAVCODEC_VERSION_INT == 0x000409 && LIBAVCODEC_BUILD >= 4758)
+#  define VIDEO_READER_HAS_SKIP_FRAME
+#endif
+
+  /** Decoded frames shared by every reader in this process that was opened
+   *  with sharedFrameCache.  A server running as a daemon (see 
+   *  mexServerStdio.cpp) can then hand one client frames that another 
+   *  client has already decoded.  Its size is the largest frameCacheMB 
+   *  any of those readers asked for. */
+  typedef std::pair<std::string, int>    SharedFrameKey;
+  static BasicFrameCache<SharedFrameKey> sharedFrames;
+  static pthread_mutex_t                 sharedFramesMutex = 
+    PTHREAD_MUTEX_INITIALIZER;
+
+  /** Converts between 0-indexed frame numbers and timestamps in 
+   *  milliseconds, assuming a constant frame rate of fps frames per 
+   *  second. */
+  static inline int64_t frameToTimestamp(AVRational const &fps, 
                                          int64_t frame)
   {
-  #if LIBAVCODEC_VERSION_INT < ((51<<16)+(7<<8)+0)
-    return (int64_t)(1000 * frame * 
-                   pCodecCtx->frame_rate_base / pCodecCtx->frame_rate);
-  #else
-    return (int64_t)(1000 * frame * 
-                   pCodecCtx->time_base.num / pCodecCtx->time_base.den);
-  #endif
+    return (int64_t)(1000 * frame * fps.den / fps.num);
   }
   
-  static inline int64_t timestampToFrame(AVCodecContext const *pCodecCtx, 
+  static inline int64_t timestampToFrame(AVRational const &fps, 
                                          int64_t ts)
   {
-  #if LIBAVCODEC_VERSION_INT < ((51<<16)+(7<<8)+0)
-    int64_t f = (int64_t)(ts * pCodecCtx->frame_rate / 
-                      1000 / pCodecCtx->frame_rate_base);
-  #else
-    int64_t f = (int64_t)(ts * pCodecCtx->time_base.den /
-                      1000 / pCodecCtx->time_base.num);
-  #endif
+    int64_t f = (int64_t)(ts * fps.num / 1000 / fps.den);
     // Provide consistent handling of roundoff errors.  Example: at 30fps,
     // frame 10 --> 333.333...ms, which gets rounded down to 333ms.
     // If we then say timestampToFrame(...,333), we get frame 9, not
     // frame 10.  We choose to make the frame numbers authoritative 
     // and we make timestamp rounding consistent with the frame numbers.
-    if (ts == frameToTimestamp(pCodecCtx, f+1)) f++;
+    if (ts == frameToTimestamp(fps, f+1)) f++;
     return f;
   }
 
 
   FfmpegIVideo::FfmpegIVideo() :
     fname(""), 
-    currentFrameNumber(-1), pFormatCtx(NULL), 
+    currentFrameNumber(-1), cachedFrameNumber(-1), 
+    useSharedFrameCache(false), pFormatCtx(NULL), 
     videoStream(-1), pCodecCtx(NULL), pFrame(NULL), pFrameBGR(NULL), 
-    buffPosition(0), 
+    buffPosition(0), nBytesProcessed(0),
 #ifdef VIDEO_READER_USE_SWSCALER
-    imgConvertCtx(NULL), 
+    imgConvertCtx(NULL), imgScaleCtx(NULL),
 #endif
-    nHiddenFinalFrames(0), dropBadPackets(true)
+    nHiddenFinalFrames(0), dropBadPackets(true), grayOutput(false),
+    outWidth(0), outHeight(0), cropX(0), cropY(0), cropWidth(0), 
+    cropHeight(0), roiX(0), roiY(0), roiWidth(0), roiHeight(0),
+    frameWidth(0), frameHeight(0), lowres(0),
+    useKeyframeIndex(true), packetFrameCount(false), nIndexedFrames(-1),
+    decodeThreads(1), nFramesFlushedAtEof(0),
+    skipBudget(0), decoderHasOutput(false), nFramesDecoded(0), 
+    nFramesSkipped(0),
+    prefetchFrames(0), prefetchRunning(false), prefetchHead(0), 
+    prefetchCount(0), prefetchStopRequested(false), prefetchDone(false),
+    prefetchFatal(false)
   { 
     TRACE;
     packet.data = NULL;
+    pthread_mutex_init(&prefetchMutex, NULL);
+    pthread_cond_init(&prefetchFrameReady, NULL);
+    pthread_cond_init(&prefetchSlotFree, NULL);
     // Register all formats and codecs
     ffmpegInitIfNeeded();
   }
 
-  /** Converts C-style BGR images to Matlab's preferred byte layout for images.
-   * I've optimized it as much as I thought I reasonably could.  It turns out
-   * that using the dy pointer arithmetic on bgrData yields substantial 
-   * performance benefits (15-25% faster reading benchmark speeds), but 
-   * additional arithmetic with c or x yields no benefits or even negative
-   * benefits.  These tests were run using Matlab 2007a on machines with the
-   * following specs:
-   *   2.2GHz Xeon (P4-based),     32-bit Linux 2.6.15, gcc 3.3.5
-   *   2.4GHz Core 2 Duo (Conroe), 64-bit Linux 2.6.17, gcc 3.3.5
-   *   2.33GHz Xeon (Woodcrest),   64-bit Linux 2.6.18, gcc 4.1.2
-   */
-  static inline void bgrToMatlab(unsigned char *out, 
-    unsigned char const *bgrData, 
-    int w, int h, int d)
-  {    
-    const int dy = w*d;
-    for (int c=0; c<d; c++) {
-      for (int x=0; x<w; x++) {
-        unsigned char const *b = &bgrData[x*d + (d-1-c)];
-        for (int y=0; y<h; y++) {
-          // We need to transpose from row-major to column-major, and do 
-          // BGR->RGB conversion.
-          //*out++ = bgrData[(x+y*w)*d + (d-1-c)]; // without unrolling
-          *out++ = *b; 
-          b += dy;
-        }
-      }
-    }
-  }
-
-  /*
-  int64_t FfmpegIVideo::currentTimestamp() const {
-    return frameToTimestamp(pCodecCtx, currentFrameNumber);
+  FfmpegIVideo::~FfmpegIVideo() 
+  { 
+    TRACE; 
+    close(); 
+    pthread_cond_destroy(&prefetchSlotFree);
+    pthread_cond_destroy(&prefetchFrameReady);
+    pthread_mutex_destroy(&prefetchMutex);
   }
-  */
 
   bool FfmpegIVideo::next() 
   {
     TRACE;
     VrRecoverableCheckMsg(isOpen(), "No video file is open.");
-    
+    // After a frame cache hit, the decoder is somewhere else.
+    if (cachedFrameNumber >= 0) return step(1);
+    if (prefetchFrames > 0) return nextPrefetched();
+    return nextLowLevel();
+  }
+
+  /** Decodes and converts the next frame on the caller's thread. */
+  bool FfmpegIVideo::nextLowLevel() 
+  {
+    TRACE;
     VERBOSE("About to get frame " << currentFrameNumber+1);
     if (!getNextFrame()) return false;
 
+    convertFrame(currentFrame);
+    currentFrameNumber++;
+    cacheCurrentFrame();
+    
+    return true;
+  }
+
+  /** Tells whether the first plane of a decoder pixel format is an 8-bit
+   *  luma (Y) plane that can be handed out as a grayscale image as-is. */
+  static bool hasLumaPlane(PixelFormat fmt)
+  {
+    YuvSubsampling subsampling;
+    YuvRange       range;
+    return getYuvLayout(fmt, subsampling, range) ||
+      fmt == PIX_FMT_GRAY8 || fmt == PIX_FMT_YUV410P || 
+      fmt == PIX_FMT_YUV411P;
+  }
+
+  /** Converts the frame most recently decoded into pFrame to Matlab's 
+   *  layout and stores it in out.  This is also where the region of 
+   *  interest is cropped out and scaled to the output size. */
+  void FfmpegIVideo::convertFrame(Frame &out)
+  {
+    TRACE;
     VERBOSE("About to convert frame"); 
 
+    // The region of interest in the decoded picture's coordinates (which
+    // are smaller than the file's if the decoder is running in lowres mode)
+    int const cx = roiX >> lowres;
+    int const cy = roiY >> lowres;
+    int const cw = std::min(-((-roiWidth)  >> lowres), pCodecCtx->width  - cx);
+    int const ch = std::min(-((-roiHeight) >> lowres), pCodecCtx->height - cy);
+    bool const rescale = (cw != width() || ch != height());
+
+    // For planar formats, we can crop by simply moving the plane pointers.
+    // Chroma offsets are rounded down for subsampled formats.
+    uint8_t *roiData[4]     = { NULL, NULL, NULL, NULL };
+    int      roiLinesize[4] = { 0, 0, 0, 0 };
+    bool const planar = hasLumaPlane(pCodecCtx->pix_fmt);
+    if (planar) {
+      int hShift, vShift;
+      avcodec_get_chroma_sub_sample(pCodecCtx->pix_fmt, &hShift, &vShift);
+      for (int p=0; p<3; p++) {
+        int const px = (p == 0) ? cx : (cx >> hShift);
+        int const py = (p == 0) ? cy : (cy >> vShift);
+        roiLinesize[p] = pFrame->linesize[p];
+        if (pFrame->data[p] != NULL) {
+          roiData[p] = pFrame->data[p] + py * roiLinesize[p] + px;
+        }
+      }
+    }
+
+    // In grayscale mode, the decoder's luma plane is the output image.
+    if (grayOutput && planar && !rescale) {
+      planeToMatlab(&out[0], roiData[0], width(), height(), roiLinesize[0]);
+      VERBOSE("Frame gotten and converted.");
+      return;
+    }
+
+    // Planar YUV (what nearly every codec produces) goes straight to 
+    // Matlab's layout in a single pass.
+    YuvSubsampling subsampling;
+    YuvRange       range;
+    if (!grayOutput && !rescale &&
+        getYuvLayout(pCodecCtx->pix_fmt, subsampling, range)) {
+      unsigned char const *const planes[3] = 
+        { roiData[0], roiData[1], roiData[2] };
+      int const strides[3] = 
+        { roiLinesize[0], roiLinesize[1], roiLinesize[2] };
+      yuvToMatlab(&out[0], width(), height(), planes, strides, 
+                  subsampling, range);
+      VERBOSE("Frame gotten and converted.");
+      return;
+    }
+
+    // Everything else is first converted to packed BGR (or to 8-bit gray)
+    // by ffmpeg.  Planar formats are cropped and scaled straight to the
+    // output size.  Other formats are converted at full size and cropped
+    // afterwards.  If they must also be scaled, that takes a second pass
+    // (see below).  The BGR buffer is only allocated if we ever need it.
+    PixelFormat const packedFmt = grayOutput ? PIX_FMT_GRAY8 : PIX_FMT_BGR24;
+    int const packedWidth  = planar ? width()  : pCodecCtx->width;
+    int const packedHeight = planar ? height() : pCodecCtx->height;
+    if (bgrData.size() != (size_t)(packedWidth * packedHeight * depth())) {
+      PRINTINFO("Creating bitmap image ("<<packedWidth<<"x"<<
+                packedHeight<<")...");
+      bgrData.resize(packedWidth * packedHeight * depth());
+      VrRecoverableCheck(depth() * packedWidth * packedHeight ==
+        avpicture_fill((AVPicture *)pFrameBGR, (uint8_t*)&bgrData[0], 
+                       packedFmt, packedWidth, packedHeight));
+    }
+
 #ifdef VIDEO_READER_USE_SWSCALER
     imgConvertCtx = sws_getCachedContext(imgConvertCtx,
                                          // what the decoder gives us
-                                         pCodecCtx->width, pCodecCtx->height, 
+                                         planar ? cw : pCodecCtx->width,
+                                         planar ? ch : pCodecCtx->height, 
                                          pCodecCtx->pix_fmt,
                                          // what we want
-                                         width(), height(), 
-                                         PIX_FMT_BGR24,
+                                         packedWidth, packedHeight, 
+                                         packedFmt,
                                          // how we want it
-                                         SWS_POINT, NULL, NULL, NULL);
+                                         rescale ? SWS_AREA : SWS_POINT, 
+                                         NULL, NULL, NULL);
     VrRecoverableCheckMsg(imgConvertCtx, 
-      "Could not initialize the colorspace converter to produce BGR output");
+      "Could not initialize the colorspace converter to produce " << 
+      (grayOutput ? "grayscale" : "BGR") << " output");
     FfRecoverableCheckMsg(
       sws_scale(imgConvertCtx, 
-                pFrame->data, pFrame->linesize, 0, pCodecCtx->height, 
+                planar ? roiData : pFrame->data, 
+                planar ? roiLinesize : pFrame->linesize, 
+                0, planar ? ch : pCodecCtx->height, 
                 pFrameBGR->data, pFrameBGR->linesize),
-      "Could not convert from the stream's pixel format to BGR.");
+      "Could not convert from the stream's pixel format to " << 
+      (grayOutput ? "grayscale." : "BGR."));
 #else
+    VrRecoverableCheckMsg(!rescale,
+      "This version of ffmpeg has no libswscale, so outWidth and outHeight "
+      "are only supported when the decoder can produce that size itself.");
     FfRecoverableCheck(
-      img_convert((AVPicture *)pFrameBGR, PIX_FMT_BGR24, (AVPicture*)pFrame, 
+      img_convert((AVPicture *)pFrameBGR, packedFmt, (AVPicture*)pFrame, 
                   pCodecCtx->pix_fmt, pCodecCtx->width, pCodecCtx->height));
 #endif
     VERBOSE("Frame gotten and converted.");
 
-    bgrToMatlab(&currentFrame[0], &bgrData[0], width(), height(), depth());
-      
-    currentFrameNumber++;
-    
+    unsigned char const *packed   = &bgrData[0];
+    int                  stride   = pFrameBGR->linesize[0];
+    if (!planar) {
+      // Crop the full-sized packed image
+      packed += cy * stride + cx * depth();
+#ifdef VIDEO_READER_USE_SWSCALER
+      if (rescale) {
+        // ...and scale it in a second pass
+        scaledData.resize(width() * height() * depth());
+        uint8_t *src[4]       = { (uint8_t*)packed, NULL, NULL, NULL };
+        int      srcStride[4] = { stride, 0, 0, 0 };
+        uint8_t *dst[4]       = { &scaledData[0], NULL, NULL, NULL };
+        int      dstStride[4] = { width() * depth(), 0, 0, 0 };
+        imgScaleCtx = sws_getCachedContext(imgScaleCtx,
+                                           cw, ch, packedFmt,
+                                           width(), height(), packedFmt,
+                                           SWS_AREA, NULL, NULL, NULL);
+        VrRecoverableCheckMsg(imgScaleCtx, 
+                              "Could not initialize the image scaler");
+        FfRecoverableCheckMsg(
+          sws_scale(imgScaleCtx, src, srcStride, 0, ch, dst, dstStride),
+          "Could not scale the image to " << width() << "x" << height());
+        packed = &scaledData[0];
+        stride = dstStride[0];
+      }
+#endif
+    }
+
+    // Transpose to column-major and do BGR->RGB conversion
+    packedToMatlab(&out[0], packed, width(), height(), depth(), stride, true);
+  }
+
+  /** next() when the decode-ahead thread is enabled: we just wait for the
+   *  thread to produce a frame and swap it into currentFrame.  If the thread
+   *  hit the end of the file or a decoding error, we behave exactly as 
+   *  nextLowLevel would have. */
+  bool FfmpegIVideo::nextPrefetched()
+  {
+    TRACE;
+    if (!prefetchRunning && !startPrefetch()) return nextLowLevel();
+
+    pthread_mutex_lock(&prefetchMutex);
+    while (prefetchCount == 0 && !prefetchDone) {
+      pthread_cond_wait(&prefetchFrameReady, &prefetchMutex);
+    }
+    if (prefetchCount > 0) {
+      // The worker never touches the slot at prefetchHead, so we may take
+      // it over.  The old currentFrame buffer becomes a free slot.
+      currentFrame.swap(prefetchRing[prefetchHead]);
+      prefetchHead = (prefetchHead + 1) % prefetchRing.size();
+      prefetchCount--;
+      currentFrameNumber++;
+      pthread_cond_signal(&prefetchSlotFree);
+      pthread_mutex_unlock(&prefetchMutex);
+      cacheCurrentFrame();
+      return true;
+    }
+    bool const        fatal  = prefetchFatal;
+    std::string const errMsg = prefetchErrMsg;
+    pthread_mutex_unlock(&prefetchMutex);
+
+    VERBOSE("Decode-ahead thread stopped: " << errMsg);
+    stopPrefetch();
+    close();
+    VrFatalCheckMsg(!fatal, errMsg);
+    return false;
+  }
+
+  /** Launches the decode-ahead thread.  The thread starts decoding right 
+   *  after the current decoder position.  Returns false if the thread could
+   *  not be created, in which case we just keep decoding synchronously. */
+  bool FfmpegIVideo::startPrefetch()
+  {
+    TRACE;
+    if (prefetchRing.size() != (size_t)prefetchFrames) {
+      prefetchRing.resize(prefetchFrames);
+    }
+    for (size_t i=0; i<prefetchRing.size(); i++) {
+      prefetchRing[i].resize(currentFrame.size());
+    }
+    prefetchHead          = 0;
+    prefetchCount         = 0;
+    prefetchStopRequested = false;
+    prefetchDone          = false;
+    prefetchFatal         = false;
+    prefetchErrMsg        = "";
+
+    if (pthread_create(&prefetchThread, NULL, prefetchThreadMain, this) != 0) {
+      PRINTWARN("Could not start the decode-ahead thread.  Decoding "
+                "synchronously instead.");
+      prefetchFrames = 0;
+      prefetchRing.clear();
+      return false;
+    }
+    prefetchRunning = true;
     return true;
   }
 
+  /** Stops the decode-ahead thread and throws away any frames it has 
+   *  queued up.  Afterwards, currentFrameNumber refers to the last frame 
+   *  the decoder produced, which may be ahead of the frame the user is 
+   *  looking at.  Callers must reposition the decoder (see step). */
+  void FfmpegIVideo::stopPrefetch()
+  {
+    TRACE;
+    if (!prefetchRunning) return;
+
+    pthread_mutex_lock(&prefetchMutex);
+    prefetchStopRequested = true;
+    pthread_cond_signal(&prefetchSlotFree);
+    pthread_mutex_unlock(&prefetchMutex);
+    pthread_join(prefetchThread, NULL);
+    prefetchRunning = false;
+
+    currentFrameNumber += (int)prefetchCount;
+    prefetchHead  = 0;
+    prefetchCount = 0;
+  }
+
+  void *FfmpegIVideo::prefetchThreadMain(void *self)
+  {
+    ((FfmpegIVideo*)self)->prefetchLoop();
+    return NULL;
+  }
+
+  /** Body of the decode-ahead thread.  It must never close the video or 
+   *  throw: errors are recorded and handed to the main thread. */
+  void FfmpegIVideo::prefetchLoop()
+  {
+    while (true) {
+      pthread_mutex_lock(&prefetchMutex);
+      while (prefetchCount == prefetchRing.size() && !prefetchStopRequested) {
+        pthread_cond_wait(&prefetchSlotFree, &prefetchMutex);
+      }
+      if (prefetchStopRequested) {
+        pthread_mutex_unlock(&prefetchMutex);
+        return;
+      }
+      size_t const slot = 
+        (prefetchHead + prefetchCount) % prefetchRing.size();
+      pthread_mutex_unlock(&prefetchMutex);
+
+      bool        ok    = false;
+      bool        fatal = false;
+      std::string errMsg("End of file reached.");
+      try {
+        ok = decodeNextFrame();
+        if (ok) convertFrame(prefetchRing[slot]);
+      } catch (VrRecoverableException const &e) {
+        ok     = false;
+        errMsg = e.message;
+      } catch (VrFatalError const &e) {
+        ok     = false;
+        fatal  = true;
+        errMsg = e.message;
+      } catch (...) {
+        ok     = false;
+        fatal  = true;
+        errMsg = "Unexpected exception in the decode-ahead thread.";
+      }
+
+      pthread_mutex_lock(&prefetchMutex);
+      if (ok) {
+        prefetchCount++;
+      } else {
+        prefetchDone   = true;
+        prefetchFatal  = fatal;
+        prefetchErrMsg = errMsg;
+      }
+      pthread_cond_signal(&prefetchFrameReady);
+      pthread_mutex_unlock(&prefetchMutex);
+      if (!ok) return;
+    }
+  }
+
   bool FfmpegIVideo::step(int frameDelta) 
   { 
     TRACE;
     VrRecoverableCheckMsg(isOpen(), "No video file is open.");
 
+    const int origFrame = currFrameNum();
+    const int toFrame   = origFrame + frameDelta;
+
     // Early exits
-    if (!(frameDelta + currentFrameNumber >= 0)) return false;
+    if (!(toFrame >= 0)) return false;
     if (frameDelta == 0) return true;
 
-    // Restart from the beginning for backward steps
-    string const filename(pFormatCtx->filename);
-    if (frameDelta < 0) {
-      frameDelta = currentFrameNumber + frameDelta + 1;
-      open(filename.c_str());
+    if (lookupCachedFrame(toFrame)) {
+      VERBOSE("Frame " << toFrame << " found in the frame cache.");
+      cachedFrameNumber = toFrame;
+      return true;
     }
 
-    // Speedy advance that avoids decoding frames
-    const int origFrame = currentFrameNumber;
-    if (!stepLowLevel(frameDelta)) {
+    // The rest works relative to the decoder's position, which differs 
+    // from origFrame after a cache hit.  (currentFrame then does not hold 
+    // the decoder's frame, so even toFrame == currentFrameNumber has to go
+    // through seekLowLevel.)
+    cachedFrameNumber = -1;
+    frameDelta        = toFrame - currentFrameNumber;
+
+    // Short forward steps can be served from the decode-ahead queue
+    if (prefetchRunning && frameDelta > 0) {
+      pthread_mutex_lock(&prefetchMutex);
+      bool const queued = ((size_t)frameDelta <= prefetchCount);
+      pthread_mutex_unlock(&prefetchMutex);
+      if (queued) {
+        while (frameDelta-- > 0) nextPrefetched();
+        return true;
+      }
+    }
+
+    string const filename(fname);
+    // From here on, currentFrameNumber tracks the decoder's position.  The
+    // decode-ahead thread is restarted by the next call to next().
+    stopPrefetch();
+    if (!seekLowLevel(toFrame)) {
       // If the step failed, try to go back to the frame we were previously
       // observing.  If that fails (e.g. because the file was corrupted or
       // deleted), then give up.
-      open(filename.c_str());
+      open(filename);
       if (origFrame >= 0) {
-        stepLowLevel(origFrame);
+        seekLowLevel(origFrame);
       }
       return false;
     }
     return true;  
   }
 
+  /** Makes toFrame the current frame.  If we have a keyframe index, we jump
+   *  straight to the closest keyframe at or before toFrame whenever that
+   *  saves us from decoding frames (always the case when going backwards).
+   *  Without an index, backward seeks restart from the beginning of the file
+   *  and forward seeks decode every intermediate frame. */
+  bool FfmpegIVideo::seekLowLevel(int toFrame)
+  {
+    TRACE;
+    int const k = findKeyframe(toFrame);
+    if (k >= 0 && (toFrame <= currentFrameNumber || 
+                   keyframes[k].frameNum > currentFrameNumber + 1)) {
+      if (seekToKeyframe(k)) {
+        return stepLowLevel(toFrame - currentFrameNumber);
+      }
+      // The demuxer didn't land where the index said it would.  The decoder
+      // state is now unknown, so start over from the beginning.
+      VERBOSE("Keyframe seek to frame " << keyframes[k].frameNum << 
+              " failed.  Falling back to a linear seek.");
+      string const filename(fname);
+      open(filename);
+    } else if (toFrame <= currentFrameNumber) {
+      string const filename(fname);
+      open(filename);
+    }
+    return stepLowLevel(toFrame - currentFrameNumber);
+  }
+
   bool FfmpegIVideo::stepLowLevel(int frameDelta)
   {
     TRACE;
     //VrRecoverableCheck(frameDelta > 0);
     frameDelta--;
-    while (frameDelta-- > 0) {
-      if (!getNextFrame()) return false;
-      currentFrameNumber++;
+    // Frames we pass over are never returned, so the decoder may throw away
+    // the non-reference ones (see decodeNextFrame).  The budget makes sure
+    // we never skip past the frame we want.
+    bool const skip = canSkipNonRefFrames();
+    while (frameDelta > 0) {
+      skipBudget = skip ? frameDelta - 1 : 0;
+      int const nSkippedBefore = nFramesSkipped;
+      if (!getNextFrame()) { skipBudget = 0; return false; }
+      int const nPassed = 1 + (nFramesSkipped - nSkippedBefore);
+      currentFrameNumber += nPassed;
+      frameDelta         -= nPassed;
     }
-    return next();
+    skipBudget = 0;
+    return nextLowLevel();
+  }
+
+  /** Tells whether the frames skipped by discarding non-reference frames 
+   *  can be counted reliably.  We need every discarded frame to show up as
+   *  exactly one decode call without output, in display order relative to
+   *  the frames that are output.  That holds for codecs with at most one 
+   *  frame of reordering delay (MPEG-1/2/4, simple H.264 B-frames) and no
+   *  frame-level threading. */
+  bool FfmpegIVideo::canSkipNonRefFrames() const
+  {
+#ifdef VIDEO_READER_HAS_SKIP_FRAME
+    if (pCodecCtx->has_b_frames > 1) return false;
+#  if LIBAVCODEC_VERSION_INT >= ((52<<16)+(112<<8)+0)
+    if (pCodecCtx->thread_count > 1 && 
+        (pCodecCtx->thread_type & FF_THREAD_FRAME)) return false;
+#  endif
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /** Switches the decoder between normal decoding and discarding 
+   *  non-reference frames (and their deblocking and IDCT work). */
+  void FfmpegIVideo::setSkipNonRefFrames(bool skip)
+  {
+#ifdef VIDEO_READER_HAS_SKIP_FRAME
+    AVDiscard const discard = skip ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    pCodecCtx->skip_frame       = discard;
+    pCodecCtx->skip_idct        = discard;
+    pCodecCtx->skip_loop_filter = discard;
+#endif
   }
 
   bool FfmpegIVideo::seek(int toFrame) 
   { 
     TRACE;
-    return step(toFrame - currentFrameNumber);
+    VrRecoverableCheckMsg(isOpen(), "No video file is open.");
+    return step(toFrame - currFrameNum());
+  }
+
+  /** When the index has every frame's pts, we seek to the last frame whose
+   *  pts is at or before the requested time, so variable frame rate files
+   *  are handled exactly.  Otherwise we assume a constant frame rate. */
+  bool FfmpegIVideo::seekTime(double seconds) 
+  { 
+    TRACE;
+    VrRecoverableCheckMsg(isOpen(), "No video file is open.");
+    if (seconds < 0) return false;
+
+    int toFrame;
+    if (!framePts.empty()) {
+      AVRational const tb = pFormatCtx->streams[videoStream]->time_base;
+      int64_t const ts = framePts[0] + 
+        (int64_t)floor(seconds * tb.den / tb.num + 0.5);
+      toFrame = (int)(upper_bound(framePts.begin(), framePts.end(), ts) - 
+                      framePts.begin()) - 1;
+    } else {
+      int64_t const ms = (int64_t)floor(seconds * 1000 + 0.5);
+      int64_t const f  = timestampToFrame(fpsRational(), ms);
+      if (f > numeric_limits<int>::max()) return false;
+      toFrame = (int)f;
+    }
+    VERBOSE("Time " << seconds << "s is frame " << toFrame);
+    return seek(toFrame);
   }
 
   IVideo::ExtraParamsAndStats FfmpegIVideo::extraParamsAndStats() const 
@@ -239,9 +643,135 @@ namespace VideoIO
     IVideo::ExtraParamsAndStats params;
     params["preciseFrames"]  = "-1";
     params["dropBadPackets"] = toString((int)dropBadPackets);
+    params["outputFormat"]   = grayOutput ? "gray" : "rgb";
+    params["outWidth"]       = toString(isOpen() ? frameWidth : outWidth);
+    params["outHeight"]      = toString(isOpen() ? frameHeight : outHeight);
+    params["cropRect"]       = isOpen() ?
+      (toString(roiX) + " " + toString(roiY) + " " + 
+       toString(roiWidth) + " " + toString(roiHeight)) :
+      (toString(cropX) + " " + toString(cropY) + " " + 
+       toString(cropWidth) + " " + toString(cropHeight));
+    params["lowres"]         = toString(lowres);
+    params["keyframeIndex"]  = toString((int)useKeyframeIndex);
+    params["indexFile"]      = keyframeIndexFilename();
+    params["numKeyframes"]   = toString((int)keyframes.size());
+    params["packetFrameCount"] = toString((int)packetFrameCount);
+    // Otherwise numFrames is the container's estimate
+    params["exactNumFrames"] = 
+      toString((int)(packetFrameCount && nIndexedFrames >= 0));
+    params["prefetchFrames"] = toString(prefetchFrames);
+    params["decodeThreads"]  = 
+      toString(isOpen() ? std::max(1, pCodecCtx->thread_count) : 
+                          decodeThreads);
+    // The decode-ahead thread may be updating the statistics
+    pthread_mutex_lock(&prefetchMutex);
+    int const     framesDecoded  = nFramesDecoded;
+    int const     framesSkipped  = nFramesSkipped;
+    int64_t const bytesProcessed = nBytesProcessed;
+    pthread_mutex_unlock(&prefetchMutex);
+    params["framesDecoded"]  = toString(framesDecoded);
+    params["framesSkipped"]  = toString(framesSkipped);
+    params["bytesProcessed"] = toString(bytesProcessed);
+    params["frameCacheMB"]   = 
+      toString(frameCache.getMaxBytes() / (1024.0 * 1024.0));
+    params["sharedFrameCache"] = toString((int)useSharedFrameCache);
+    if (useSharedFrameCache && !frameCacheKey.empty()) {
+      // The whole process's statistics
+      pthread_mutex_lock(&sharedFramesMutex);
+      params["frameCacheFrames"]    = toString(sharedFrames.numFrames());
+      params["frameCacheHits"]      = toString(sharedFrames.numHits());
+      params["frameCacheMisses"]    = toString(sharedFrames.numMisses());
+      params["frameCacheEvictions"] = toString(sharedFrames.numEvictions());
+      pthread_mutex_unlock(&sharedFramesMutex);
+    } else {
+      params["frameCacheFrames"]    = toString(frameCache.numFrames());
+      params["frameCacheHits"]      = toString(frameCache.numHits());
+      params["frameCacheMisses"]    = toString(frameCache.numMisses());
+      params["frameCacheEvictions"] = toString(frameCache.numEvictions());
+    }
     return params;
   }
 
+  /** If frameNum is in the frame cache, makes it the current frame and 
+   *  returns true. */
+  bool FfmpegIVideo::lookupCachedFrame(int frameNum)
+  {
+    if (!useSharedFrameCache || frameCacheKey.empty()) {
+      return frameCache.lookup(frameNum, currentFrame);
+    }
+    pthread_mutex_lock(&sharedFramesMutex);
+    bool const found = 
+      sharedFrames.lookup(SharedFrameKey(frameCacheKey, frameNum), 
+                          currentFrame);
+    pthread_mutex_unlock(&sharedFramesMutex);
+    return found;
+  }
+
+  /** Puts a copy of the current frame in the frame cache */
+  void FfmpegIVideo::cacheCurrentFrame()
+  {
+    if (!useSharedFrameCache || frameCacheKey.empty()) {
+      frameCache.insert(currentFrameNumber, currentFrame);
+      return;
+    }
+    pthread_mutex_lock(&sharedFramesMutex);
+    sharedFrames.insert(SharedFrameKey(frameCacheKey, currentFrameNumber),
+                        currentFrame);
+    pthread_mutex_unlock(&sharedFramesMutex);
+  }
+
+  /** Works out the region of interest, the output frame size, and how
+   *  much of the downscaling the decoder can do for us (lowres mode). 
+   *  Must be called before the codec is opened. */
+  void FfmpegIVideo::resolveOutputGeometry(AVCodec const *pCodec)
+  {
+    TRACE;
+    int const srcWidth  = pCodecCtx->width;
+    int const srcHeight = pCodecCtx->height;
+
+    if (cropWidth == 0) {
+      roiX = 0;  roiWidth  = srcWidth;
+      roiY = 0;  roiHeight = srcHeight;
+    } else {
+      VrRecoverableCheckMsg(cropX + cropWidth <= srcWidth &&
+                            cropY + cropHeight <= srcHeight,
+        "cropRect (" << cropX << "," << cropY << " " << cropWidth << "x" <<
+        cropHeight << ") does not fit in the " << srcWidth << "x" << 
+        srcHeight << " frames of \"" << fname << "\".");
+      roiX = cropX;  roiWidth  = cropWidth;
+      roiY = cropY;  roiHeight = cropHeight;
+    }
+
+    // If only one output dimension is given, preserve the aspect ratio.
+    frameWidth  = outWidth;
+    frameHeight = outHeight;
+    if (frameWidth == 0 && frameHeight == 0) {
+      frameWidth  = roiWidth;
+      frameHeight = roiHeight;
+    } else if (frameWidth == 0) {
+      frameWidth  = std::max(1, (int)floor((double)roiWidth * frameHeight / 
+                                           roiHeight + 0.5));
+    } else if (frameHeight == 0) {
+      frameHeight = std::max(1, (int)floor((double)roiHeight * frameWidth / 
+                                           roiWidth + 0.5));
+    }
+
+    // Let the decoder skip detail we'd throw away anyway: each lowres step
+    // halves the decoded size and is much cheaper than decoding the full
+    // frame and scaling it down afterwards.
+    lowres = 0;
+#if LIBAVCODEC_VERSION_INT >= ((52<<16)+(50<<8)+0)
+    while (lowres < pCodec->max_lowres &&
+           (roiWidth  >> (lowres+1)) >= frameWidth &&
+           (roiHeight >> (lowres+1)) >= frameHeight) {
+      lowres++;
+    }
+#endif
+    if (lowres > 0) {
+      PRINTINFO("decoding at 1/" << (1<<lowres) << " resolution...");
+    }
+  }
+
   void FfmpegIVideo::open(KeyValueMap &kvm) 
   {
     TRACE;
@@ -258,18 +788,86 @@ namespace VideoIO
         // for now, all ffmpeg seeks are precise, so ignore this option.
       } else if (strcasecmp("dropBadPackets", i->first.c_str())==0) {
         dropBadPackets = (bool)kvm.parseInt<int>("dropBadPackets");
+      } else if (strcasecmp("outputFormat", i->first.c_str())==0) {
+        if (strcasecmp("rgb", i->second.c_str())==0) {
+          grayOutput = false;
+        } else if (strcasecmp("gray", i->second.c_str())==0) {
+          grayOutput = true;
+        } else {
+          VrRecoverableThrow("outputFormat must be \"rgb\" or \"gray\", "
+                             "not \"" << i->second << "\".");
+        }
+      } else if (strcasecmp("outWidth", i->first.c_str())==0) {
+        outWidth = kvm.parseInt<int>("outWidth");
+        VrRecoverableCheckMsg(outWidth >= 0, 
+                              "outWidth must be non-negative.");
+      } else if (strcasecmp("outHeight", i->first.c_str())==0) {
+        outHeight = kvm.parseInt<int>("outHeight");
+        VrRecoverableCheckMsg(outHeight >= 0, 
+                              "outHeight must be non-negative.");
+      } else if (strcasecmp("cropRect", i->first.c_str())==0) {
+        int rect[4];
+        VrRecoverableCheckMsg(kvm.parseIntList<int>("cropRect", rect, 4),
+          "cropRect must have 4 values: x, y, width, and height, not \"" <<
+          i->second << "\".");
+        VrRecoverableCheckMsg(rect[0] >= 0 && rect[1] >= 0 && 
+                              rect[2] > 0 && rect[3] > 0,
+          "cropRect's x and y must be non-negative and its width and "
+          "height must be positive.");
+        cropX      = rect[0];
+        cropY      = rect[1];
+        cropWidth  = rect[2];
+        cropHeight = rect[3];
+      } else if (strcasecmp("keyframeIndex", i->first.c_str())==0) {
+        useKeyframeIndex = (bool)kvm.parseInt<int>("keyframeIndex");
+      } else if (strcasecmp("indexFile", i->first.c_str())==0) {
+        indexFname = i->second; // no type conversion necessary
+      } else if (strcasecmp("packetFrameCount", i->first.c_str())==0) {
+        packetFrameCount = (bool)kvm.parseInt<int>("packetFrameCount");
+      } else if (strcasecmp("decodeThreads", i->first.c_str())==0) {
+        decodeThreads = kvm.parseInt<int>("decodeThreads");
+        VrRecoverableCheckMsg(decodeThreads >= 0, 
+                              "decodeThreads must be non-negative.");
+      } else if (strcasecmp("prefetchFrames", i->first.c_str())==0) {
+        prefetchFrames = kvm.parseInt<int>("prefetchFrames");
+        VrRecoverableCheckMsg(prefetchFrames >= 0, 
+                              "prefetchFrames must be non-negative.");
+      } else if (strcasecmp("frameCacheMB", i->first.c_str())==0) {
+        double const mb = kvm.parseFloat<double>("frameCacheMB");
+        VrRecoverableCheckMsg(mb >= 0, "frameCacheMB must be non-negative.");
+        frameCache.setMaxBytes((size_t)(mb * 1024 * 1024));
+      } else if (strcasecmp("sharedFrameCache", i->first.c_str())==0) {
+        useSharedFrameCache = (bool)kvm.parseInt<int>("sharedFrameCache");
+      } else if (strcasecmp("pipelining", i->first.c_str())==0) {
+        // Handled by the popen2 mex client.  Direct plugins ignore it.
       } else {
         VrRecoverableThrow("Unrecognnized argument name: " << i->first);
       }
     }
 
-    // Do all the work to open the file.
+    if (useSharedFrameCache) {
+      pthread_mutex_lock(&sharedFramesMutex);
+      if (frameCache.getMaxBytes() > sharedFrames.getMaxBytes()) {
+        sharedFrames.setMaxBytes(frameCache.getMaxBytes());
+      }
+      pthread_mutex_unlock(&sharedFramesMutex);
+    }
+
+    // Do all the work to open the file.  The frame cache and the keyframe
+    // index survive the internal reopens done by some seeks, but not a new
+    // file (even one with the same name).
+    frameCache.clear();
+    fnameOfIndex.clear();
     open(fname);
   }
 
   void FfmpegIVideo::open(std::string const &fname) {
     TRACE;
-    if (isOpen()) close();
+    if (isOpen()) {
+      std::string const indexed = fnameOfIndex;
+      close();
+      if (indexed == fname) fnameOfIndex = indexed;
+    }
 
     try {
       this->fname = fname;
@@ -286,9 +884,12 @@ namespace VideoIO
       
       // Retrieve stream information
       PRINTINFO("finding stream info...");
-      FfRecoverableCheckMsg(av_find_stream_info(pFormatCtx),
-                            "Could not find the stream info for \"" << 
-                            fname << "\".");
+      {
+        FfmpegCodecLock lock;
+        FfRecoverableCheckMsg(av_find_stream_info(pFormatCtx),
+                              "Could not find the stream info for \"" << 
+                              fname << "\".");
+      }
   
       // Dump information about file onto standard error
 #ifdef PRINT_VERBOSES      
@@ -339,14 +940,12 @@ namespace VideoIO
       pCodecCtx->debug_mv          = 0;
       pCodecCtx->debug             = 0;
       pCodecCtx->workaround_bugs   = 1;
-      pCodecCtx->lowres            = 0;
+      resolveOutputGeometry(pCodec);
+      pCodecCtx->lowres            = lowres;
       if(pCodecCtx->lowres) pCodecCtx->flags |= CODEC_FLAG_EMU_EDGE;
       pCodecCtx->idct_algo         = FF_IDCT_AUTO;
       //if(fast) pCodecCtx->flags2  |= CODEC_FLAG2_FAST;
-#if (LIBAVCODEC_VERSION_INT > 0x000409) || (LIBAVCODEC_VERSION_INT == 0x000409 && LIBAVCODEC_BUILD >= 4758)
-      // These three fields were introduced after 0.4.9-pre1 used for the 
-      // Debian Sarge build, but before the version number was changed from 
-      // 0.4.9 (svn revision 4440).
+#ifdef VIDEO_READER_HAS_SKIP_FRAME
       pCodecCtx->skip_frame        = AVDISCARD_DEFAULT;
       pCodecCtx->skip_idct         = AVDISCARD_DEFAULT;
       pCodecCtx->skip_loop_filter  = AVDISCARD_DEFAULT;
@@ -359,12 +958,38 @@ namespace VideoIO
       pCodecCtx->error_resilience  = FF_ER_CAREFULL; // typo in 0.4.9
 #endif
       pCodecCtx->error_concealment = 3;
+
+      // Codec threading must be set up before the codec is opened.  Not all
+      // codecs can use multiple threads (older versions of libavcodec only
+      // do slice-level threading), in which case this is harmless.
+      int nThreads = decodeThreads;
+      if (nThreads == 0) {
+        long const nCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+        nThreads = (int)std::min<long>(std::max<long>(nCPUs, 1), 
+                                       MAX_AUTO_DECODE_THREADS);
+      }
+      if (nThreads > 1) {
+        PRINTINFO("using " << nThreads << " decoder threads...");
+#if LIBAVCODEC_VERSION_INT >= ((52<<16)+(112<<8)+0)
+        pCodecCtx->thread_count = nThreads;
+        pCodecCtx->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+#else
+        if (avcodec_thread_init(pCodecCtx, nThreads) < 0) {
+          PRINTWARN("Could not start " << nThreads << " decoder threads.  "
+                    "Decoding with a single thread instead.");
+          pCodecCtx->thread_count = 1;
+        }
+#endif
+      }
       
       // Open codec
       PRINTINFO("opening codec...");
-      FfRecoverableCheckMsg(avcodec_open(pCodecCtx, pCodec),
-                            "Could not open the codec for \"" << 
-                            fname << "\".");
+      {
+        FfmpegCodecLock lock;
+        FfRecoverableCheckMsg(avcodec_open(pCodecCtx, pCodec),
+                              "Could not open the codec for \"" << 
+                              fname << "\".");
+      }
     
       // Hack to correct wrong frame rates that seem to be generated by some 
       // codecs 
@@ -388,21 +1013,44 @@ namespace VideoIO
       PRINTINFO("allocating avframe struct...");
       VrRecoverableCheck((pFrameBGR = avcodec_alloc_frame()) != NULL);
     
-      // Allocate BGR adn Matlab buffers
-      PRINTINFO("Creating bitmap image ("<<pCodecCtx->width<<"x"<<
-                pCodecCtx->height<<")...");
-      bgrData.resize(pCodecCtx->width * pCodecCtx->height * depth());
-      currentFrame.resize(pCodecCtx->width * pCodecCtx->height * depth());
-  
-      // Assign appropriate parts of buffer to image planes in pFrameBGR
-      PRINTINFO("Setting up pixel transfer structure...");
-      VrRecoverableCheck(3 * pCodecCtx->width * pCodecCtx->height ==
-        avpicture_fill((AVPicture *)pFrameBGR, (uint8_t*)&bgrData[0], 
-                       PIX_FMT_BGR24, pCodecCtx->width, pCodecCtx->height));
+      // Allocate the Matlab buffer.  The BGR buffer is only allocated if 
+      // the decoder's pixel format requires it (see convertFrame).
+      currentFrame.resize(width() * height() * depth());
   
       packet.data = NULL;
       
-      nHiddenFinalFrames = guessNumHiddenFinalFrames(fourcc());
+      // Codecs that delay their output (B-frame reordering, frame 
+      // threading) give up their final frames when we flush them at the 
+      // end of the file (see decodeNextFrame), so none are hidden.
+      if (pCodec->capabilities & CODEC_CAP_DELAY) {
+        nHiddenFinalFrames = 0;
+      } else {
+        nHiddenFinalFrames = guessNumHiddenFinalFrames(fourcc());
+      }
+      nFramesFlushedAtEof = 0;
+      decoderHasOutput    = false;
+
+      // Internal reopens (e.g. after a failed step) reuse the existing index.
+      if ((useKeyframeIndex || packetFrameCount) && fnameOfIndex != fname) {
+        loadOrBuildKeyframeIndex();
+      }
+      // Every packet the scan counted can be decoded, so the FourCC-based
+      // guess does not apply to the packet count.
+      if (packetFrameCount && nIndexedFrames >= 0) nHiddenFinalFrames = 0;
+
+      // Readers may only share frames if they read the same version of the
+      // same file and convert its frames the same way.
+      frameCacheKey.clear();
+      struct stat vidStat;
+      if (stat(fname.c_str(), &vidStat) == 0) {
+        frameCacheKey = 
+          toString((long long)vidStat.st_size) + " " + 
+          toString((long long)vidStat.st_mtime) + " " + 
+          toString(videoStream) + " " + toString((int)grayOutput) + " " + 
+          toString(roiX) + " " + toString(roiY) + " " + 
+          toString(roiWidth) + " " + toString(roiHeight) + " " + 
+          toString(frameWidth) + " " + toString(frameHeight) + " " + fname;
+      }
         
       PRINTINFO("done.");
     } catch (...) {
@@ -414,13 +1062,12 @@ namespace VideoIO
   void FfmpegIVideo::close() 
   {
     TRACE;
+    // The decode-ahead thread uses everything we're about to free
+    stopPrefetch();
+    prefetchRing.clear();
+
     // Clean up partially-decoded streams
-    buffPosition = 0;
-    dataBuffer.resize(0);
-    squeeze(dataBuffer);
-    if (packet.data != NULL) {
-      av_free_packet(&packet);
-    }
+    releasePacket();
   
     // Free the RGB image
     if (pFrameBGR != NULL) { 
@@ -440,7 +1087,10 @@ namespace VideoIO
     if (pCodecCtx != NULL) { 
       PRINTINFO("About to free pCodecCtx");
       PRINTINFO("Codec ID: " <<  pCodecCtx->codec_id << ""); 
-      if (pCodecCtx->codec_id != CODEC_ID_NONE) avcodec_close(pCodecCtx); 
+      if (pCodecCtx->codec_id != CODEC_ID_NONE) {
+        FfmpegCodecLock lock;
+        avcodec_close(pCodecCtx); 
+      }
       pCodecCtx = NULL; 
     }
   
@@ -449,17 +1099,22 @@ namespace VideoIO
     // Close the video file
     if (pFormatCtx != NULL) { 
       PRINTINFO("About to free pFormatCtx");
+      FfmpegCodecLock lock;
       av_close_input_file(pFormatCtx); 
       pFormatCtx = NULL; 
     }
   
     currentFrame.resize(0);
     bgrData.resize(0);
+    scaledData.resize(0);
     currentFrameNumber = -1;
+    cachedFrameNumber  = -1;
     fname              = "";
+    fnameOfIndex       = "";
 
     squeeze(currentFrame);
     squeeze(bgrData);
+    squeeze(scaledData);
 
 #ifdef VIDEO_READER_USE_SWSCALER
     // Clean up image converter
@@ -467,105 +1122,158 @@ namespace VideoIO
       sws_freeContext(imgConvertCtx);
       imgConvertCtx = NULL;
     }
+    if (imgScaleCtx != NULL) {
+      sws_freeContext(imgScaleCtx);
+      imgScaleCtx = NULL;
+    }
 #endif
 
     nHiddenFinalFrames = 0;  
   }
   
+  /** Decodes the next frame into pFrame.  If the end of the file is reached
+   *  or there's a decoding error, the video is closed and false is 
+   *  returned. */
   bool FfmpegIVideo::getNextFrame()
   {
     TRACE;
-    size_t totalBytesDecoded = 0;
-    int    bytesRemaining    = dataBuffer.size() - (int)buffPosition;
-  
     try {
-      // Decode packets until we have decoded a complete frame
-      pCodecCtx->debug = 1;
-      while (true) {
-        // Work on the current packet until we have decoded all of it
-        while (bytesRemaining > 0) {
-          // Decode the next chunk of data
-          int       frameFinished = 0;
-          int const bytesDecoded  = 
-            avcodec_decode_video(pCodecCtx, pFrame, &frameFinished, 
-                                 &dataBuffer[buffPosition], bytesRemaining);
-          if (bytesDecoded >= 0) {
-            totalBytesDecoded += bytesDecoded;
-          }
-          VERBOSE("  decoded "<<bytesDecoded<<" bytes ("<<totalBytesDecoded<<
-                  " total), frame "<<(frameFinished ? "" : "not ")<<
-                  "finished");
-            
-          if (bytesDecoded >= 0) {
-            bytesRemaining -= bytesDecoded;
-            buffPosition   += bytesDecoded;
-          } else { 
-            // Error decoding the packet... 
-            if (dropBadPackets) {
-              // just discard the packet and try the next one (what ffmpeg.c 
-              // and ffplay.c do)
-              if (packet.data != NULL) av_free_packet(&packet);
-              break;
-            } else {
-              // play it safe and complain
-              VrRecoverableCheckMsg(false, // using *Check* to embed context 
-                                    "Error decoding packet.\n" <<
-                                    (ffBuffer[0] ? ffBuffer : "\n"));
-            }
-          }
-            
-          // Did we finish the current frame? Then we can return
-          if (frameFinished) {
-            VERBOSE("  codec says the frame is finished (frame "<<
-                    pCodecCtx->frame_number<<", "<<
-                    pCodecCtx->frame_skip_factor<<") (bytesRemaining="<<
-                    bytesRemaining<<").");
-            VrRecoverableCheck(totalBytesDecoded > 0);
-            return true;
-          }
-        }
-        
-        // Read the next packet, skipping all packets that aren't for this 
-        // stream
-        do {
-          if (packet.data != NULL) av_free_packet(&packet);
-          if (av_read_frame(pFormatCtx, &packet) < 0) {
-            // Decode the rest of the last frame
-            int       frameFinished = 0;
-            int const bytesDecoded  = avcodec_decode_video(pCodecCtx, pFrame, 
-              &frameFinished, &dataBuffer[buffPosition], bytesRemaining);
-            if (bytesDecoded >= 0) {
-              totalBytesDecoded += bytesDecoded;
-            }
-            VERBOSE("  decoded "<<bytesDecoded<<" bytes ("<<totalBytesDecoded<<
-              " total) from final packet");
-            if (packet.data != NULL) av_free_packet(&packet);
-            buffPosition = 0;
-            dataBuffer.resize(0);
-
-            VrRecoverableCheck(frameFinished);
-            VrRecoverableCheck(totalBytesDecoded > 0);
-            return true;
-          }
-          VERBOSE("  "<<((packet.stream_index==videoStream) ? 
-                         "Found":"skipping")<<" packet with "<<
-                  packet.size<<" bytes");
-        } while (packet.stream_index != videoStream);
-      
-        bytesRemaining = packet.size;
-        buffPosition = 0;
-        dataBuffer.resize(bytesRemaining);
-        memcpy(&dataBuffer[0], packet.data, bytesRemaining);
-      }
+      if (decodeNextFrame()) return true;
     } catch (VrRecoverableException const &e) {
-      if (packet.data != NULL) av_free_packet(&packet);
-      close();
-      return false;
     } catch (VrFatalError const &e) {
-      if (packet.data != NULL) av_free_packet(&packet);
+      releasePacket();
       close();
       throw;
     }
+    releasePacket();
+    close();
+    return false;
+  }
+
+  /** Decodes the next frame into pFrame.  Errors are reported by throwing
+   *  VrRecoverableException or VrFatalError.  Unlike getNextFrame, this 
+   *  never closes the video, so it is safe to call from the decode-ahead
+   *  thread. */
+  bool FfmpegIVideo::decodeNextFrame()
+  {
+    TRACE;
+    size_t totalBytesDecoded = 0;
+    int    bytesRemaining    = 
+      (packet.data != NULL) ? packet.size - (int)buffPosition : 0;
+  
+    // Decode packets until we have decoded a complete frame
+    pCodecCtx->debug = 1;
+    while (true) {
+      // Work on the current packet until we have decoded all of it
+      while (bytesRemaining > 0) {
+        // Decode the next chunk of data
+        bool const skipping     = (skipBudget > 0);
+        int const  bFramesDelay = pCodecCtx->has_b_frames;
+        setSkipNonRefFrames(skipping);
+        int       frameFinished = 0;
+        int const bytesDecoded  = 
+          avcodec_decode_video(pCodecCtx, pFrame, &frameFinished, 
+                               packet.data + buffPosition, bytesRemaining);
+        if (bytesDecoded >= 0) {
+          totalBytesDecoded += bytesDecoded;
+          pthread_mutex_lock(&prefetchMutex);
+          nBytesProcessed   += bytesDecoded;
+          pthread_mutex_unlock(&prefetchMutex);
+        }
+
+        // A whole packet that produced no picture while we were discarding
+        // is a skipped frame, unless the decoder is still filling up its 
+        // reordering delay.
+        if (skipping && !frameFinished && bytesDecoded == bytesRemaining && 
+            decoderHasOutput && pCodecCtx->has_b_frames <= bFramesDelay) {
+          VERBOSE("  discarded a non-reference frame");
+          pthread_mutex_lock(&prefetchMutex);
+          nFramesSkipped++;
+          pthread_mutex_unlock(&prefetchMutex);
+          skipBudget--;
+        }
+        VERBOSE("  decoded "<<bytesDecoded<<" bytes ("<<totalBytesDecoded<<
+                " total), frame "<<(frameFinished ? "" : "not ")<<
+                "finished");
+          
+        if (bytesDecoded >= 0) {
+          bytesRemaining -= bytesDecoded;
+          buffPosition   += bytesDecoded;
+        } else { 
+          // Error decoding the packet... 
+          if (dropBadPackets) {
+            // just discard the packet and try the next one (what ffmpeg.c 
+            // and ffplay.c do)
+            releasePacket();
+            break;
+          } else {
+            // play it safe and complain
+            VrRecoverableCheckMsg(false, // using *Check* to embed context 
+                                  "Error decoding packet.\n" <<
+                                  (ffBuffer[0] ? ffBuffer : "\n"));
+          }
+        }
+          
+        // Did we finish the current frame? Then we can return
+        if (frameFinished) {
+          decoderHasOutput = true;
+          pthread_mutex_lock(&prefetchMutex);
+          nFramesDecoded++;
+          pthread_mutex_unlock(&prefetchMutex);
+          VERBOSE("  codec says the frame is finished (frame "<<
+                  pCodecCtx->frame_number<<", "<<
+                  pCodecCtx->frame_skip_factor<<") (bytesRemaining="<<
+                  bytesRemaining<<").");
+          VrRecoverableCheck(totalBytesDecoded > 0);
+          return true;
+        }
+      }
+      
+      // Read the next packet, skipping all packets that aren't for this 
+      // stream
+      do {
+        releasePacket();
+        if (av_read_frame(pFormatCtx, &packet) < 0) {
+          // We're at the end of the file.  Drain any frames the codec is
+          // still holding on to (B-frame reordering and frame-level 
+          // threading both delay the output).  Codecs without 
+          // CODEC_CAP_DELAY don't produce anything here.
+          releasePacket();
+
+          int frameFinished = 0;
+          if (nFramesFlushedAtEof < MAX_DELAYED_FRAMES) {
+            avcodec_decode_video(pCodecCtx, pFrame, &frameFinished, NULL, 0);
+          }
+          VERBOSE("  flushed " << (frameFinished ? "a" : "no") << 
+                  " delayed frame at the end of the file");
+          VrRecoverableCheck(frameFinished);
+          nFramesFlushedAtEof++;
+          pthread_mutex_lock(&prefetchMutex);
+          nFramesDecoded++;
+          pthread_mutex_unlock(&prefetchMutex);
+          return true;
+        }
+        VERBOSE("  "<<((packet.stream_index==videoStream) ? 
+                       "Found":"skipping")<<" packet with "<<
+                packet.size<<" bytes");
+      } while (packet.stream_index != videoStream);
+    
+      // We decode straight out of the packet's own buffer.  It stays valid
+      // until we release the packet or read the next one.
+      nFramesFlushedAtEof = 0;
+      bytesRemaining = packet.size;
+      buffPosition = 0;
+    }
+  }
+
+  /** Frees the packet we're decoding from (if any) and forgets about any
+   *  of its data that has not been decoded yet. */
+  void FfmpegIVideo::releasePacket()
+  {
+    if (packet.data != NULL) av_free_packet(&packet);
+    packet.data  = NULL;
+    packet.size  = 0;
+    buffPosition = 0;
   }
   
   AVRational FfmpegIVideo::fpsRational() const
@@ -606,6 +1314,7 @@ namespace VideoIO
   int FfmpegIVideo::numFrames() const 
   { 
     VrRecoverableCheck(isOpen()); 
+    if (packetFrameCount && nIndexedFrames >= 0) return nIndexedFrames;
 #if (LIBAVCODEC_VERSION_INT > 0x000409) || (LIBAVCODEC_VERSION_INT == 0x000409 && LIBAVCODEC_BUILD >= 4758)
     const int nReported = (int)pFormatCtx->streams[videoStream]->nb_frames;
     if (nReported == 0) {
@@ -625,4 +1334,371 @@ namespace VideoIO
 #endif
   }
 
+  /** Finds the last keyframe at or before frameNum.  Returns its position 
+   *  in the keyframes vector or -1 if there is no usable keyframe. */
+  int FfmpegIVideo::findKeyframe(int frameNum) const
+  {
+    if (!useKeyframeIndex || keyframes.empty()) return -1;
+    int lo = 0, hi = (int)keyframes.size();
+    while (lo < hi) {
+      int const mid = (lo + hi) / 2;
+      if (keyframes[mid].frameNum <= frameNum) lo = mid + 1;
+      else                                     hi = mid;
+    }
+    return lo - 1;
+  }
+
+  /** Positions the demuxer and decoder at the given keyframe.  On success, 
+   *  the keyframe's packet is ready to be decoded and currentFrameNumber
+   *  is set so that the next call to getNextFrame produces the keyframe.
+   *
+   *  We assume the keyframe begins a closed GOP, i.e. that no frame at or 
+   *  after the keyframe (in presentation order) references data before it.
+   *  This holds for intra-only codecs and the typical MPEG-4 ASP (xvid, 
+   *  divx) and MPEG-1/2 files videoIO users record.  */
+  bool FfmpegIVideo::seekToKeyframe(int keyframeIdx)
+  {
+    TRACE;
+    KeyframeIndexEntry const &kf = keyframes[keyframeIdx];
+    VERBOSE("Seeking to keyframe at frame " << kf.frameNum << " (timestamp " 
+            << kf.timestamp << ")");
+    if (av_seek_frame(pFormatCtx, videoStream, kf.timestamp, 
+                      AVSEEK_FLAG_BACKWARD) < 0) {
+      return false;
+    }
+    avcodec_flush_buffers(pCodecCtx);
+    releasePacket();
+    nFramesFlushedAtEof = 0;
+    decoderHasOutput    = false;
+
+    // Read the first video packet and verify that the demuxer put us exactly
+    // where the index says we should be.
+    do {
+      releasePacket();
+      if (av_read_frame(pFormatCtx, &packet) < 0) { 
+        releasePacket(); 
+        return false; 
+      }
+    } while (packet.stream_index != videoStream || packet.size <= 0);
+
+    int64_t const ts = 
+      (packet.dts != (int64_t)AV_NOPTS_VALUE) ? packet.dts : packet.pts;
+    if (ts != kf.timestamp || !(packet.flags & PKT_FLAG_KEY)) {
+      VERBOSE("Expected keyframe at timestamp " << kf.timestamp << 
+              ", but found a packet at " << ts);
+      releasePacket();
+      return false;
+    }
+
+    currentFrameNumber = kf.frameNum - 1;
+    return true;
+  }
+
+  /** By default, the keyframe index is cached in a private per-user 
+   *  directory (see cachedir.h), never next to the video. */
+  std::string FfmpegIVideo::keyframeIndexFilename() const
+  {
+    if (!indexFname.empty()) return indexFname;
+    if (fname.empty()) return "";
+    return cachedFilename(defaultCacheDir("index"), fname, ".vioidx");
+  }
+
+  void FfmpegIVideo::loadOrBuildKeyframeIndex()
+  {
+    TRACE;
+    keyframes.clear();
+    framePts.clear();
+    nIndexedFrames = -1;
+    fnameOfIndex = fname;
+
+    if (fetchSharedKeyframeIndex()) {
+      VERBOSE("Reused the index of " << keyframes.size() << " keyframes "
+              "and " << nIndexedFrames << " frames for " << fname);
+      return;
+    }
+
+    // Nobody else may plant an index in the default directory.
+    string const idxFname = 
+      (indexFname.empty() && !makePrivateCacheDir(defaultCacheDir("index"))) ?
+      string() : keyframeIndexFilename();
+    if (!idxFname.empty() && loadKeyframeIndex(idxFname)) {
+      VERBOSE("Loaded " << keyframes.size() << " keyframes and " << 
+              nIndexedFrames << " frames from " << idxFname);
+      shareKeyframeIndex();
+      return;
+    }
+
+    if (!buildKeyframeIndex()) {
+      PRINTWARN("Could not build a keyframe index for \"" << fname << 
+                "\".  Seeks will decode from the beginning of the file.");
+      keyframes.clear();
+      framePts.clear();
+      nIndexedFrames = -1;
+      return;
+    }
+    VERBOSE("Indexed " << keyframes.size() << " keyframes and " << 
+            nIndexedFrames << " frames in " << fname);
+    if (!idxFname.empty()) saveKeyframeIndex(idxFname);
+    shareKeyframeIndex();
+  }
+
+  /** Keyframe indexes of recently opened files, shared by every reader in
+   *  this process.  A server running as a daemon (see mexServerStdio.cpp)
+   *  sees the same files opened over and over by its clients, and this way
+   *  it neither rescans nor rereads them.  Entries are keyed by filename 
+   *  and video stream and are dropped when the file's size or mtime 
+   *  changes. */
+  struct SharedKeyframeIndex {
+    long long        fileSize;
+    long long        mtime;
+    int              nFrames;
+    vector<int>      frameNums;
+    vector<int64_t>  timestamps;
+    vector<int64_t>  pts;
+    unsigned long    lastUse;
+  };
+  typedef map<string, SharedKeyframeIndex> SharedKeyframeIndexMap;
+  static SharedKeyframeIndexMap sharedIndexes;
+  static unsigned long          sharedIndexClock = 0;
+  static pthread_mutex_t        sharedIndexMutex = PTHREAD_MUTEX_INITIALIZER;
+  static const size_t           MAX_SHARED_INDEXES = 64;
+
+  static string sharedIndexKey(string const &fname, int stream) {
+    return toString(stream) + ":" + fname;
+  }
+
+  bool FfmpegIVideo::fetchSharedKeyframeIndex()
+  {
+    TRACE;
+    struct stat vidStat;
+    if (stat(fname.c_str(), &vidStat) != 0) return false;
+
+    pthread_mutex_lock(&sharedIndexMutex);
+    SharedKeyframeIndexMap::iterator i = 
+      sharedIndexes.find(sharedIndexKey(fname, videoStream));
+    bool const found = 
+      (i != sharedIndexes.end() && 
+       i->second.fileSize == (long long)vidStat.st_size &&
+       i->second.mtime    == (long long)vidStat.st_mtime);
+    if (found) {
+      SharedKeyframeIndex &idx = i->second;
+      keyframes.resize(idx.frameNums.size());
+      for (size_t k=0; k<keyframes.size(); k++) {
+        keyframes[k].frameNum  = idx.frameNums[k];
+        keyframes[k].timestamp = idx.timestamps[k];
+      }
+      framePts       = idx.pts;
+      nIndexedFrames = idx.nFrames;
+      idx.lastUse    = ++sharedIndexClock;
+    }
+    pthread_mutex_unlock(&sharedIndexMutex);
+    return found;
+  }
+
+  void FfmpegIVideo::shareKeyframeIndex() const
+  {
+    TRACE;
+    struct stat vidStat;
+    if (stat(fname.c_str(), &vidStat) != 0) return;
+
+    SharedKeyframeIndex idx;
+    idx.fileSize = (long long)vidStat.st_size;
+    idx.mtime    = (long long)vidStat.st_mtime;
+    idx.nFrames  = nIndexedFrames;
+    idx.frameNums.resize(keyframes.size());
+    idx.timestamps.resize(keyframes.size());
+    for (size_t k=0; k<keyframes.size(); k++) {
+      idx.frameNums[k]  = keyframes[k].frameNum;
+      idx.timestamps[k] = keyframes[k].timestamp;
+    }
+    idx.pts = framePts;
+
+    pthread_mutex_lock(&sharedIndexMutex);
+    idx.lastUse = ++sharedIndexClock;
+    sharedIndexes[sharedIndexKey(fname, videoStream)] = idx;
+    if (sharedIndexes.size() > MAX_SHARED_INDEXES) {
+      SharedKeyframeIndexMap::iterator oldest = sharedIndexes.begin();
+      for (SharedKeyframeIndexMap::iterator i = sharedIndexes.begin(); 
+           i != sharedIndexes.end(); i++) {
+        if (i->second.lastUse < oldest->second.lastUse) oldest = i;
+      }
+      sharedIndexes.erase(oldest);
+    }
+    pthread_mutex_unlock(&sharedIndexMutex);
+  }
+
+  /** Scans every packet in the file (without decoding anything) and 
+   *  records where the video stream's keyframes are, how many frames there
+   *  are, and when each one is displayed.  A separate demuxer context is 
+   *  used so that the scan does not disturb the main one.
+   *
+   *  Frame numbers count the non-empty video packets, just like 
+   *  getNextFrame does.  When every packet carries a pts, we use the rank 
+   *  of the keyframe's pts instead so that B-frame reordering is handled
+   *  correctly.  
+   *
+   *  Returns false only if the file could not be scanned.  A file with no
+   *  usable keyframes still gets a frame count. */
+  bool FfmpegIVideo::buildKeyframeIndex()
+  {
+    TRACE;
+    keyframes.clear();
+    framePts.clear();
+    nIndexedFrames = -1;
+
+    AVFormatContext *ic = NULL;
+    if (av_open_input_file(&ic, fname.c_str(), NULL, 0, NULL) != 0) {
+      return false;
+    }
+    {
+      FfmpegCodecLock lock;
+      if (av_find_stream_info(ic) < 0 || videoStream >= (int)ic->nb_streams) {
+        av_close_input_file(ic);
+        return false;
+      }
+    }
+
+    vector<int64_t> allPts;
+    vector<int64_t> keyframePts;
+    bool            havePts = true;
+    AVPacket        pkt;
+    while (av_read_frame(ic, &pkt) >= 0) {
+      if (pkt.stream_index == videoStream && pkt.size > 0) {
+        if (pkt.flags & PKT_FLAG_KEY) {
+          KeyframeIndexEntry e;
+          e.frameNum  = (int)allPts.size();
+          e.timestamp = 
+            (pkt.dts != (int64_t)AV_NOPTS_VALUE) ? pkt.dts : pkt.pts;
+          if (e.timestamp != (int64_t)AV_NOPTS_VALUE) {
+            keyframes.push_back(e);
+            keyframePts.push_back(pkt.pts);
+          }
+        }
+        if (pkt.pts == (int64_t)AV_NOPTS_VALUE) havePts = false;
+        allPts.push_back(pkt.pts);
+      }
+      av_free_packet(&pkt);
+    }
+    {
+      FfmpegCodecLock lock;
+      av_close_input_file(ic);
+    }
+
+    nIndexedFrames = (int)allPts.size();
+    if (havePts) {
+      sort(allPts.begin(), allPts.end());
+      for (size_t i=0; i<keyframes.size(); i++) {
+        keyframes[i].frameNum = (int)(lower_bound(allPts.begin(), allPts.end(),
+                                                  keyframePts[i]) - 
+                                      allPts.begin());
+      }
+      framePts.swap(allPts);
+    }
+
+    // findKeyframe does a binary search on frame numbers
+    for (size_t i=1; i<keyframes.size(); i++) {
+      if (keyframes[i].frameNum <= keyframes[i-1].frameNum) {
+        VERBOSE("Keyframes are not in presentation order.  Ignoring them.");
+        keyframes.clear();
+        break;
+      }
+    }
+    return true;
+  }
+
+  /** Index file format (text):
+   *    videoIO-keyframe-index 2
+   *    <video file size> <video file mtime> <video stream> <num keyframes>
+   *      <num frames> <num pts>
+   *    <frameNum> <timestamp>      (one line per keyframe)
+   *    <pts>                       (one line per frame, if num pts > 0)
+   *  The size and mtime let us detect stale indices.  Version 1 files 
+   *  lacked the frame count and pts table, so they are simply rebuilt. */
+  static char const *KEYFRAME_INDEX_MAGIC = "videoIO-keyframe-index";
+  static int  const  KEYFRAME_INDEX_VERSION = 2;
+
+  bool FfmpegIVideo::loadKeyframeIndex(std::string const &idxFname)
+  {
+    TRACE;
+    struct stat vidStat;
+    if (stat(fname.c_str(), &vidStat) != 0) return false;
+
+    FILE *f = fopen(idxFname.c_str(), "r");
+    if (f == NULL) return false;
+
+    bool ok = false;
+    char magic[64];
+    int  version, stream, n, nFrames, nPts;
+    long long fileSize, mtime;
+    if (fscanf(f, "%63s %d %lld %lld %d %d %d %d", magic, &version, 
+               &fileSize, &mtime, &stream, &n, &nFrames, &nPts) == 8 &&
+        strcmp(magic, KEYFRAME_INDEX_MAGIC) == 0 &&
+        version  == KEYFRAME_INDEX_VERSION &&
+        fileSize == (long long)vidStat.st_size &&
+        mtime    == (long long)vidStat.st_mtime &&
+        stream   == videoStream && n >= 0 && nFrames >= 0 &&
+        (nPts == 0 || nPts == nFrames)) {
+      keyframes.resize(n);
+      ok = true;
+      for (int i=0; i<n && ok; i++) {
+        long long ts;
+        ok = (fscanf(f, "%d %lld", &keyframes[i].frameNum, &ts) == 2) &&
+             (i == 0 || keyframes[i].frameNum > keyframes[i-1].frameNum);
+        keyframes[i].timestamp = ts;
+      }
+      framePts.resize(nPts);
+      for (int i=0; i<nPts && ok; i++) {
+        long long pts;
+        ok = (fscanf(f, "%lld", &pts) == 1) &&
+             (i == 0 || pts >= framePts[i-1]);
+        framePts[i] = pts;
+      }
+      nIndexedFrames = nFrames;
+    }
+    fclose(f);
+
+    if (!ok) {
+      keyframes.clear();
+      framePts.clear();
+      nIndexedFrames = -1;
+    }
+    return ok;
+  }
+
+  /** Failing to write the index is not an error (e.g. indexFile may be in
+   *  a read-only directory).  We'll just rebuild it next time.  The index
+   *  is written to a temporary file that is renamed into place, so other 
+   *  readers never see a partial one. */
+  void FfmpegIVideo::saveKeyframeIndex(std::string const &idxFname) const
+  {
+    TRACE;
+    struct stat vidStat;
+    if (stat(fname.c_str(), &vidStat) != 0) return;
+
+    std::string tmpFname;
+    int const fd  = createTempFile(idxFname, tmpFname);
+    FILE     *f   = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (f == NULL) {
+      VERBOSE("Could not write the keyframe index to " << idxFname);
+      if (fd >= 0) { ::close(fd); unlink(tmpFname.c_str()); }
+      return;
+    }
+    fprintf(f, "%s %d\n%lld %lld %d %d %d %d\n", 
+            KEYFRAME_INDEX_MAGIC, KEYFRAME_INDEX_VERSION,
+            (long long)vidStat.st_size, (long long)vidStat.st_mtime, 
+            videoStream, (int)keyframes.size(), nIndexedFrames, 
+            (int)framePts.size());
+    for (size_t i=0; i<keyframes.size(); i++) {
+      fprintf(f, "%d %lld\n", keyframes[i].frameNum, 
+              (long long)keyframes[i].timestamp);
+    }
+    for (size_t i=0; i<framePts.size(); i++) {
+      fprintf(f, "%lld\n", (long long)framePts[i]);
+    }
+    if (fclose(f) != 0 || rename(tmpFname.c_str(), idxFname.c_str()) != 0) {
+      VERBOSE("Could not write the keyframe index to " << idxFname);
+      unlink(tmpFname.c_str());
+    }
+  }
+
 };
@@ -40,6 +40,7 @@ SOFTWARE.
 #include "debug.h"
 #include "IVideo.h"
 #include "FfmpegCommon.h"
+#include "FrameCache.h"
 
 // Normal includes
 #include <string>
@@ -49,6 +50,7 @@ SOFTWARE.
 #include <math.h>
 #include <limits>
 #include <memory>
+#include <pthread.h>
 
 namespace VideoIO 
 {
@@ -74,7 +76,7 @@ namespace VideoIO
   public:
     // Constructors/Destructors
     FfmpegIVideo();
-    virtual ~FfmpegIVideo() { TRACE; close(); };
+    virtual ~FfmpegIVideo();
 
     // I/O Operations
     virtual void         open(KeyValueMap &kvm);
@@ -82,14 +84,17 @@ namespace VideoIO
     virtual bool         next();
     virtual bool         step(int numFrames=1);
     virtual bool         seek(int toFrame);
-    virtual int          currFrameNum()   const {AO;return currentFrameNumber;}
+    virtual bool         seekTime(double seconds);
+    virtual int          currFrameNum()   const {
+      AO; return (cachedFrameNumber >= 0) ? cachedFrameNumber : currentFrameNumber;
+    }
     virtual Frame const &currFrame()      const {AO;return currentFrame;} 
 
     // video stats
     virtual std::string filename()             const { AO; return fname; } 
-    virtual int         width()                const { AO; return pCodecCtx->width; }
-    virtual int         height()               const { AO; return pCodecCtx->height; }
-    virtual int         depth()                const { AO; return 3; } 
+    virtual int         width()                const { AO; return frameWidth; }
+    virtual int         height()               const { AO; return frameHeight; }
+    virtual int         depth()                const { AO; return grayOutput ? 1 : 3; } 
             AVRational  fpsRational()          const;
     virtual double      fps()                  const;
     virtual int         numFrames()            const;
@@ -102,11 +107,52 @@ namespace VideoIO
     void        open(std::string const &fname);
     inline bool isOpen() const { return (pCodecCtx != NULL); }    
     bool getNextFrame();
+    bool decodeNextFrame();
+    void releasePacket();
+    void convertFrame(Frame &out);
+    void resolveOutputGeometry(AVCodec const *pCodec);
+    bool nextLowLevel();
     bool stepLowLevel(int numFrames);
+    bool seekLowLevel(int toFrame);
+    bool canSkipNonRefFrames() const;
+    void setSkipNonRefFrames(bool skip);
+    bool lookupCachedFrame(int frameNum);
+    void cacheCurrentFrame();
+
+    // Keyframe index management
+    void        loadOrBuildKeyframeIndex();
+    bool        fetchSharedKeyframeIndex();
+    void        shareKeyframeIndex() const;
+    bool        buildKeyframeIndex();
+    bool        loadKeyframeIndex(std::string const &indexFname);
+    void        saveKeyframeIndex(std::string const &indexFname) const;
+    std::string keyframeIndexFilename() const;
+    int         findKeyframe(int frameNum) const;
+    bool        seekToKeyframe(int keyframeIdx);
+
+    // Decode-ahead (prefetch) thread management
+    bool         startPrefetch();
+    void         stopPrefetch();
+    bool         nextPrefetched();
+    static void *prefetchThreadMain(void *self);
+    void         prefetchLoop();
 
     std::string                fname;
     
     int                        currentFrameNumber;
+    /** If non-negative, currentFrame was taken from frameCache and holds 
+     *  this frame, while currentFrameNumber is still the decoder's 
+     *  position. */
+    int                        cachedFrameNumber;
+    /** Recently returned frames (see frameCacheMB).  Disabled by default. */
+    FrameCache                 frameCache;
+    /** If true, recently returned frames go to the cache shared by every 
+     *  reader in the process that asked for it (see sharedFrameCache) 
+     *  instead of frameCache. */
+    bool                       useSharedFrameCache;
+    /** Identifies the file and the output format in the shared cache.  
+     *  Empty if the file can't be identified (then frameCache is used). */
+    std::string                frameCacheKey;
 
     AVFormatContext            *pFormatCtx;
     int                        videoStream;
@@ -114,24 +160,135 @@ namespace VideoIO
     
     /** The codec stuffs the data here */
     AVFrame                    *pFrame; 
-    /** We then tell it to decode to a 24-bit BGR wrapper */
+    /** We then tell it to decode to a 24-bit BGR wrapper (8-bit gray in
+     *  grayscale mode) if the codec's pixel format isn't planar YUV */
     AVFrame                    *pFrameBGR;
-    /** Where the actual BGR data is stored here */
+    /** Where the actual BGR (or gray) data is stored here */
     std::vector<unsigned char> bgrData;
+    /** Scaled copy of bgrData, for non-planar formats that need resizing */
+    std::vector<unsigned char> scaledData;
     /** Which we then manually rearrange to Matlab's format */
     Frame                      currentFrame;       
   
+    /** The packet currently being decoded, and how far into its data the
+     *  decoder has gotten.  packet.data is NULL when there is none. */
     AVPacket                   packet;  
-    std::vector<unsigned char> dataBuffer;
     size_t                     buffPosition;
+    /** Statistics: compressed bytes consumed by the decoder so far */
+    int64_t                    nBytesProcessed;
 
 #ifdef VIDEO_READER_USE_SWSCALER
     struct SwsContext         *imgConvertCtx;
+    struct SwsContext         *imgScaleCtx;
 #endif 
 
     int                        nHiddenFinalFrames; 
 
     bool                       dropBadPackets;
+
+    /** If true, frames are single-plane luma images copied directly from
+     *  the decoder's Y plane instead of RGB images. */
+    bool                       grayOutput;
+
+    /** Requested output size.  0 means the size of the region of interest
+     *  (or, if only one of them is 0, whatever keeps the aspect ratio). */
+    int                        outWidth;
+    int                        outHeight;
+    /** Requested region of interest, in the file's pixel coordinates.  A 
+     *  cropWidth of 0 means the whole frame. */
+    int                        cropX;
+    int                        cropY;
+    int                        cropWidth;
+    int                        cropHeight;
+    /** Region of interest and output size actually used for the open 
+     *  file (see resolveOutputGeometry) */
+    int                        roiX;
+    int                        roiY;
+    int                        roiWidth;
+    int                        roiHeight;
+    int                        frameWidth;
+    int                        frameHeight;
+    /** log2 of the decoder's downscaling factor (libavcodec's lowres) */
+    int                        lowres;
+
+    /** One entry per keyframe in the video stream.  The index lets seek and
+     *  backward steps jump directly to the closest preceding keyframe 
+     *  instead of reopening the file and decoding from frame 0. */
+    struct KeyframeIndexEntry {
+      /** 0-indexed frame number of the keyframe, in presentation order */
+      int     frameNum;
+      /** dts of the keyframe's packet (pts if there's no dts), in the 
+       *  video stream's time base.  This is what we hand to av_seek_frame. */
+      int64_t timestamp;
+    };
+    std::vector<KeyframeIndexEntry> keyframes;
+    /** Name of the file the index in keyframes describes.  Cleared by 
+     *  close() and by user-level opens, so only the internal reopens done
+     *  by seeks reuse an index. */
+    std::string                fnameOfIndex;
+    /** If false, we never build, load, or use a keyframe index */
+    bool                       useKeyframeIndex;
+    /** Where the index is cached between sessions.  Empty means use the 
+     *  default in a private cache directory (see keyframeIndexFilename). */
+    std::string                indexFname;
+    /** If true, numFrames reports the number of non-empty video packets
+     *  counted by the scan that builds the index rather than the 
+     *  container's (often estimated) frame count.  This is the number of 
+     *  frames unless packets hold several frames or none (e.g. AVIs with
+     *  packed B-frames). */
+    bool                       packetFrameCount;
+    /** Number of video packets found by the scan, or -1 if unknown */
+    int                        nIndexedFrames;
+    /** Presentation timestamp of every frame, in frame order and in the 
+     *  video stream's time base.  Empty if some packets had no pts. */
+    std::vector<int64_t>       framePts;
+
+    /** Number of threads libavcodec may use for decoding, as requested by 
+     *  the user.  0 means use one per online CPU. */
+    int                        decodeThreads;
+    /** Number of delayed frames flushed out of the codec since the demuxer
+     *  reached the end of the file. */
+    int                        nFramesFlushedAtEof;
+
+    /** Number of frames decodeNextFrame may still discard before it must 
+     *  go back to decoding everything.  Only positive during forward 
+     *  steps (see stepLowLevel). */
+    int                        skipBudget;
+    /** True once the codec has produced a picture since it was opened or
+     *  flushed, i.e. once its reordering delay has been filled. */
+    bool                       decoderHasOutput;
+    /** Statistics: frames fully decoded and non-reference frames discarded
+     *  during forward steps, since the video was opened.  Like 
+     *  nBytesProcessed, they are updated under prefetchMutex because the 
+     *  decode-ahead thread may be the one decoding. */
+    int                        nFramesDecoded;
+    int                        nFramesSkipped;
+
+    /** Number of frames the decode-ahead thread may work ahead of the user.
+     *  0 disables the thread and all decoding is done by next(). */
+    int                        prefetchFrames;
+    /** True while prefetchThread exists.  When it is running, the thread
+     *  owns the demuxer, decoder, and BGR conversion buffers. */
+    bool                       prefetchRunning;
+    pthread_t                  prefetchThread;
+    /** Guards all of the prefetch* fields below and the statistics */
+    mutable pthread_mutex_t    prefetchMutex;
+    /** Signalled when the thread produces a frame or stops */
+    pthread_cond_t             prefetchFrameReady;
+    /** Signalled when a slot is freed up or when the thread must stop */
+    pthread_cond_t             prefetchSlotFree;
+    /** Ring of preallocated, already-converted frames */
+    std::vector<Frame>         prefetchRing;
+    /** Index of the oldest ready frame in prefetchRing */
+    size_t                     prefetchHead;
+    /** Number of ready frames in prefetchRing */
+    size_t                     prefetchCount;
+    /** Set by the main thread to ask the worker to exit */
+    bool                       prefetchStopRequested;
+    /** Set by the worker when it hits the end of the file or an error */
+    bool                       prefetchDone;
+    bool                       prefetchFatal;
+    std::string                prefetchErrMsg;
   };
 
 #undef AO
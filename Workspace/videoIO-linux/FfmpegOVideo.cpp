@@ -35,6 +35,7 @@ SOFTWARE.
 */
 
 #include <errno.h>
+#include <pthread.h>
 #include "FfmpegOVideo.h"
 #include "registry.h"
 #include "parse.h"
@@ -55,6 +56,7 @@ namespace VideoIO
   static const int     DEFAULT_BITRATE_PER_PIX = (int)(38.8*1024*1024/1920/1080);
   static const CodecID CODEC_ID_DEFAULT        = CODEC_ID_MPEG1VIDEO; 
   static const int     USE_DEFAULT_VAL         =     -1;
+  static const int     DEFAULT_ASYNC_QUEUE_FRAMES = 4;
 
   /////////////////////////////////////////////////////////////////////////////
   // codec id <-> codec name mappings
@@ -113,8 +115,13 @@ namespace VideoIO
 #undef PC
   }
 
+  static void buildCodecMapsIfNeeded() {
+    static pthread_once_t built = PTHREAD_ONCE_INIT;
+    pthread_once(&built, buildCodecMaps);
+  }
+
   static CodecID parseCodecId(string const &cn) {
-    if (codecIdFromName.size() == 0) buildCodecMaps();
+    buildCodecMapsIfNeeded();
 
     const char *codecName = cn.c_str();
     if (codecName == NULL) return CODEC_ID_NONE;
@@ -125,7 +132,7 @@ namespace VideoIO
   }
 
   static string getCodecName(CodecID id) {
-    if (codecIdFromName.size() == 0) buildCodecMaps();
+    buildCodecMapsIfNeeded();
 
     map<CodecID,string>::const_iterator i = codecNameFromId.find(id);
     if (i == codecNameFromId.end()) return "NONE";
@@ -161,11 +168,27 @@ namespace VideoIO
     codecId(CODEC_ID_DEFAULT), 
     fmt(NULL), oc(NULL), videoStream(NULL), currFrameNum(-1), rgbPicture(NULL),
     codecPicture(NULL), outputBuffer(NULL), 
-    urlOpened(false), codecOpened(false)
+    urlOpened(false), codecOpened(false),
 #ifdef VIDEO_READER_USE_SWSCALER
-    , imgConvertCtx(NULL)
+    imgConvertCtx(NULL),
 #endif
-  { }
+    asyncEncode(0), asyncQueueFrames(DEFAULT_ASYNC_QUEUE_FRAMES),
+    encodeRunning(false), encodeHead(0), encodeCount(0), 
+    encodeStopRequested(false), encodeFailed(false), encodeFatal(false)
+  { 
+    pthread_mutex_init(&encodeMutex, NULL);
+    pthread_cond_init(&encodeFrameReady, NULL);
+    pthread_cond_init(&encodeSlotFree, NULL);
+  }
+
+  FfmpegOVideo::~FfmpegOVideo() 
+  { 
+    TRACE; 
+    close(); 
+    pthread_cond_destroy(&encodeSlotFree);
+    pthread_cond_destroy(&encodeFrameReady);
+    pthread_mutex_destroy(&encodeMutex);
+  }
 
 // (S)et (P)arameter if file is (C)onfigurable
 #define SPC(pa) if (kvm.hasKey(#pa)) { pa = kvm.parseInt<int>(#pa); }
@@ -186,6 +209,12 @@ namespace VideoIO
      SPC(height);
      SPC(gopSize);
      SPC(maxBFrames);
+     if (kvm.hasKey("asyncEncode")) {
+       setAsyncEncode(kvm.parseInt<int>("asyncEncode"));
+     }
+     if (kvm.hasKey("asyncQueueFrames")) {
+       setAsyncQueueFrames(kvm.parseInt<int>("asyncQueueFrames"));
+     }
 
      KeyValueMap::const_iterator cdc = kvm.find("codec");
      if (cdc != kvm.end()) {
@@ -222,6 +251,8 @@ namespace VideoIO
     assnString(kvm["gopSize"],          getGopSize());
     assnString(kvm["maxBFrames"],       getMaxBFrames());
     assnString(kvm["codec"],            getCodecName());
+    assnString(kvm["asyncEncode"],      getAsyncEncode());
+    assnString(kvm["asyncQueueFrames"], getAsyncQueueFrames());
                kvm["filename"]        = oc ? oc->filename : "";
 
     // stats
@@ -267,10 +298,20 @@ namespace VideoIO
 
   /** Converts Matlab's preferred byte layout for images to C-style RGB images.
    *  This code should be kept in sync with bgr2Matlab in FfmpegIVideo.cpp.
+   *  Grayscale images (d == 1) are copied into all three channels.
    */
   static inline void matlab2rgb(unsigned char *rgb, unsigned char const *mat, 
     int w, int h, int d)
   {
+    if (d == 1) {
+      for (int x=0; x<w; x++) {
+        for (int y=0; y<h; y++) {
+          unsigned char *p = rgb + (x+y*w)*3;
+          p[0] = p[1] = p[2] = *mat++;
+        }
+      }
+      return;
+    }
     for (int c=0; c<d; c++) {
       for (int x=0; x<w; x++) {
         for (int y=0; y<h; y++) {
@@ -380,6 +421,16 @@ namespace VideoIO
   {
     TRACE;
 
+    // Let the encoder thread write whatever is still queued.  close may
+    // not throw, so a deferred error that nobody has seen yet can only
+    // be printed.
+    stopEncodeThread();
+    if (encodeFailed) {
+      PRINTERROR("Frames were lost while writing \"" << 
+                 (oc ? oc->filename : "") << "\": " << encodeErrMsg);
+      encodeFailed = false;
+    }
+
     VERBOSE("Draining the encoder...");
     if (oc && videoStream && getCodecFromStream(videoStream) && outputBuffer) {
       // Do I need a check for (oc->oformat->flags & AVFMT_RAWPICTURE)?
@@ -391,6 +442,7 @@ namespace VideoIO
     if (videoStream && codecOpened) {
       AVCodecContext *c = getCodecFromStream(videoStream);
       if ((c != NULL) && (avcodec_find_encoder(c->codec_id) != NULL)) {
+        FfmpegCodecLock lock;
         avcodec_close(getCodecFromStream(videoStream));
       }
     }
@@ -452,7 +504,9 @@ namespace VideoIO
   }
 
 
-  static void writeVideoFrame(
+  /** Returns the number of bytes written to the file (see encodeFrame).  If 
+   *  rgbPicture is NULL, codecPicture already holds the frame. */
+  static int writeVideoFrame(
 #ifdef VIDEO_READER_USE_SWSCALER
                               struct SwsContext *&imgConvertCtx, 
                               int rgbW, int rgbH,
@@ -466,24 +520,26 @@ namespace VideoIO
     AVCodecContext *c = getCodecFromStream(st);
 
     // rgbPicture is in RGB24, so we must convert it to the codec pixel format
+    if (rgbPicture != NULL) {
 #ifdef VIDEO_READER_USE_SWSCALER
-    imgConvertCtx = sws_getCachedContext(imgConvertCtx,
-                                         rgbW, rgbH, PIX_FMT_RGB24,
-                                         c->width, c->height, c->pix_fmt,
-                                         SWS_POINT, NULL, NULL, NULL);
-    VrRecoverableCheckMsg(imgConvertCtx, 
-      "Could not initialize the colorspace converter to convert from RGB to "
-      "the codec's colorspace.");
-    FfRecoverableCheckMsg(
-      sws_scale(imgConvertCtx, 
-                rgbPicture->data, rgbPicture->linesize, 0, rgbH, 
-                codecPicture->data, codecPicture->linesize),
-      "Could not convert from RGB to the stream's pixel format.");
+      imgConvertCtx = sws_getCachedContext(imgConvertCtx,
+                                           rgbW, rgbH, PIX_FMT_RGB24,
+                                           c->width, c->height, c->pix_fmt,
+                                           SWS_POINT, NULL, NULL, NULL);
+      VrRecoverableCheckMsg(imgConvertCtx, 
+        "Could not initialize the colorspace converter to convert from RGB "
+        "to the codec's colorspace.");
+      FfRecoverableCheckMsg(
+        sws_scale(imgConvertCtx, 
+                  rgbPicture->data, rgbPicture->linesize, 0, rgbH, 
+                  codecPicture->data, codecPicture->linesize),
+        "Could not convert from RGB to the stream's pixel format.");
 #else
-    FfRecoverableCheck(img_convert((AVPicture*)codecPicture, c->pix_fmt, 
-                       (AVPicture*)rgbPicture, PIX_FMT_RGB24,
-                       c->width, c->height));
+      FfRecoverableCheck(img_convert((AVPicture*)codecPicture, c->pix_fmt, 
+                         (AVPicture*)rgbPicture, PIX_FMT_RGB24,
+                         c->width, c->height));
 #endif
+    }
     
     if (oc->oformat->flags & AVFMT_RAWPICTURE) {
       /* raw video case. The API will change slightly in the near
@@ -499,6 +555,7 @@ namespace VideoIO
       FfRecoverableCheckMsg(av_write_frame(oc, &pkt), 
         "Could not write frame " << currFrameNum << ".  "
         "Perhaps you are out of disk space or have lost write permissions.");
+      return pkt.size;
     } else {
       const int nEncodedBytes = encodeFrame(oc, c, st, outputBuffer, 
                                             OutputBufferSize, codecPicture);
@@ -506,6 +563,7 @@ namespace VideoIO
       VrRecoverableCheckMsg(nEncodedBytes >= 0, 
         "No bytes were encoded for frame " << currFrameNum << ".");
       */
+      return nEncodedBytes;
     }
   }
 
@@ -513,6 +571,39 @@ namespace VideoIO
                               IVideo::Frame const &f) 
   {
     TRACE;
+    VrRecoverableCheck(f.size() == w*h*d);
+    addframe(w, h, d, &f[0]);
+  }
+
+  void FfmpegOVideo::addframe(int w, int h, int d,
+                              unsigned char const *data) 
+  {
+    TRACE;
+    addframeInternal(w, h, d, data);
+  }
+
+  /** All frames go through the same RGB picture, so a batch needs no more
+   *  conversion buffers than a single frame does. */
+  void FfmpegOVideo::addframes(int w, int h, int d, int n, 
+                               unsigned char const *data, 
+                               std::vector<int> &encodedBytes)
+  {
+    TRACE;
+    VrRecoverableCheck(n >= 0);
+    encodedBytes.assign(n, -1);
+    size_t const frameBytes = (size_t)w*h*d;
+    for (int i=0; i<n; i++) {
+      encodedBytes[i] = addframeInternal(w, h, d, data + i*frameBytes);
+    }
+  }
+
+  /** Adds one frame.  Returns the number of bytes written for it, or -1 
+   *  if the frame was queued for the encoder thread. */
+  int FfmpegOVideo::addframeInternal(int w, int h, int d,
+                                     unsigned char const *data) 
+  {
+    TRACE;
+    checkEncodeError();
     VrRecoverableCheck(isOpen());
 
     if (getWidth() == USE_DEFAULT_VAL)  setWidth(w);
@@ -520,27 +611,203 @@ namespace VideoIO
     
     VrRecoverableCheck(w == getWidth());
     VrRecoverableCheck(h == getHeight());
-    VrRecoverableCheck(d == getDepth());
-    VrRecoverableCheck(f.size() == w*h*d);
+    VrRecoverableCheck(d == getDepth() || d == 1);
 
     if (isConfigurable()) finalizeOpen();
 
-    try {
-      matlab2rgb(rgbPicture->data[0], &f[0], w, h, d);
+    if (asyncEncode && (encodeRunning || startEncodeThread(w, h, getDepth()))) {
+      // Wait for a free slot.  Only the worker touches the queued slots, 
+      // so the free one may be filled without holding the lock.
+      pthread_mutex_lock(&encodeMutex);
+      while (encodeCount == encodeRing.size() && !encodeFailed) {
+        pthread_cond_wait(&encodeSlotFree, &encodeMutex);
+      }
+      bool const   failed = encodeFailed;
+      size_t const slot   = (encodeHead + encodeCount) % encodeRing.size();
+      pthread_mutex_unlock(&encodeMutex);
+      if (failed) checkEncodeError();
+
+      memcpy(&encodeRing[slot][0], data, (size_t)w*h*d);
+      encodeRingFrameNums[slot] = ++currFrameNum;
+      encodeRingDepths[slot]    = d;
+
+      pthread_mutex_lock(&encodeMutex);
+      encodeCount++;
+      pthread_cond_signal(&encodeFrameReady);
+      pthread_mutex_unlock(&encodeMutex);
+      return -1;
+    }
 
-      writeVideoFrame(
-#ifdef VIDEO_READER_USE_SWSCALER
-                      imgConvertCtx, w, h,
-#endif
-                      oc, videoStream, ++currFrameNum, 
-                      rgbPicture, codecPicture, 
-                      outputBuffer, OutputBufferSize);
+    try {
+      return encodeRgbFrame(data, w, h, d, ++currFrameNum);
     } catch (VrRecoverableException const &e) {
       close();
       throw;
     }
   }
 
+  /** Converts one frame from Matlab's layout and writes it to the file.  For
+   *  the common planar YUV pixel formats, the frame goes straight into the
+   *  codec's picture in one pass.  Anything else is converted to RGB24 
+   *  first and then to the codec's format by ffmpeg. */
+  int FfmpegOVideo::encodeRgbFrame(unsigned char const *data, 
+                                   int w, int h, int d, int64 frameNum)
+  {
+    TRACE;
+    if (rgbPicture == NULL) {
+      YuvSubsampling subsampling;
+      YuvRange       range;
+      VrRecoverableCheck(getYuvLayout(getCodecFromStream(videoStream)->pix_fmt,
+                                      subsampling, range));
+      unsigned char *const planes[3] = 
+        { codecPicture->data[0], codecPicture->data[1], codecPicture->data[2] };
+      int const strides[3] = { codecPicture->linesize[0], 
+                               codecPicture->linesize[1], 
+                               codecPicture->linesize[2] };
+      matlabToYuv(planes, strides, data, w, h, d, subsampling, range);
+    } else {
+      matlab2rgb(rgbPicture->data[0], data, w, h, d);
+    }
+
+    return writeVideoFrame(
+#ifdef VIDEO_READER_USE_SWSCALER
+                    imgConvertCtx, w, h,
+#endif
+                    oc, videoStream, (int)frameNum, 
+                    rgbPicture, codecPicture, 
+                    outputBuffer, OutputBufferSize);
+  }
+
+  void FfmpegOVideo::flush()
+  {
+    TRACE;
+    stopEncodeThread();
+    checkEncodeError();
+  }
+
+  /** Launches the encoder thread with an empty queue of frames of the 
+   *  given size.  Returns false if the thread could not be created, in 
+   *  which case we just encode synchronously. */
+  bool FfmpegOVideo::startEncodeThread(int w, int h, int d)
+  {
+    TRACE;
+    encodeRing.resize(asyncQueueFrames);
+    encodeRingFrameNums.resize(asyncQueueFrames);
+    encodeRingDepths.resize(asyncQueueFrames);
+    for (size_t i=0; i<encodeRing.size(); i++) {
+      encodeRing[i].resize((size_t)w*h*d);
+    }
+    encodeHead          = 0;
+    encodeCount         = 0;
+    encodeStopRequested = false;
+    encodeFailed        = false;
+    encodeFatal         = false;
+    encodeErrMsg        = "";
+
+    if (pthread_create(&encodeThread, NULL, encodeThreadMain, this) != 0) {
+      PRINTWARN("Could not start the encoder thread.  Encoding "
+                "synchronously instead.");
+      asyncEncode = 0;
+      encodeRing.clear();
+      return false;
+    }
+    encodeRunning = true;
+    return true;
+  }
+
+  /** Waits for the encoder thread to write every queued frame (or to give
+   *  up after an error), then joins it. */
+  void FfmpegOVideo::stopEncodeThread()
+  {
+    TRACE;
+    if (!encodeRunning) return;
+
+    pthread_mutex_lock(&encodeMutex);
+    encodeStopRequested = true;
+    pthread_cond_signal(&encodeFrameReady);
+    pthread_mutex_unlock(&encodeMutex);
+    pthread_join(encodeThread, NULL);
+    encodeRunning = false;
+    encodeHead    = 0;
+    encodeCount   = 0;
+  }
+
+  /** Rethrows an error hit by the encoder thread.  Just like a failed 
+   *  synchronous addframe, the video is closed first. */
+  void FfmpegOVideo::checkEncodeError()
+  {
+    TRACE;
+    pthread_mutex_lock(&encodeMutex);
+    bool const failed = encodeFailed;
+    pthread_mutex_unlock(&encodeMutex);
+    if (!failed) return;
+
+    stopEncodeThread();
+    bool const        fatal  = encodeFatal;
+    std::string const errMsg = encodeErrMsg;
+    encodeFailed = false;
+    close();
+    VrFatalCheckMsg(!fatal, errMsg);
+    VrRecoverableThrow(errMsg);
+  }
+
+  void *FfmpegOVideo::encodeThreadMain(void *self)
+  {
+    ((FfmpegOVideo*)self)->encodeLoop();
+    return NULL;
+  }
+
+  /** Body of the encoder thread.  Frames are written in the order they 
+   *  were queued.  It must never close the video or throw: the first 
+   *  error is recorded, the rest of the queue is dropped, and the thread
+   *  exits. */
+  void FfmpegOVideo::encodeLoop()
+  {
+    while (true) {
+      pthread_mutex_lock(&encodeMutex);
+      while (encodeCount == 0 && !encodeStopRequested) {
+        pthread_cond_wait(&encodeFrameReady, &encodeMutex);
+      }
+      if (encodeCount == 0) {
+        pthread_mutex_unlock(&encodeMutex);
+        return;
+      }
+      size_t const slot = encodeHead;
+      pthread_mutex_unlock(&encodeMutex);
+
+      bool        ok    = false;
+      bool        fatal = false;
+      std::string errMsg;
+      try {
+        encodeRgbFrame(&encodeRing[slot][0], getWidth(), getHeight(), 
+                       encodeRingDepths[slot], encodeRingFrameNums[slot]);
+        ok = true;
+      } catch (VrRecoverableException const &e) {
+        errMsg = e.message;
+      } catch (VrFatalError const &e) {
+        fatal  = true;
+        errMsg = e.message;
+      } catch (...) {
+        fatal  = true;
+        errMsg = "Unexpected exception in the encoder thread.";
+      }
+
+      pthread_mutex_lock(&encodeMutex);
+      if (ok) {
+        encodeHead = (encodeHead + 1) % encodeRing.size();
+        encodeCount--;
+      } else {
+        encodeFailed = true;
+        encodeFatal  = fatal;
+        encodeErrMsg = errMsg;
+        encodeCount  = 0;
+      }
+      pthread_cond_signal(&encodeSlotFree);
+      pthread_mutex_unlock(&encodeMutex);
+      if (!ok) return;
+    }
+  }
+
   void FfmpegOVideo::setFramesPerSecond(double newVal)
   { 
     VrRecoverableCheck(isConfigurable()); 
@@ -618,6 +885,20 @@ namespace VideoIO
     codecId = newCodecId;
   }
 
+  void FfmpegOVideo::setAsyncEncode(int newVal)
+  { 
+    VrRecoverableCheck(isConfigurable()); 
+    asyncEncode = newVal; 
+  }
+
+  void FfmpegOVideo::setAsyncQueueFrames(int newVal)
+  { 
+    VrRecoverableCheck(isConfigurable()); 
+    VrRecoverableCheckMsg(newVal > 0, 
+                          "asyncQueueFrames must be positive.");
+    asyncQueueFrames = newVal; 
+  }
+
   void FfmpegOVideo::setCodec(string const &codecName)
   { 
     CodecID newCodecId = parseCodecId(codecName);
@@ -720,9 +1001,12 @@ namespace VideoIO
     }
 
     VERBOSE("Opening the codec...");
-    FfRecoverableCheckMsg(avcodec_open(c, codec),
-                          "Could not initialize the codec.  "
-                          "Perhaps you've chosen an unsupported frame rate.");
+    {
+      FfmpegCodecLock lock;
+      FfRecoverableCheckMsg(avcodec_open(c, codec),
+                            "Could not initialize the codec.  "
+                            "Perhaps you've chosen an unsupported frame rate.");
+    }
     // When avcodec_open fails, it tends to leave a mess, so we use a flag
     // to tell us if it succeeded.  There a chance that our close method will 
     // leak memory on failed avcodec_open attempts.
@@ -738,11 +1022,16 @@ namespace VideoIO
     VrRecoverableCheck(
       codecPicture = allocPicture(c->pix_fmt, c->width, c->height));
     
-    VERBOSE("Allocating input image wrapper...");
-    VrRecoverableCheckMsg(
-      rgbPicture = allocPicture(PIX_FMT_RGB24, c->width, c->height),
-      "Could not allocate a " << c->width << "x" << c->height << 
-      " RGB image.  Perhaps you are out of memory.");    
+    // matlabToYuv fills codecPicture directly for the usual formats.
+    YuvSubsampling subsampling;
+    YuvRange       range;
+    if (!getYuvLayout(c->pix_fmt, subsampling, range)) {
+      VERBOSE("Allocating input image wrapper...");
+      VrRecoverableCheckMsg(
+        rgbPicture = allocPicture(PIX_FMT_RGB24, c->width, c->height),
+        "Could not allocate a " << c->width << "x" << c->height << 
+        " RGB image.  Perhaps you are out of memory.");    
+    }
   }
 
 #define SETINTVAL(varname, fieldname) \
@@ -51,6 +51,7 @@ SOFTWARE.
 #include <math.h>
 #include <limits>
 #include <memory>
+#include <pthread.h>
 
 namespace VideoIO 
 {
@@ -76,7 +77,7 @@ namespace VideoIO
   public:
     // Constructors/Destructors
     FfmpegOVideo();
-    virtual ~FfmpegOVideo() { TRACE; close(); };
+    virtual ~FfmpegOVideo();
 
     virtual void setup(KeyValueMap &kvm);
 
@@ -85,6 +86,12 @@ namespace VideoIO
     virtual void         close();
     virtual void         addframe(int w, int h, int d,
                                   IVideo::Frame const &f);
+    virtual void         addframe(int w, int h, int d,
+                                  unsigned char const *data);
+    virtual void         addframes(int w, int h, int d, int n,
+                                   unsigned char const *data, 
+                                   std::vector<int> &encodedBytes);
+    virtual void         flush();
 
     // Only callable when !isOpen()
     void setFramesPerSecond(double newVal);
@@ -97,6 +104,8 @@ namespace VideoIO
     void setMaxBFrames(int newVal);
     void setCodec(CodecID newCodecId);
     void setCodec(std::string const &codecName);
+    void setAsyncEncode(int newVal);
+    void setAsyncQueueFrames(int newVal);
 
     // Callable any time.  For int and CodecID return vals, -1 means the
     // default value will be (is being) used.  No default framesPerSecond
@@ -113,6 +122,8 @@ namespace VideoIO
     int                 getGopSize()          const { return gopSize; }
     int                 getMaxBFrames()       const { return maxBFrames; }
     CodecID             getCodec()            const { return codecId; }
+    int                 getAsyncEncode()      const { return asyncEncode; }
+    int                 getAsyncQueueFrames() const { return asyncQueueFrames; }
     std::string         getCodecName()        const;
 
   private:
@@ -120,12 +131,29 @@ namespace VideoIO
     void      finalizeOpen();  // locks in the configuration, calls openVideo
     void      openVideo();     // just opens the video file
     AVStream *addVideoStream();
+    int       encodeRgbFrame(unsigned char const *data, int w, int h, int d,
+                             int64 frameNum);
+    int       addframeInternal(int w, int h, int d, 
+                               unsigned char const *data);
+
+    // encoder thread (see addframe)
+    bool         startEncodeThread(int w, int h, int d);
+    void         stopEncodeThread();
+    void         checkEncodeError();
+    static void *encodeThreadMain(void *self);
+    void         encodeLoop();
 
     // config params
     int     fpsNum, fpsDenom;
     int     bitRate, bitRateTolerance, gopSize, maxBFrames;
     int     width, height;
     CodecID codecId;
+    /** If non-zero, addframe just queues the frame and a background 
+     *  thread converts, encodes, and writes it. */
+    int     asyncEncode;
+    /** Maximum number of frames waiting for the encoder thread.  addframe
+     *  blocks when the queue is full. */
+    int     asyncQueueFrames;
 
     // runtime data structures
     AVOutputFormat    *fmt;
@@ -142,6 +170,36 @@ namespace VideoIO
 #ifdef VIDEO_READER_USE_SWSCALER
     struct SwsContext *imgConvertCtx;
 #endif 
+
+    /** True while encodeThread exists.  When it is running, the thread 
+     *  owns the codec, the pictures, and the output file. */
+    bool                       encodeRunning;
+    pthread_t                  encodeThread;
+    /** Guards all of the encode* fields below */
+    pthread_mutex_t            encodeMutex;
+    /** Signalled when a frame is queued or when the thread must stop */
+    pthread_cond_t             encodeFrameReady;
+    /** Signalled when the thread finishes with a frame or gives up */
+    pthread_cond_t             encodeSlotFree;
+    /** Ring of queued frames, in Matlab's layout.  Each slot can hold a 
+     *  color frame. */
+    std::vector<IVideo::Frame> encodeRing;
+    /** Frame number of each entry in encodeRing (for error messages) */
+    std::vector<int64>         encodeRingFrameNums;
+    /** Depth of each entry in encodeRing (1 for grayscale, else 3) */
+    std::vector<int>           encodeRingDepths;
+    /** Index of the oldest queued frame in encodeRing */
+    size_t                     encodeHead;
+    /** Number of queued frames in encodeRing */
+    size_t                     encodeCount;
+    /** Set by the main thread to ask the worker to exit once the queue 
+     *  is empty */
+    bool                       encodeStopRequested;
+    /** Set by the worker when a frame could not be written.  The error 
+     *  is reported by the next addframe, flush, or close. */
+    bool                       encodeFailed;
+    bool                       encodeFatal;
+    std::string                encodeErrMsg;
   };
 
 #undef AO
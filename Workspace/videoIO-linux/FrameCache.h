@@ -0,0 +1,163 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include <list>
+#include <map>
+#include <vector>
+#include <stddef.h>
+
+namespace VideoIO 
+{
+
+  /** A least-recently-used cache of decoded frames.  Readers use it so 
+   *  that going back and forth over the same few frames (e.g. scrubbing in
+   *  a video player) does not decode them again.  Frames are stored in the
+   *  same format as IVideo::currFrame.  A reader's own cache is keyed by 
+   *  frame number (see FrameCache); a cache shared by several readers 
+   *  needs a key that also says which video and output format a frame 
+   *  belongs to.  The cache is not thread safe. */
+  template <class Key>
+  class BasicFrameCache
+  {
+  public:
+    typedef std::vector<unsigned char> Frame;
+
+    BasicFrameCache() : 
+      maxBytes(0), nBytes(0), nHits(0), nMisses(0), nEvictions(0)
+    {}
+
+    /** Sets the capacity in bytes, evicting frames as needed.  0 disables
+     *  the cache. */
+    void setMaxBytes(size_t bytes) {
+      maxBytes = bytes;
+      while (nBytes > maxBytes) evict();
+    }
+    size_t getMaxBytes() const { return maxBytes; }
+    bool   enabled()     const { return maxBytes > 0; }
+
+    /** If frameNum is cached, copies it to dst and returns true. */
+    bool lookup(Key const &frameNum, Frame &dst) {
+      if (!enabled()) return false;
+      typename Index::iterator i = index.find(frameNum);
+      if (i == index.end()) {
+        nMisses++;
+        return false;
+      }
+      nHits++;
+      touch(i->second);
+      dst = i->second->frame;
+      return true;
+    }
+
+    /** Adds a copy of f as frameNum, evicting the least recently used 
+     *  frames to make room.  Frames larger than the whole cache are not 
+     *  stored. */
+    void insert(Key const &frameNum, Frame const &f) {
+      if (f.size() > maxBytes) return;
+      typename Index::iterator i = index.find(frameNum);
+      if (i != index.end()) {
+        touch(i->second);
+        return;
+      }
+
+      // Recycle the evicted frames' buffers to avoid reallocating.
+      Frame spare;
+      while (nBytes + f.size() > maxBytes) evict(&spare);
+      entries.push_front(Entry());
+      Entry &e = entries.front();
+      e.frameNum = frameNum;
+      e.frame.swap(spare);
+      e.frame    = f;
+      index[frameNum] = entries.begin();
+      nBytes    += f.size();
+    }
+
+    /** Forgets all frames (e.g. when the video is closed).  The statistics
+     *  are kept. */
+    void clear() {
+      entries.clear();
+      index.clear();
+      nBytes = 0;
+    }
+
+    size_t        numFrames()    const { return index.size(); }
+    size_t        numBytes()     const { return nBytes; }
+    unsigned long numHits()      const { return nHits; }
+    unsigned long numMisses()    const { return nMisses; }
+    unsigned long numEvictions() const { return nEvictions; }
+
+  private:
+    struct Entry {
+      Key   frameNum;
+      Frame frame;
+    };
+    /** Most recently used first */
+    typedef std::list<Entry>                          Entries;
+    typedef std::map<Key, typename Entries::iterator> Index;
+
+    /** Marks e as the most recently used frame */
+    void touch(typename Entries::iterator e) {
+      entries.splice(entries.begin(), entries, e);
+    }
+
+    /** Drops the least recently used frame */
+    void evict(Frame *spare = NULL) {
+      Entry &lru = entries.back();
+      nBytes -= lru.frame.size();
+      if (spare != NULL) spare->swap(lru.frame);
+      index.erase(lru.frameNum);
+      entries.pop_back();
+      nEvictions++;
+    }
+
+    Entries       entries;
+    Index         index;
+    size_t        maxBytes;
+    size_t        nBytes;
+    unsigned long nHits;
+    unsigned long nMisses;
+    unsigned long nEvictions;
+  };
+
+  /** A single reader's frame cache, keyed by frame number */
+  typedef BasicFrameCache<int> FrameCache;
+
+}; /* namespace VideoIO */
+
+#endif
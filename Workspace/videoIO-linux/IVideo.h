@@ -110,8 +110,22 @@ namespace VideoIO
     virtual bool         next()                        = 0;
     virtual bool         step(int numFrames=1)         = 0;
     virtual bool         seek(int toFrame)             = 0;
+    /** Seeks to the frame being displayed at the given time (in seconds,
+     *  relative to the first frame).  The default assumes a constant 
+     *  frame rate. */
+    virtual bool         seekTime(double seconds) { 
+      if (seconds < 0) return false;
+      return seek((int)floor(seconds * fps() + 1e-6)); 
+    }
     virtual int          currFrameNum()          const = 0;
     virtual Frame const &currFrame()             const = 0; 
+    /** Copies the current frame into dst, which must hold 
+     *  height()*width()*depth() bytes.  Lets callers reuse one buffer for
+     *  every frame instead of allocating a new one each time. */
+    virtual void         currFrameInto(unsigned char *dst) const {
+      Frame const &f = currFrame();
+      if (!f.empty()) memcpy(dst, &f[0], f.size());
+    }
 
     // video stats
     virtual std::string  filename()             const = 0;
@@ -43,6 +43,7 @@ SOFTWARE.
 #include <limits> 
 #include <memory>
 #include <map> 
+#include <algorithm>
 #include "IVideo.h"
 #include "parse.h"
 
@@ -102,6 +103,35 @@ namespace VideoIO
     virtual void close()                           = 0;
     virtual void addframe(int w, int h, int d, 
                           IVideo::Frame const &f)  = 0;
+    // Same as above, but for a caller-owned buffer of w*h*d bytes.
+    // Implementations that can consume the buffer directly should override
+    // this to avoid the copy made here.  Grayscale frames (d == 1) are 
+    // expanded to color here if the implementation needs color.
+    virtual void addframe(int w, int h, int d, unsigned char const *data) {
+      if (d == 1 && getDepth() == 3) {
+        size_t const n = (size_t)w*h;
+        IVideo::Frame f(3*n);
+        for (int c=0; c<3; c++) std::copy(data, data + n, f.begin() + c*n);
+        addframe(w, h, 3, f);
+        return;
+      }
+      IVideo::Frame f(data, data + (size_t)w*h*d);
+      addframe(w, h, d, f);
+    }
+    // Adds n frames stored one after the other in data.  encodedBytes[i]
+    // receives the number of bytes written to the file for frame i, 0 if 
+    // the encoder buffered the frame, or -1 if the number is not known 
+    // (the default, and with background encoding).
+    virtual void addframes(int w, int h, int d, int n, 
+                           unsigned char const *data, 
+                           std::vector<int> &encodedBytes) {
+      encodedBytes.assign(n, -1);
+      for (int i=0; i<n; i++) addframe(w, h, d, data + (size_t)i*w*h*d);
+    }
+    // Blocks until every frame given to addframe has been handed to the 
+    // encoder.  Implementations that encode in the background report 
+    // deferred encoding errors here (close must not throw).
+    virtual void flush() { }
     virtual bool isOpen() const = 0;
   };
 
@@ -0,0 +1,134 @@
+#ifndef CACHEDIR_H
+#define CACHEDIR_H
+
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include <string>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "parse.h"
+
+namespace VideoIO 
+{
+
+  /** Helpers for the files we cache between sessions (keyframe indexes, 
+   *  libmpeg3 .toc files).  They live in a per-user directory under 
+   *  $TMPDIR (or /tmp).  Since their contents are trusted when a video is
+   *  reopened, that directory must be a real directory that belongs to us
+   *  and that nobody else can write to (see makePrivateCacheDir). */
+
+  /** The default cache directory for files of the given kind */
+  inline std::string defaultCacheDir(char const *kind)
+  {
+    char const *tmp = getenv("TMPDIR");
+    return std::string((tmp != NULL && *tmp != '\0') ? tmp : "/tmp") + 
+      "/videoIO-" + kind + "-" + toString(getuid());
+  }
+
+  /** True iff dir is a directory, not a symlink, owned by us, and not 
+   *  writable by anyone else */
+  inline bool cacheDirIsPrivate(std::string const &dir)
+  {
+    struct stat st;
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+      st.st_uid == getuid() && (st.st_mode & 022) == 0;
+  }
+
+  /** Creates dir (mode 0700) and any missing parents.  Returns 
+   *  cacheDirIsPrivate(dir). */
+  inline bool makePrivateCacheDir(std::string const &dir)
+  {
+    for (std::string::size_type i=1; i<=dir.size(); i++) {
+      if (i == dir.size() || dir[i] == '/') {
+        mkdir(dir.substr(0, i).c_str(), (i == dir.size()) ? 0700 : 0777);
+      }
+    }
+    return cacheDirIsPrivate(dir);
+  }
+
+  /** Name of the cached file for src inside cacheDir.  The name includes a
+   *  hash of src's absolute path and src's size and mtime, so renamed, 
+   *  replaced, or modified files get a fresh one. */
+  inline std::string cachedFilename(std::string const &cacheDir,
+                                    std::string const &src, 
+                                    char const *ext)
+  {
+    char absPath[PATH_MAX];
+    std::string const key = 
+      (realpath(src.c_str(), absPath) != NULL) ? absPath : src;
+
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i=0; i<key.size(); i++) {
+      hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+    }
+    char hashStr[9];
+    snprintf(hashStr, sizeof(hashStr), "%08x", hash);
+
+    struct stat st;
+    long long size = 0, mtime = 0;
+    if (stat(src.c_str(), &st) == 0) {
+      size  = (long long)st.st_size;
+      mtime = (long long)st.st_mtime;
+    }
+
+    std::string::size_type const slash = key.find_last_of('/');
+    std::string const base = 
+      key.substr(slash == std::string::npos ? 0 : slash + 1);
+    std::string const stem = base.substr(0, base.find_last_of('.'));
+    return cacheDir + "/" + stem + "-" + hashStr + "-" + toString(size) + 
+      "-" + toString(mtime) + ext;
+  }
+
+  /** Creates a new, empty, private temporary file next to dst, to be 
+   *  renamed to dst once it is complete.  Returns its file descriptor and
+   *  sets tmpName, or returns -1. */
+  inline int createTempFile(std::string const &dst, std::string &tmpName)
+  {
+    std::string name = dst + ".XXXXXX";
+    int const fd = mkstemp(&name[0]);
+    if (fd >= 0) tmpName = name;
+    return fd;
+  }
+
+}; /* namespace VideoIO */
+
+#endif
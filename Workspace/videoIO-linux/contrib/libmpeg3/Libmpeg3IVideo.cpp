@@ -8,8 +8,15 @@ copyright stuff
 
 #include <iostream>
 #include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include "Libmpeg3IVideo.h"
 #include "registry.h"
+#include "cachedir.h"
 #include <algorithm>
 #include <cctype>
 
@@ -30,26 +37,6 @@ namespace VideoIO
     registerIVideoManager(new Libmpeg3IVideoManager()));
   
 
-  // This function generates a .toc file to be named dst from .mpg src.
-  // Code taken from mpeg3toc util for Libmpeg3
-  bool generateTOCFile(std::string &src,std::string &dst)
-  {
-    int64_t total_bytes;
-    mpeg3_t *file = mpeg3_start_toc((char *)src.c_str(), (char *)dst.c_str(), &total_bytes);
-  
-    if(!file) { return false; }
-    
-    int64_t bytes_processed = 0;
-    
-    while(bytes_processed < total_bytes) {
-      mpeg3_do_toc(file, &bytes_processed);
-    }
-
-    mpeg3_stop_toc(file);
-    return true;
-    
-  }
-  
   // Stupid utility to make things lower case
   // and avoid name conflicts
   int lower_case ( int c )
@@ -57,8 +44,6 @@ namespace VideoIO
     return tolower ( c );
   }
 
-  
-  
   Libmpeg3IVideo::Libmpeg3IVideo() :
     fname(""), 
     currentFrameNumber(-1),
@@ -66,34 +51,46 @@ namespace VideoIO
     pFile(NULL), 
     nHiddenFinalFrames(0),
     nCPUs(1),
+    fileFrameNumber(-1),
+    gopParallel(false),
+    gopChunkFrames(15),
+    gopOrigin(-1),
+    gopWindowFirst(0),
+    gopNumFrames(0),
+    gopStopRequested(false),
+    backgroundToc(true),
+    tocState(TOC_READY),
+    tocRunning(false),
+    tocStopRequested(false),
+    tocDone(false),
+    tocOk(false),
     frameWidth(-1),
-    frameHeight(-1)
+    frameHeight(-1),
+    subsampling(YUV_420),
+    grayOutput(false),
+    yuvOutput(false)
   { 
     TRACE;
+    long const onlineCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (onlineCPUs > 1) nCPUs = (int)onlineCPUs;
+    pthread_mutex_init(&gopMutex, NULL);
+    pthread_cond_init(&gopWork, NULL);
+    pthread_cond_init(&gopDone, NULL);
+    pthread_mutex_init(&tocMutex, NULL);
+    pthread_cond_init(&tocFinished, NULL);
   }
 
-  /** Converts C-style RGB images to Matlab's preferred byte layout for images.
-   */
-  static inline void rgbToMatlab(unsigned char *out, 
-    unsigned char const *bgrData, 
-    int w, int h, int d)
-  {    
-    const int dy = w*d;
-    for (int c=(d-1); c>=0; c--) {
-      for (int x=0; x<w; x++) {
-        unsigned char const *b = &bgrData[x*d + (d-1-c)];
-        for (int y=0; y<h; y++) {
-          // We need to transpose from row-major to column-major, and do 
-          // BGR->RGB conversion.
-          //*out++ = bgrData[(x+y*w)*d + (d-1-c)]; // without unrolling
-          *out++ = *b; 
-          b += dy;
-        }
-      }
-    }
+  Libmpeg3IVideo::~Libmpeg3IVideo()
+  {
+    TRACE;
+    close();
+    pthread_cond_destroy(&tocFinished);
+    pthread_mutex_destroy(&tocMutex);
+    pthread_cond_destroy(&gopDone);
+    pthread_cond_destroy(&gopWork);
+    pthread_mutex_destroy(&gopMutex);
   }
 
- 
 /** For now this plugin can only seek if a .toc file was specified. 
   * .toc files can be created with the mpeg3toc util that is part of Libmpeg3.
   */
@@ -116,39 +113,528 @@ namespace VideoIO
     TRACE;
     VrRecoverableCheckMsg(isOpen(), "No video file is open.");
     VrRecoverableCheckMsg(toFrame >= 0, "Cannot seek to frame " << toFrame << ".");
-    VrRecoverableCheckMsg(toFrame < numFrames(), 
+    VrRecoverableCheckMsg(numFrames() < 0 || toFrame < numFrames(), 
                           "Frame " << toFrame << " is past the end of this video.");
+
+    if (frameCache.lookup(toFrame, currentFrame)) {
+      VERBOSE("Frame " << toFrame << " found in the frame cache.");
+      currentFrameNumber = toFrame;
+      return true;
+    }
+    if (!seekLowLevel(toFrame)) return false;
+    frameCache.insert(toFrame, currentFrame);
+    return true;
+  }
+
+  /** Decodes toFrame into currentFrame, bypassing the frame cache */
+  bool Libmpeg3IVideo::seekLowLevel(int toFrame)
+  {
+    TRACE;
+    if (tocState != TOC_READY) {
+      // Reading forward works without the .toc.  Anything else waits for 
+      // the background build to finish.
+      bool const forward = (toFrame > fileFrameNumber);
+      if (tocState == TOC_FAILED || !switchToToc(!forward)) {
+        return seekSequential(toFrame);
+      }
+    }
     
+    if (!gopWorkers.empty() && seekGopParallel(toFrame)) {
+      currentFrameNumber = toFrame;
+      return true;
+    }
     
-    // There is some issue with seeking backwards with libmpeg3
-    if(toFrame < currentFrameNumber) {
-      VERBOSE("Seeking backwards: Reopening file to ensure consistent behavoir");
-      close();
-      open(fname);
+    // libmpeg3 does not reset its decoder properly when seeking backwards,
+    // so we switch to a fresh handle first.  mpeg3_open_copy copies the
+    // table of contents from the old handle instead of rereading the .toc,
+    // and mpeg3_set_frame then uses the table to jump to the I-frame 
+    // before toFrame and decode forward from there.  The copy still
+    // allocates a whole new decoder, which is why repeated backward seeks
+    // should be served by the frame cache in seek() instead.
+    if(toFrame < fileFrameNumber) {
+      VERBOSE("Seeking backwards: restarting the decoder");
+      int err = 0;
+      mpeg3_t *fresh = mpeg3_open_copy((char *)fname.c_str(), pFile, &err);
+      if (fresh != NULL && err != 0) {
+        mpeg3_close(fresh);
+        fresh = NULL;
+      }
+      VrRecoverableCheckMsg(fresh != NULL, 
+                            "Libmpeg3 could not reopen " << fname);
+      mpeg3_set_cpus(fresh, nCPUs);
+      mpeg3_close(pFile);
+      pFile = fresh;
+      fileFrameNumber = -1;
     }
     
     VERBOSE("Seeking to frame "<< toFrame );
     
     mpeg3_set_frame(pFile, (long)toFrame, videoStream);
-    currentFrameNumber = (int) mpeg3_get_frame(pFile, videoStream);
+    fileFrameNumber = (int) mpeg3_get_frame(pFile, videoStream);
     
-    VrRecoverableCheckMsg(currentFrameNumber == toFrame, 
+    VrRecoverableCheckMsg(fileFrameNumber == toFrame, 
                           "Failed to seek to frame " << toFrame << ".");
     
-    // Decode Frame into rgb buffer
-    VERBOSE("Decoding Frame.");
-    mpeg3_read_frame(pFile,&rgbRowPtrs[0],0,0,width(),height(),
-                     width(),height(),MPEG3_RGB888,videoStream);
-    
-    // Convert to matlab
-    VERBOSE("Converting frame to Matlab Format.");    
-    rgbToMatlab(&currentFrame[0], &rgbData[0], width(), height(), depth());
+    unsigned char *raw = yuvData.empty() ? &rgbData[0] : &yuvData[0];
+    decodeRaw(pFile, raw, toFrame);
+    rawToMatlab(raw);
+    currentFrameNumber = toFrame;
     
     VERBOSE("Frame gotten and converted.");
     
     return true;
   }
 
+  /** Size of one decoded-but-not-converted frame, as produced by decodeRaw */
+  size_t Libmpeg3IVideo::rawFrameBytes() const
+  {
+    return yuvData.empty() ? rgbData.size() : yuvData.size();
+  }
+
+  /** Decodes the frame file is positioned at into raw, which has the layout
+   *  of yuvData or rgbData (whichever one open chose).  This must not touch
+   *  any member that changes after open: the GOP workers call it 
+   *  concurrently with their own handles. */
+  void Libmpeg3IVideo::decodeRaw(mpeg3_t *file, unsigned char *raw, 
+                                 int frameNum) const
+  {
+    const int w = frameWidth, h = frameHeight;
+    if (!yuvData.empty()) {
+      VERBOSE("Decoding Frame as YUV.");
+      const int cw = (w + 1) / 2;
+      const int ch = (subsampling == YUV_420) ? (h + 1) / 2 : h;
+      unsigned char *y = raw;
+      unsigned char *u = y + w * h;
+      unsigned char *v = u + cw * ch;
+      VrRecoverableCheckMsg(
+        mpeg3_read_yuvframe(file, (char*)y, (char*)u, (char*)v, 
+                            0, 0, w, h, videoStream) == 0,
+        "Failed to decode frame " << frameNum << ".");
+    } else {
+      VERBOSE("Decoding Frame as RGB.");
+      std::vector<unsigned char *> rows(h);
+      for (int k=0; k<h; k++) rows[k] = &raw[k*w*3];
+      VrRecoverableCheckMsg(
+        mpeg3_read_frame(file, &rows[0], 0, 0, w, h, w, h, MPEG3_RGB888, 
+                         videoStream) == 0,
+        "Failed to decode frame " << frameNum << ".");
+    }
+  }
+
+  /** Converts a frame produced by decodeRaw into currentFrame */
+  void Libmpeg3IVideo::rawToMatlab(unsigned char const *raw)
+  {
+    VERBOSE("Converting frame to Matlab Format.");
+    const int w = width(), h = height();
+    if (!yuvData.empty()) {
+      const int cw = (w + 1) / 2;
+      const int ch = (subsampling == YUV_420) ? (h + 1) / 2 : h;
+      unsigned char const *y = raw;
+      unsigned char const *u = y + w * h;
+      unsigned char const *v = u + cw * ch;
+      unsigned char const *const planes[3] = { y, u, v };
+      int const strides[3] = { w, cw, cw };
+      if (grayOutput) {
+        planeToMatlab(&currentFrame[0], y, w, h, w);
+      } else if (yuvOutput) {
+        yuvPlanesToMatlab(&currentFrame[0], w, h, planes, strides, 
+                          subsampling);
+      } else {
+        yuvToMatlab(&currentFrame[0], w, h, planes, strides, 
+                    subsampling, YUV_MPEG_RANGE);
+      }
+    } else {
+      packedToMatlab(&currentFrame[0], raw, w, h, depth(), w*depth(), false);
+    }
+  }
+
+  /** Used while there is no .toc.  pFile is then the .mpg itself, which 
+   *  libmpeg3 can only decode from start to end, so we decode forward to
+   *  toFrame, reopening the file first if toFrame is behind us.  Since the
+   *  number of frames is unknown, a failure to decode is treated as the 
+   *  end of the video. */
+  bool Libmpeg3IVideo::seekSequential(int toFrame)
+  {
+    TRACE;
+    if (toFrame <= fileFrameNumber) {
+      VERBOSE("Seeking backwards without a .toc: reopening " << fname);
+      mpeg3_close(pFile);
+      pFile = openHandle(fname);
+      fileFrameNumber = -1;
+    }
+    
+    unsigned char *raw = yuvData.empty() ? &rgbData[0] : &yuvData[0];
+    try {
+      if (toFrame > fileFrameNumber + 1) {
+        mpeg3_drop_frames(pFile, toFrame - fileFrameNumber - 1, videoStream);
+      }
+      decodeRaw(pFile, raw, toFrame);
+    } catch (VrRecoverableException const &e) {
+      VERBOSE("Treating decode failure as the end of the video: " << 
+              e.message);
+      return false;
+    }
+    fileFrameNumber    = toFrame;
+    rawToMatlab(raw);
+    currentFrameNumber = toFrame;
+    return true;
+  }
+
+  /** Switches from reading the .mpg to reading through its freshly built
+   *  .toc.  If wait is false and the .toc is not done yet, we return false
+   *  and keep reading the .mpg. */
+  bool Libmpeg3IVideo::switchToToc(bool wait)
+  {
+    TRACE;
+    pthread_mutex_lock(&tocMutex);
+    if (wait && !tocDone) {
+      VERBOSE("Waiting for " << tocFname << " to be built.");
+      while (!tocDone) pthread_cond_wait(&tocFinished, &tocMutex);
+    }
+    bool const done = tocDone;
+    bool const ok   = tocOk;
+    pthread_mutex_unlock(&tocMutex);
+    if (!done) return false;
+
+    pthread_join(tocThread, NULL);
+    tocRunning = false;
+
+    if (!ok) {
+      PRINTWARN("Could not build " << tocFname << ".  Backward seeks will "
+                "decode " << fname << " from the beginning.");
+      tocState = TOC_FAILED;
+      return false;
+    }
+
+    VERBOSE("Switching to " << tocFname << " for fast indexing");
+    mpeg3_close(pFile);
+    pFile = NULL;
+    fname = tocFname;
+    pFile = openHandle(fname);
+    fileFrameNumber = -1;
+    tocState = TOC_READY;
+    if (gopParallel && nCPUs > 1) startGopWorkers();
+    return true;
+  }
+
+  /** Returns true if a stop of the background .toc build was requested */
+  bool Libmpeg3IVideo::tocStopWanted()
+  {
+    pthread_mutex_lock(&tocMutex);
+    bool const stop = tocStopRequested;
+    pthread_mutex_unlock(&tocMutex);
+    return stop;
+  }
+
+  /** Generates the .toc file dst from the .mpg src.  The table is written 
+   *  to a temporary file that is renamed into place when complete, so 
+   *  other readers never see a partial .toc.  Code taken from the mpeg3toc
+   *  util for Libmpeg3.
+   *
+   *  libmpeg3 builds the table in a single pass over the file (and has no
+   *  way to merge tables), so the scan cannot be split across threads. */
+  bool Libmpeg3IVideo::buildToc(std::string const &src, std::string const &dst)
+  {
+    TRACE;
+    // Several videos (even in one process) may build the same .toc at 
+    // once, and the directory may be shared, so let mkstemp pick a fresh
+    // name that nobody else can have opened.  libmpeg3 reopens it by name.
+    std::string tmp;
+    int const tmpFd = createTempFile(dst, tmp);
+    if (tmpFd < 0) return false;
+    ::close(tmpFd);
+    int64_t total_bytes;
+    mpeg3_t *file = mpeg3_start_toc((char *)src.c_str(), (char *)tmp.c_str(),
+                                    &total_bytes);
+    if(!file) { 
+      unlink(tmp.c_str());
+      return false; 
+    }
+    
+    int64_t bytes_processed = 0;
+    bool    stopped         = false;
+    while(bytes_processed < total_bytes) {
+      if (tocStopWanted()) {
+        stopped = true;
+        break;
+      }
+      mpeg3_do_toc(file, &bytes_processed);
+    }
+
+    mpeg3_stop_toc(file);
+    if (stopped || rename(tmp.c_str(), dst.c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  void *Libmpeg3IVideo::tocThreadMain(void *self)
+  {
+    ((Libmpeg3IVideo*)self)->tocLoop();
+    return NULL;
+  }
+
+  /** Body of the background .toc thread */
+  void Libmpeg3IVideo::tocLoop()
+  {
+    bool const ok = buildToc(tocSrcFname, tocFname);
+    pthread_mutex_lock(&tocMutex);
+    tocDone = true;
+    tocOk   = ok;
+    pthread_cond_broadcast(&tocFinished);
+    pthread_mutex_unlock(&tocMutex);
+  }
+
+  /** Stops the background .toc build, if any, and throws away its partial
+   *  output. */
+  void Libmpeg3IVideo::stopTocBuild()
+  {
+    TRACE;
+    if (!tocRunning) return;
+    pthread_mutex_lock(&tocMutex);
+    tocStopRequested = true;
+    pthread_mutex_unlock(&tocMutex);
+    pthread_join(tocThread, NULL);
+    tocRunning = false;
+  }
+
+  /** Opens path with libmpeg3 and applies the per-handle settings */
+  mpeg3_t *Libmpeg3IVideo::openHandle(std::string const &path)
+  {
+    VrRecoverableCheckMsg(
+      mpeg3_check_sig((char *)path.c_str()),
+      "Could not open \"" << path << "\".  Make sure the filename is "
+      "correct, that the file is not corrupted, and that mpeg3toc or"
+      "libmpeg3 can read the file.");
+    
+    int err = 0;
+    mpeg3_t *file = mpeg3_open((char *)path.c_str(),&err);
+    if (file != NULL && err != 0) {
+      mpeg3_close(file);
+      file = NULL;
+    }
+    VrRecoverableCheckMsg(file != NULL, "Libmpeg3 could not open " << path);
+
+    // Let libmpeg3 split each picture's slices across the CPUs.  This 
+    // helps random access too, unlike the GOP workers.
+    mpeg3_set_cpus(file, nCPUs);
+    return file;
+  }
+
+  /** Serves toFrame from the GOP workers if it belongs to a chunk they have
+   *  been given, or if it is the frame right after the current one (in 
+   *  which case a new window of chunks is started at toFrame).  Returns 
+   *  false for any other seek; the caller then decodes it with pFile.
+   *
+   *  MPEG-1/2 frames can only be decoded starting from an I-frame, so each
+   *  worker seeks its own handle to the start of its chunk (libmpeg3 
+   *  decodes forward from the preceding I-frame using the .toc) and then 
+   *  decodes the chunk sequentially.  Chunks are independent, so nCPUs of
+   *  them are decoded at once.  Longer chunks waste less time on those
+   *  seeks but use more memory. */
+  bool Libmpeg3IVideo::seekGopParallel(int toFrame)
+  {
+    TRACE;
+    int const nWorkers = (int)gopWorkers.size();
+
+    pthread_mutex_lock(&gopMutex);
+    int chunk = (gopOrigin >= 0 && toFrame >= gopOrigin) ? 
+      (toFrame - gopOrigin) / gopChunkFrames : -1;
+    if (chunk < gopWindowFirst || chunk >= gopWindowFirst + nWorkers) {
+      if (toFrame != currentFrameNumber + 1) {
+        pthread_mutex_unlock(&gopMutex);
+        return false;
+      }
+      VERBOSE("Starting GOP-parallel read-ahead at frame " << toFrame);
+      gopOrigin      = toFrame;
+      gopWindowFirst = 0;
+      for (int c=0; c<nWorkers; c++) assignGopChunk(c);
+      chunk = 0;
+    }
+
+    // Hand the workers of the chunks we have moved past the next ones
+    while (gopWindowFirst < chunk) {
+      assignGopChunk(gopWindowFirst + nWorkers);
+      gopWindowFirst++;
+    }
+
+    GopWorker &w = gopWorkers[chunk % nWorkers];
+    while (w.state == GopWorker::ASSIGNED || w.state == GopWorker::BUSY) {
+      pthread_cond_wait(&gopDone, &gopMutex);
+    }
+    if (w.state != GopWorker::READY) {
+      bool const        fatal  = w.fatal;
+      std::string const errMsg = w.errMsg;
+      gopOrigin = -1;
+      pthread_mutex_unlock(&gopMutex);
+      VrFatalCheckMsg(!fatal, errMsg);
+      VrRecoverableThrow(errMsg);
+    }
+    int const offset = toFrame - w.first;
+    pthread_mutex_unlock(&gopMutex);
+
+    // w stays READY until we reassign it, so its frames are ours to read.
+    rawToMatlab(&w.frames[offset * rawFrameBytes()]);
+    return true;
+  }
+
+  /** Gives chunk to its worker, abandoning whatever that worker was doing.
+   *  Must be called with gopMutex held. */
+  void Libmpeg3IVideo::assignGopChunk(int chunk)
+  {
+    GopWorker &w = gopWorkers[chunk % gopWorkers.size()];
+    w.cancel = true;
+    while (w.state == GopWorker::BUSY) pthread_cond_wait(&gopDone, &gopMutex);
+    w.cancel = false;
+
+    w.first  = gopOrigin + chunk * gopChunkFrames;
+    if (w.first >= gopNumFrames) {
+      w.state = GopWorker::IDLE;
+      return;
+    }
+    w.count  = std::min(gopChunkFrames, gopNumFrames - w.first);
+    w.fatal  = false;
+    w.errMsg = "";
+    w.state  = GopWorker::ASSIGNED;
+    pthread_cond_broadcast(&gopWork);
+  }
+
+  /** Opens a libmpeg3 handle per CPU and starts the GOP workers.  If 
+   *  anything goes wrong, we warn and fall back to decoding with pFile. */
+  void Libmpeg3IVideo::startGopWorkers()
+  {
+    TRACE;
+    gopOrigin        = -1;
+    gopWindowFirst   = 0;
+    gopNumFrames     = numFrames();
+    gopStopRequested = false;
+
+    gopWorkers.resize(nCPUs);
+    for (size_t i=0; i<gopWorkers.size(); i++) {
+      GopWorker &w = gopWorkers[i];
+      w.owner   = this;
+      w.file    = NULL;
+      w.running = false;
+      w.state   = GopWorker::IDLE;
+      w.cancel  = false;
+      w.first   = -1;
+      w.count   = 0;
+      w.fatal   = false;
+    }
+
+    for (size_t i=0; i<gopWorkers.size(); i++) {
+      GopWorker &w = gopWorkers[i];
+      w.frames.resize(gopChunkFrames * rawFrameBytes());
+
+      // open_copy shares pFile's table of contents instead of rereading it
+      int err = 0;
+      w.file = mpeg3_open_copy((char *)fname.c_str(), pFile, &err);
+      if (w.file == NULL || err != 0) {
+        if (w.file != NULL) mpeg3_close(w.file);
+        w.file = NULL;
+        PRINTWARN("Could not open another handle on " << fname << 
+                  ".  GOP-parallel decoding is disabled.");
+        stopGopWorkers();
+        return;
+      }
+      mpeg3_set_cpus(w.file, 1);
+
+      if (pthread_create(&w.thread, NULL, gopThreadMain, &w) != 0) {
+        PRINTWARN("Could not start a GOP decoding thread.  GOP-parallel "
+                  "decoding is disabled.");
+        stopGopWorkers();
+        return;
+      }
+      w.running = true;
+    }
+  }
+
+  /** Stops and joins all GOP workers and closes their handles */
+  void Libmpeg3IVideo::stopGopWorkers()
+  {
+    TRACE;
+    if (gopWorkers.empty()) return;
+
+    pthread_mutex_lock(&gopMutex);
+    gopStopRequested = true;
+    for (size_t i=0; i<gopWorkers.size(); i++) gopWorkers[i].cancel = true;
+    pthread_cond_broadcast(&gopWork);
+    pthread_mutex_unlock(&gopMutex);
+
+    for (size_t i=0; i<gopWorkers.size(); i++) {
+      GopWorker &w = gopWorkers[i];
+      if (w.running) pthread_join(w.thread, NULL);
+      if (w.file != NULL) mpeg3_close(w.file);
+    }
+    gopWorkers.clear();
+    gopOrigin = -1;
+  }
+
+  void *Libmpeg3IVideo::gopThreadMain(void *worker)
+  {
+    GopWorker *w = (GopWorker*)worker;
+    w->owner->gopLoop(*w);
+    return NULL;
+  }
+
+  /** Body of a GOP worker thread.  It must never throw: errors are recorded
+   *  in the worker and rethrown by the main thread when it wants one of the
+   *  chunk's frames. */
+  void Libmpeg3IVideo::gopLoop(GopWorker &w)
+  {
+    pthread_mutex_lock(&gopMutex);
+    while (true) {
+      while (w.state != GopWorker::ASSIGNED && !gopStopRequested) {
+        pthread_cond_wait(&gopWork, &gopMutex);
+      }
+      if (gopStopRequested) break;
+
+      w.state         = GopWorker::BUSY;
+      int const first = w.first;
+      int const count = w.count;
+      pthread_mutex_unlock(&gopMutex);
+
+      bool        cancelled = false;
+      bool        fatal     = false;
+      std::string errMsg;
+      try {
+        mpeg3_set_frame(w.file, (long)first, videoStream);
+        VrRecoverableCheckMsg(mpeg3_get_frame(w.file, videoStream) == first,
+                              "Failed to seek to frame " << first << ".");
+        size_t const frameBytes = rawFrameBytes();
+        for (int i=0; i<count; i++) {
+          pthread_mutex_lock(&gopMutex);
+          cancelled = w.cancel;
+          pthread_mutex_unlock(&gopMutex);
+          if (cancelled) break;
+          decodeRaw(w.file, &w.frames[i * frameBytes], first + i);
+        }
+      } catch (VrRecoverableException const &e) {
+        errMsg = e.message;
+      } catch (VrFatalError const &e) {
+        fatal  = true;
+        errMsg = e.message;
+      } catch (...) {
+        fatal  = true;
+        errMsg = "Unexpected exception in a GOP decoding thread.";
+      }
+
+      pthread_mutex_lock(&gopMutex);
+      if (cancelled) {
+        w.state  = GopWorker::IDLE;
+      } else if (errMsg.empty()) {
+        w.state  = GopWorker::READY;
+      } else {
+        w.state  = GopWorker::FAILED;
+        w.fatal  = fatal;
+        w.errMsg = errMsg;
+      }
+      pthread_cond_broadcast(&gopDone);
+    }
+    pthread_mutex_unlock(&gopMutex);
+  }
+
   void Libmpeg3IVideo::open(KeyValueMap &kvm) 
   {
     TRACE;
@@ -163,8 +649,32 @@ namespace VideoIO
         fname = i->second; // no type conversion necessary
       } else if (strcasecmp("videoStream", i->first.c_str())==0) {
         videoStream = atoi(i->second.c_str());
+      } else if (strcasecmp("outputFormat", i->first.c_str())==0) {
+        grayOutput = (strcasecmp("gray", i->second.c_str())==0);
+        yuvOutput  = (strcasecmp("yuv",  i->second.c_str())==0);
+        VrRecoverableCheckMsg(grayOutput || yuvOutput || 
+                              strcasecmp("rgb", i->second.c_str())==0,
+          "outputFormat must be \"rgb\", \"gray\", or \"yuv\", "
+          "not \"" << i->second << "\".");
       } else if (strcasecmp("numCPUs", i->first.c_str())==0) {
         nCPUs = atoi(i->second.c_str());
+        VrRecoverableCheckMsg(nCPUs >= 1, "numCPUs must be at least 1.");
+      } else if (strcasecmp("gopParallel", i->first.c_str())==0) {
+        gopParallel = (atoi(i->second.c_str()) != 0);
+      } else if (strcasecmp("gopChunkFrames", i->first.c_str())==0) {
+        gopChunkFrames = atoi(i->second.c_str());
+        VrRecoverableCheckMsg(gopChunkFrames >= 1, 
+                              "gopChunkFrames must be at least 1.");
+      } else if (strcasecmp("frameCacheMB", i->first.c_str())==0) {
+        double const mb = atof(i->second.c_str());
+        VrRecoverableCheckMsg(mb >= 0, "frameCacheMB cannot be negative.");
+        frameCache.setMaxBytes((size_t)(mb * 1024 * 1024));
+      } else if (strcasecmp("tocCacheDir", i->first.c_str())==0) {
+        tocCacheDir = i->second;
+      } else if (strcasecmp("backgroundToc", i->first.c_str())==0) {
+        backgroundToc = (atoi(i->second.c_str()) != 0);
+      } else if (strcasecmp("pipelining", i->first.c_str())==0) {
+        // Handled by the popen2 mex client.  Direct plugins ignore it.
       } else {
         VrRecoverableThrow("Unrecognnized argument name: " << i->first);
       }
@@ -206,24 +716,63 @@ namespace VideoIO
           "correct, that the file is not corrupted, and that mpeg3toc or"
           "libmpeg3 can read the file.");
         
-        std::string tocfname = fname.substr(0,fname.size()-3) + "toc";
-        
-        // Check if a .toc file exists already exists and is valid
-        // If not, generate a .toc file in the same place
-        if(!mpeg3_check_sig((char *)tocfname.c_str())) {
-        
-          VERBOSE("Generating " << tocfname << " for fast indexing");
-          VrRecoverableCheckMsg(generateTOCFile(fname,tocfname),
-            "Failed to generate .toc file");
+        // Look for a valid .toc next to the .mpg, then in the cache.  If 
+        // there is none, build one in the cache, or next to the .mpg if 
+        // no cache directory was given and we may write there.
+        std::string const siblingToc = fname.substr(0,fname.size()-3) + "toc";
+        std::string const cacheDir = 
+          tocCacheDir.empty() ? defaultCacheDir("toc") : tocCacheDir;
+        std::string const cachedToc = cachedFilename(cacheDir, fname, ".toc");
+        std::string tocfname;
+        if (mpeg3_check_sig((char *)siblingToc.c_str())) {
+          tocfname = siblingToc;
+        } else if (cacheDirIsPrivate(cacheDir) && 
+                   mpeg3_check_sig((char *)cachedToc.c_str())) {
+          // Only we can have put it there
+          tocfname = cachedToc;
+        }
         
-          VERBOSE("Opening and using generated .toc file");  
-         
-        } else {
+        if (!tocfname.empty()) {
           VERBOSE("Using existing " << tocfname << " instead of .mpg");
+          fname = tocfname;
+        } else {
+          string::size_type const slash = fname.find_last_of('/');
+          std::string const dir = 
+            (slash == string::npos) ? "." : fname.substr(0, slash + 1);
+          if (tocCacheDir.empty() && access(dir.c_str(), W_OK) == 0) {
+            tocfname = siblingToc;
+          } else {
+            VrRecoverableCheckMsg(makePrivateCacheDir(cacheDir), 
+              "Could not create the .toc cache directory " << cacheDir << 
+              ", or it is not a directory that only we can write to.");
+            tocfname = cachedToc;
+          }
+
+          if (backgroundToc) {
+            // Start reading the .mpg right away while the .toc is built.
+            VERBOSE("Generating " << tocfname << " in the background");
+            tocSrcFname      = fname;
+            tocFname         = tocfname;
+            tocStopRequested = false;
+            tocDone          = false;
+            tocOk            = false;
+            if (pthread_create(&tocThread, NULL, tocThreadMain, this) == 0) {
+              tocRunning = true;
+              tocState   = TOC_BUILDING;
+            } else {
+              PRINTWARN("Could not start the .toc thread.  Building " << 
+                        tocfname << " before opening the video.");
+            }
+          }
+          if (tocState != TOC_BUILDING) {
+            VERBOSE("Generating " << tocfname << " for fast indexing");
+            VrRecoverableCheckMsg(buildToc(fname,tocfname),
+              "Failed to generate .toc file");
+            VERBOSE("Opening and using generated .toc file");  
+            fname = tocfname;
+          }
         }
         
-        fname = tocfname;
-        
       } else if(ext.compare("toc")==0) {
         // Nothing to do, move along
       } else {
@@ -233,20 +782,8 @@ namespace VideoIO
       
       // Open video file
       VERBOSE("Opening video file (" << fname.c_str() << ") for reading...");
-    
-      int err;    
-
-      VrRecoverableCheckMsg(
-        mpeg3_check_sig((char *)fname.c_str()),
-        "Could not open \"" << fname << "\".  Make sure the filename is "
-        "correct, that the file is not corrupted, and that mpeg3toc or"
-        "libmpeg3 can read the file.");
-    
-        
-      pFile = mpeg3_open((char *)fname.c_str(),&err);
-    
-      VrRecoverableCheckMsg(pFile != NULL && err==0, 
-        "Libmpeg3 could not open " << fname);
+      pFile = openHandle(fname);
+      fileFrameNumber = -1;
 
       int numStreams = mpeg3_total_vstreams(pFile);
     
@@ -261,12 +798,42 @@ namespace VideoIO
       
       PRINTINFO("Video is " << frameWidth << " x " << frameHeight);
       
-      // Create RGB Image buffer (extra 12 bytes for processing)
-      rgbData.resize(frameWidth*frameHeight*3+12);
-      rgbRowPtrs.resize(frameHeight);
-      for(int k=0;k<frameHeight;k++){rgbRowPtrs[k] = &rgbData[k*frameWidth*3];}
+      // Whenever possible, grab the decoder's planar YUV output and convert
+      // it ourselves: it avoids libmpeg3's RGB conversion and a second
+      // pass over the image.  Odd-sized frames take the RGB route unless we
+      // only need the luma plane.  libmpeg3 writes w/2 chroma samples per
+      // row, so odd sizes can't give us the raw YUV planes.
+      const int colormodel = mpeg3_colormodel(pFile,videoStream);
+      const bool planar = 
+        (colormodel == MPEG3_YUV420P || colormodel == MPEG3_YUV422P);
+      VrRecoverableCheckMsg(planar || !(grayOutput || yuvOutput),
+        "Grayscale and YUV output require a planar YUV stream.");
+      VrRecoverableCheckMsg(
+        !yuvOutput || (frameWidth % 2 == 0 && frameHeight % 2 == 0),
+        "YUV output requires even frame dimensions, but the video is " <<
+        frameWidth << " x " << frameHeight << ".");
+      yuvData.clear();
+      rgbData.clear();
+      rgbRowPtrs.clear();
+      if (planar && 
+          (grayOutput || (frameWidth % 2 == 0 && frameHeight % 2 == 0))) {
+        subsampling = (colormodel == MPEG3_YUV420P) ? YUV_420 : YUV_422;
+        const int chromaRows = 
+          (subsampling == YUV_420) ? (frameHeight+1)/2 : frameHeight;
+        yuvData.resize(frameWidth*frameHeight + 
+                       2*((frameWidth+1)/2)*chromaRows);
+      } else {
+        // Create RGB Image buffer (extra 12 bytes for processing)
+        rgbData.resize(frameWidth*frameHeight*3+12);
+        rgbRowPtrs.resize(frameHeight);
+        for(int k=0;k<frameHeight;k++){rgbRowPtrs[k] = &rgbData[k*frameWidth*3];}
+      }
       
-      currentFrame.resize(frameWidth*frameHeight*3);
+      currentFrame.resize(frameWidth*frameHeight*depth());
+
+      if (gopParallel && nCPUs > 1 && tocState == TOC_READY) {
+        startGopWorkers();
+      }
      
       
       PRINTINFO("done.");
@@ -276,9 +843,36 @@ namespace VideoIO
     }
   }
 
+  IVideo::ExtraParamsAndStats Libmpeg3IVideo::extraParamsAndStats() const
+  {
+    ExtraParamsAndStats params;
+    params["outputFormat"]   = 
+      grayOutput ? "gray" : (yuvOutput ? "yuv" : "rgb");
+    params["numCPUs"]        = toString(nCPUs);
+    params["gopParallel"]    = toString((int)gopParallel);
+    params["gopChunkFrames"] = toString(gopChunkFrames);
+    params["backgroundToc"]  = toString((int)backgroundToc);
+    params["tocCacheDir"]    = 
+      tocCacheDir.empty() ? defaultCacheDir("toc") : tocCacheDir;
+    params["tocReady"]       = toString((int)(tocState == TOC_READY));
+    // numFrames comes from the table of contents, or is -1 without one
+    params["exactNumFrames"] = toString((int)(tocState == TOC_READY));
+    params["frameCacheMB"]   = 
+      toString(frameCache.getMaxBytes() / (1024.0 * 1024.0));
+    params["frameCacheFrames"]    = toString(frameCache.numFrames());
+    params["frameCacheHits"]      = toString(frameCache.numHits());
+    params["frameCacheMisses"]    = toString(frameCache.numMisses());
+    params["frameCacheEvictions"] = toString(frameCache.numEvictions());
+    return params;
+  }
+
   void Libmpeg3IVideo::close() 
   {
     TRACE;
+    stopGopWorkers();
+    stopTocBuild();
+    tocState = TOC_READY;
+    frameCache.clear();
     if(pFile != NULL){
       mpeg3_close(pFile);
       pFile = NULL;
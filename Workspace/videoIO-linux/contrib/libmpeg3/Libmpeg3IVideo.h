@@ -8,6 +8,8 @@ Insert copyright stuff etc...
 
 #include "debug.h"
 #include "IVideo.h"
+#include "ColorConversion.h"
+#include "FrameCache.h"
 #include "libmpeg3.h"
 
 // Normal includes
@@ -18,6 +20,7 @@ Insert copyright stuff etc...
 #include <math.h>
 #include <limits>
 #include <memory>
+#include <pthread.h>
 
 namespace VideoIO 
 {
@@ -41,7 +44,7 @@ namespace VideoIO
   public:
     // Constructors/Destructors
     Libmpeg3IVideo();
-    virtual ~Libmpeg3IVideo() { TRACE; close(); };
+    virtual ~Libmpeg3IVideo();
 
     // I/O Operations
     virtual void         open(KeyValueMap &kvm);
@@ -56,23 +59,63 @@ namespace VideoIO
     virtual std::string filename()             const { AO; return fname; }  
     virtual int         width()                const { AO; return frameWidth; }
     virtual int         height()               const { AO; return frameHeight; }
-    virtual int         depth()                const { AO; return 3; } 
+    virtual int         depth()                const { AO; return grayOutput ? 1 : 3; } 
     virtual double      fps()                  const { AO; return mpeg3_frame_rate(pFile,videoStream);}
-    virtual int         numFrames()            const { AO; return mpeg3_video_frames(pFile,videoStream);}
+    virtual int         numFrames()            const { AO; return (tocState == TOC_READY) ? mpeg3_video_frames(pFile,videoStream) : -1;}
     virtual FourCC      fourcc()               const { AO; stringToFourCC("tocf"); }
     virtual int         numHiddenFinalFrames() const { AO; return nHiddenFinalFrames; }
 
-    virtual ExtraParamsAndStats extraParamsAndStats() const {
-      // TODO: it might be interesting to extract a lot of extra metadata 
-      // from the pFormatCtx, pCodecCtx, etc.
-      return ExtraParamsAndStats();
-    }
+    virtual ExtraParamsAndStats extraParamsAndStats() const;
 
   private:
     void        open(std::string const &fname);
     inline bool isOpen() const { return (pFile != NULL); }    
     bool getNextFrame();
     bool stepLowLevel(int numFrames);
+    bool seekLowLevel(int toFrame);
+
+    // Decoding helpers shared by the main handle and the GOP workers
+    size_t rawFrameBytes() const;
+    void   decodeRaw(mpeg3_t *file, unsigned char *raw, int frameNum) const;
+    void   rawToMatlab(unsigned char const *raw);
+
+    /** One GOP-parallel decoding thread.  Each worker has its own libmpeg3
+     *  handle and decodes whole chunks of consecutive frames into its own
+     *  buffer.  All fields except file, thread, and frames are guarded by
+     *  gopMutex.  frames belongs to the worker while it is BUSY and to the
+     *  main thread while it is READY. */
+    struct GopWorker {
+      enum State { IDLE, ASSIGNED, BUSY, READY, FAILED };
+      Libmpeg3IVideo             *owner;
+      mpeg3_t                    *file;
+      pthread_t                  thread;
+      bool                       running;
+      State                      state;
+      bool                       cancel;
+      int                        first;   // first frame of the chunk
+      int                        count;   // number of frames in the chunk
+      std::vector<unsigned char> frames;  // count raw frames, back-to-back
+      bool                       fatal;
+      std::string                errMsg;
+    };
+
+    // Reading without a .toc and building one in the background
+    mpeg3_t     *openHandle(std::string const &path);
+    bool         seekSequential(int toFrame);
+    bool         switchToToc(bool wait);
+    bool         buildToc(std::string const &src, std::string const &dst);
+    bool         tocStopWanted();
+    void         stopTocBuild();
+    static void *tocThreadMain(void *self);
+    void         tocLoop();
+
+    // GOP-parallel decoding
+    void         startGopWorkers();
+    void         stopGopWorkers();
+    bool         seekGopParallel(int toFrame);
+    void         assignGopChunk(int chunk);
+    static void *gopThreadMain(void *worker);
+    void         gopLoop(GopWorker &w);
 
     std::string                  fname;
     
@@ -81,17 +124,77 @@ namespace VideoIO
   
     mpeg3_t                      *pFile;
     int                          nCPUs;
+    /** Frame pFile last decoded (-1 right after opening).  With GOP-parallel
+     *  decoding this can differ from currentFrameNumber. */
+    int                          fileFrameNumber;
+
+    /** If true (and nCPUs > 1), sequential reads are served by nCPUs worker
+     *  threads that each decode a different chunk of gopChunkFrames frames
+     *  ahead of the current one. */
+    bool                         gopParallel;
+    int                          gopChunkFrames;
+    std::vector<GopWorker>       gopWorkers;
+    /** Frame number of the start of chunk 0, or -1 if no chunks have been 
+     *  scheduled.  Chunk c covers frames gopOrigin + c*gopChunkFrames on. */
+    int                          gopOrigin;
+    /** Oldest chunk still scheduled.  Chunk c is handled by worker c % 
+     *  gopWorkers.size(), so the window holds gopWorkers.size() chunks. */
+    int                          gopWindowFirst;
+    int                          gopNumFrames;
+    bool                         gopStopRequested;
+    pthread_mutex_t              gopMutex;
+    /** Signalled when a worker is given a chunk or asked to stop */
+    pthread_cond_t               gopWork;
+    /** Signalled when a worker finishes or abandons a chunk */
+    pthread_cond_t               gopDone;
+
+    /** Where .toc files are built when the .mpg's directory is not 
+     *  writable.  Empty means a per-user directory under $TMPDIR. */
+    std::string                  tocCacheDir;
+    /** If true, a missing .toc is built by a background thread while the
+     *  .mpg is read sequentially. */
+    bool                         backgroundToc;
+    /** TOC_READY: pFile reads through a .toc and can seek anywhere.  
+     *  TOC_BUILDING: pFile reads the .mpg while tocThread builds tocFname.
+     *  TOC_FAILED: the build failed and we keep reading the .mpg. */
+    enum TocState { TOC_READY, TOC_BUILDING, TOC_FAILED };
+    TocState                     tocState;
+    std::string                  tocSrcFname;
+    std::string                  tocFname;
+    bool                         tocRunning;
+    pthread_t                    tocThread;
+    /** Guards tocStopRequested, tocDone, and tocOk */
+    pthread_mutex_t              tocMutex;
+    /** Signalled when the background build finishes */
+    pthread_cond_t               tocFinished;
+    bool                         tocStopRequested;
+    bool                         tocDone;
+    bool                         tocOk;
   
     int                          frameWidth;
     int                          frameHeight;
   
-    // Some buffers for decoding the frame
+    // Some buffers for decoding the frame.  yuvData holds the Y, U, and V
+    // planes back-to-back and is only used when the stream is planar YUV
+    // with even dimensions; otherwise we use the RGB buffers.
+    std::vector<unsigned char>   yuvData;
+    YuvSubsampling               subsampling;
     std::vector<unsigned char>   rgbData;
     std::vector<unsigned char *> rgbRowPtrs;
+
+    // If true, frames are the decoder's luma plane instead of RGB images
+    bool                         grayOutput;
+    // If true, frames hold the decoder's Y, U, and V planes (with the 
+    // chroma upsampled to full size) instead of RGB images
+    bool                         yuvOutput;
     
     // Frame to be return in matlab format
     Frame                        currentFrame;       
 
+    /** Recently returned frames, so stepping back and forth over them (as
+     *  the videoPlayer does) does not decode them again */
+    FrameCache                   frameCache;
+
     int                          nHiddenFinalFrames; 
 
   };
@@ -11,6 +11,9 @@
 %
 % - vp.open(vararing) 
 % opens a video by calling videoReader(vararing{:})
+% For the ffmpeg and libmpeg3 plugins, a 64 MB 'frameCacheMB' is added
+% unless vararing already sets one, so scrubbing back and forth with the
+% slider hits the cache instead of re-decoding from the previous I-frame.
 %
 % - vp.close() 
 % closes the video
@@ -261,6 +264,24 @@ function vp = videoPlayer(varargin)
     end
   end
 
+  function args = frameCacheArgs(readerArgs)
+    % Seeking backwards is by far the most expensive thing the slider
+    % does, so give the plugins that keep a frame cache a small one.
+    % READERARGS are the videoReader arguments after the url.
+    args = {};
+    plugin = pvtVideoIO_parsePlugin(readerArgs, ...
+      defaultVideoIOPlugin('videoReader'));
+    if ~strncmpi(plugin, 'ffmpeg', 6) && ~strncmpi(plugin, 'libmpeg3', 8)
+      return;
+    end
+    for ii=1+mod(length(readerArgs),2):2:length(readerArgs)
+      if strcmpi(readerArgs{ii}, 'frameCacheMB')
+        return;
+      end
+    end
+    args = {'frameCacheMB', 64};
+  end
+
   function openVideo(varargin)
     
     if nargin < 1 || ~ischar(varargin{1})
@@ -279,14 +300,17 @@ function vp = videoPlayer(varargin)
       
        switch lower(ext)
          case '.toc'
-           vr = videoReader(fname,'libmpeg3Direct');
+           cacheArgs = frameCacheArgs({'libmpeg3Direct'});
+           vr = videoReader(fname,'libmpeg3Direct',cacheArgs{:});
          otherwise
-           vr = videoReader(fname);
+           cacheArgs = frameCacheArgs({});
+           vr = videoReader(fname,cacheArgs{:});
        end
        
     else
       
-      vr = videoReader(varargin{:});
+      cacheArgs = frameCacheArgs(varargin(2:end));
+      vr = videoReader(varargin{:}, cacheArgs{:});
     
     end
     
@@ -0,0 +1,242 @@
+#ifndef LOCALSOCKET_H
+#define LOCALSOCKET_H
+
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "debug.h"
+
+namespace VideoIO 
+{
+
+  /** Helpers for talking to a popen2 server that runs as a daemon (see 
+   *  the --daemon option in mexServerStdio.cpp).  The daemon listens on a
+   *  Unix domain socket and each client gets its own connection.  Clients
+   *  hand the daemon their shared memory ring and their videos, so both 
+   *  sides only talk to processes of the same user: the socket must live 
+   *  in a directory that only we can write to, and each side checks the 
+   *  other's uid (see localSocketPeerIsUs) before anything is exchanged. */
+
+  /** True iff the directory holding path is a real directory (not a 
+   *  symlink) that is owned by us and that nobody else can get into. */
+  inline bool localSocketDirIsPrivate(std::string const &path)
+  {
+    std::string::size_type const slash = path.rfind('/');
+    std::string const dir = 
+      (slash == std::string::npos) ? std::string(".") : 
+      (slash == 0)                 ? std::string("/") : path.substr(0, slash);
+    struct stat st;
+    return lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) &&
+      st.st_uid == getuid() && (st.st_mode & 077) == 0;
+  }
+
+  /** True iff the process at the other end of the connected socket sock
+   *  runs as our user */
+  inline bool localSocketPeerIsUs(int sock)
+  {
+    ucred     cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+      len == sizeof(cred) && cred.uid == getuid();
+  }
+
+  /** Fills addr for path.  Returns false if path is too long. */
+  inline bool localSocketAddress(std::string const &path, sockaddr_un &addr)
+  {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+    return true;
+  }
+
+  /** Connects to whatever listens at path.  Returns the connected 
+   *  socket, or -1 (with errno set) if nothing does.  Clients should use 
+   *  connectDaemonSocket instead. */
+  inline int connectLocalSocket(std::string const &path)
+  {
+    sockaddr_un addr;
+    if (!localSocketAddress(path, addr)) return -1;
+    int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+      int const err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    return fd;
+  }
+
+  /** Connects to the daemon listening at path.  Returns the connected 
+   *  socket, or -1 if there is no daemon or if the socket's directory or
+   *  the daemon itself does not belong to us. */
+  inline int connectDaemonSocket(std::string const &path)
+  {
+    if (!localSocketDirIsPrivate(path)) {
+      errno = EPERM;
+      return -1;
+    }
+    int const fd = connectLocalSocket(path);
+    if (fd < 0) return -1;
+    if (!localSocketPeerIsUs(fd)) {
+      close(fd);
+      errno = EPERM;
+      return -1;
+    }
+    return fd;
+  }
+
+  /** Creates the listening socket at path, replacing any stale socket 
+   *  file left by a daemon that died.  If a daemon still answers at path,
+   *  or path is something we can't connect to for another reason, it is 
+   *  left alone.  path's directory must be private (see 
+   *  localSocketDirIsPrivate) and the socket itself is only accessible to
+   *  us.  Returns -1 (with errno set) on failure. */
+  inline int listenLocalSocket(std::string const &path)
+  {
+    sockaddr_un addr;
+    if (!localSocketAddress(path, addr)) return -1;
+    if (!localSocketDirIsPrivate(path)) {
+      errno = EPERM;
+      return -1;
+    }
+    int const other = connectLocalSocket(path);
+    if (other >= 0) {
+      close(other);
+      errno = EADDRINUSE;
+      return -1;
+    }
+    if (errno == ECONNREFUSED) {
+      // Nobody is listening.  Only remove it if it really is a socket.
+      struct stat st;
+      if (lstat(path.c_str(), &st) == 0 && !S_ISSOCK(st.st_mode)) {
+        errno = EEXIST;
+        return -1;
+      }
+      unlink(path.c_str());
+    } else if (errno != ENOENT) {
+      return -1;
+    }
+    int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    mode_t const oldMask = umask(077);
+    int const bound = bind(fd, (sockaddr*)&addr, sizeof(addr));
+    umask(oldMask);
+    if (bound != 0 || chmod(path.c_str(), 0600) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+      int const err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    return fd;
+  }
+
+  /** The first thing a client sends is a single byte, optionally carrying
+   *  the file descriptor of its shared memory ring (see shmring.h).  Pass 
+   *  fd = -1 for no ring.  Returns false on failure. */
+  inline bool sendRingFd(int sock, int fd)
+  {
+    char    byte = 0;
+    iovec   iov;
+    iov.iov_base = &byte;
+    iov.iov_len  = 1;
+
+    msghdr  msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = &iov;
+    msg.msg_iovlen = 1;
+
+    char    ctrl[CMSG_SPACE(sizeof(int))];
+    if (fd >= 0) {
+      memset(ctrl, 0, sizeof(ctrl));
+      msg.msg_control    = ctrl;
+      msg.msg_controllen = sizeof(ctrl);
+      cmsghdr *c = CMSG_FIRSTHDR(&msg);
+      c->cmsg_level = SOL_SOCKET;
+      c->cmsg_type  = SCM_RIGHTS;
+      c->cmsg_len   = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+
+    ssize_t rc;
+    do { rc = sendmsg(sock, &msg, 0); } while (rc < 0 && errno == EINTR);
+    return rc == 1;
+  }
+
+  /** Daemon side of sendRingFd.  Sets fd to the received descriptor or to
+   *  -1 if the client has no ring.  Returns false if the client hung up. */
+  inline bool recvRingFd(int sock, int &fd)
+  {
+    fd = -1;
+    char    byte;
+    iovec   iov;
+    iov.iov_base = &byte;
+    iov.iov_len  = 1;
+
+    char    ctrl[CMSG_SPACE(sizeof(int))];
+    msghdr  msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    ssize_t rc;
+    do { rc = recvmsg(sock, &msg, 0); } while (rc < 0 && errno == EINTR);
+    if (rc != 1) return false;
+
+    for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; 
+         c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+      }
+    }
+    return true;
+  }
+
+}; /* namespace VideoIO */
+
+#endif
@@ -170,14 +170,32 @@ namespace VideoIO {
   // linking to any matlab libraries when marshalling matlab-style data around.
   class MatArray {
   public:
+    /// How a MatArray built from existing data treats that data.
+    /// COPY_DATA makes a private copy.  VIEW_DATA refers to the data in 
+    /// place: the view is only valid while the data is, and it must be
+    /// treated as read-only unless the owner says otherwise.  ADOPT_DATA
+    /// takes ownership of a buffer allocated the way allocData does 
+    /// (mxMalloc in mex files, malloc elsewhere) and frees it later.
+    enum DataOwnership { COPY_DATA, VIEW_DATA, ADOPT_DATA };
+
     inline MatArray(MatArray const *other);
     inline MatArray(uint8 mx, int nrows, int ncols);
     inline MatArray(uint8 mx, std::vector<int> const &dims);
+    /// Numeric arrays only.  
+    inline MatArray(uint8 mx, std::vector<int> const &dims, void *data,
+                    DataOwnership ownership);
     inline virtual ~MatArray() { freeData(); }
 
 #ifdef MATLAB_MEX_FILE
-    inline MatArray(mxArray const *mat);
+    /// ADOPT_DATA is not allowed: Matlab owns mat.  For cell arrays, 
+    /// VIEW_DATA makes every element a view.
+    inline MatArray(mxArray const *mat, DataOwnership ownership = COPY_DATA);
+    /// Hands our data to a new mxArray.  Owned buffers are given to Matlab
+    /// as they are (no copy); views are copied.
     inline void transferToMat(mxArray *&mat);
+    /// Keeps Matlab from freeing our data when the mex function returns.
+    /// The data is still released by our destructor.
+    inline void makePersistent();
 #endif    
 
     inline uint8                   mx()     const { return _mx; }
@@ -185,6 +203,12 @@ namespace VideoIO {
     inline size_t                  numElm() const;
     inline void const             *data()   const { return _data; }
     inline void                   *data()         { return _data; }
+    /// False for views
+    inline bool                    ownsData() const { return _ownsData; }
+    /// Numeric arrays only.  Reduces the last dimension to n, keeping the
+    /// leading elements where they are.  Owned buffers are shrunk with 
+    /// realloc, which normally does not move them.
+    inline void                    shrinkLastDim(int n);
 
   private:
     inline void allocData();
@@ -193,6 +217,9 @@ namespace VideoIO {
     uint8             _mx;
     std::vector<int>  _dims;
     void             *_data;
+    /// Whether freeData releases _data.  Cell arrays always own their
+    /// array of element pointers.
+    bool              _ownsData;
   };
   /////////////////////////////////////////////////////////////////////////////
 
@@ -264,7 +291,7 @@ namespace VideoIO {
   //------ MatArray implementation -------------------------------------------
 
   MatArray::MatArray(MatArray const *other) :
-    _mx(other->_mx), _dims(other->_dims), _data(NULL)
+    _mx(other->_mx), _dims(other->_dims), _data(NULL), _ownsData(true)
   { 
     TRACE;
     allocData();
@@ -281,21 +308,37 @@ namespace VideoIO {
   }
 
   MatArray::MatArray(uint8 mx, int nrows, int ncols) :
-    _mx(mx), _data(NULL)
+    _mx(mx), _data(NULL), _ownsData(true)
   { TRACE; _dims.resize(2); _dims[0] = nrows; _dims[1] = ncols; allocData(); }
 
   MatArray::MatArray(uint8 mx, std::vector<int> const &dims) :
-    _mx(mx), _dims(dims), _data(NULL)
+    _mx(mx), _dims(dims), _data(NULL), _ownsData(true)
   { TRACE; allocData(); }
 
+  MatArray::MatArray(uint8 mx, std::vector<int> const &dims, void *data,
+                     DataOwnership ownership) :
+    _mx(mx), _dims(dims), _data(NULL), _ownsData(true)
+  {
+    TRACE;
+    VrRecoverableCheck(mx != MatDataTypeConstants::mxCELL_CLASS);
+    if (ownership == COPY_DATA) {
+      allocData();
+      if (_data) memcpy(_data, data, numElm()*MatDataTypeConstants::elmSize(mx));
+    } else {
+      _data     = data;
+      _ownsData = (ownership == ADOPT_DATA);
+    }
+  }
+
 #ifdef MATLAB_MEX_FILE
-  // Creates an alias to a Matlab matrix
-  MatArray::MatArray(mxArray const *mat) :
-    _mx(mxGetClassID(mat)), _dims(), _data(NULL)
+  // Copies or creates a view of a Matlab matrix
+  MatArray::MatArray(mxArray const *mat, DataOwnership ownership) :
+    _mx(mxGetClassID(mat)), _dims(), _data(NULL), _ownsData(true)
   {
     TRACE;
     VrRecoverableCheck(!mxIsComplex(mat) && !mxIsSparse(mat));
     VrRecoverableCheck(mxIsNumeric(mat) || mxIsChar(mat) || mxIsCell(mat));
+    VrRecoverableCheck(ownership != ADOPT_DATA);
 
     _dims.resize(mxGetNumberOfDimensions(mat));
     int const *matDims = mxGetDimensions(mat);
@@ -303,14 +346,20 @@ namespace VideoIO {
       _dims[i] = matDims[i];
     }
 
-    allocData();
-
     const size_t nElm = mxGetNumberOfElements(mat);
     VrRecoverableCheck(nElm == numElm());
+    if (ownership == VIEW_DATA && !mxIsCell(mat)) {
+      _data     = mxGetData(mat);
+      _ownsData = false;
+      return;
+    }
+
+    allocData();
     if (mxIsCell(mat)) {
       VrRecoverableCheck(nElm < std::numeric_limits<int>::max());
       for (size_t i=0; i<nElm; i++) {
-        ((MatArray**)_data)[i] = new MatArray(mxGetCell(mat, (int)i));
+        ((MatArray**)_data)[i] = 
+          new MatArray(mxGetCell(mat, (int)i), ownership);
       }
     } else {
       size_t sz = nElm * MatDataTypeConstants::elmSize(mx());
@@ -337,16 +386,35 @@ namespace VideoIO {
         mxSetCell(mat, (int)i, tmp);
       }
     } else {
+      if (!_ownsData && _data != NULL) {
+        // Someone else owns a view's data, so Matlab gets a copy.
+        void const *src = _data;
+        _data     = NULL;
+        _ownsData = true;
+        allocData();
+        memcpy(_data, src, numElm() * MatDataTypeConstants::elmSize(mx()));
+      }
       // Avoid the calloc penalty 
       // (see http://ioalinux1.epfl.ch/~mleutene/MATLABToolbox/CmexWrapper.html)
       mat = mxCreateNumericArray(0, 0, (mxClassID)_mx, mxREAL);
       VrRecoverableCheck(_dims.size() < std::numeric_limits<int>::max());
       VrRecoverableCheck(mxSetDimensions(mat, &_dims[0], (int)_dims.size()) == 0);
-      mxSetPr(mat, (double*)_data);
+      mxSetData(mat, _data);
       _data = NULL;
     }
     freeData(); 
   }
+
+  void MatArray::makePersistent() {
+    TRACE;
+    if (_data == NULL || !_ownsData) return;
+    mexMakeMemoryPersistent(_data);
+    if (mx() == MatDataTypeConstants::mxCELL_CLASS) {
+      for (size_t i=0; i<numElm(); i++) {
+        ((MatArray**)_data)[i]->makePersistent();
+      }
+    }
+  }
 #endif
 
   void MatArray::allocData() {
@@ -369,7 +437,10 @@ namespace VideoIO {
 
   void MatArray::freeData() {
     TRACE;
-    if (_data) {
+    if (_data && !_ownsData) {
+      _data     = NULL;
+      _ownsData = true;
+    } else if (_data) {
       if (mx() == MatDataTypeConstants::mxCELL_CLASS) {
         MatArray **a = (MatArray**)_data;
         for (size_t i=0; i<numElm(); i++) {
@@ -386,6 +457,29 @@ namespace VideoIO {
     _dims.resize(0);
   }
 
+  void MatArray::shrinkLastDim(int n) {
+    TRACE;
+    VrRecoverableCheck(mx() != MatDataTypeConstants::mxCELL_CLASS);
+    VrRecoverableCheck(!_dims.empty() && 0 <= n && n <= _dims.back());
+    if (n == _dims.back()) return;
+    _dims.back() = n;
+    if (!_ownsData || _data == NULL) return;
+
+    const size_t sz = numElm() * MatDataTypeConstants::elmSize(mx());
+    if (sz == 0) {
+      std::vector<int> dimsBackup(_dims);
+      freeData();
+      _dims = dimsBackup;
+      return;
+    }
+#ifdef MATLAB_MEX_FILE
+    void *shrunk = mxRealloc(_data, sz);
+#else
+    void *shrunk = realloc(_data, sz);
+#endif
+    if (shrunk != NULL) _data = shrunk; // else keep the larger buffer
+  }
+
   size_t MatArray::numElm() const {
     size_t n = 1;
     for (size_t i=0; i<_dims.size(); i++) {
@@ -99,10 +99,14 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
   try {
     initializeIfNeeded();
 
-    // Transfer input data to MatArrays
+    // Wrap the input data in MatArrays.  Handlers run synchronously, so
+    // views are safe and save copying each frame passed to addframe.  
+    // The one handler that writes to an input is getframeinto, which 
+    // videoReader/getframeinto only calls when the caller asked for 
+    // 'inplace' and promised the buffer isn't shared.
     MatArrayVector rhs;
     for (int i=0; i<nrhs; i++) {
-      rhs.push_back(new MatArray(prhs[i]));
+      rhs.push_back(new MatArray(prhs[i], MatArray::VIEW_DATA));
     }
 
     // Call linked pseudo-mexFunction
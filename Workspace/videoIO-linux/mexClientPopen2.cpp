@@ -41,12 +41,28 @@ SOFTWARE.
 #include <sys/wait.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <sstream>
+#include <map>
 #include "debug.h"
 #include "popen2.h"
 #include "matarray.h"
 #include "pipecomm.h"
+#include "shmring.h"
+#include "localsocket.h"
 #include "MatlabHelpers.h"
 
+/** Frames are returned through a shared memory ring of this many bytes 
+ *  instead of the pipe (see shmring.h).  Define VIDEOIO_NO_SHM_TRANSPORT 
+ *  to send everything through the pipe.  The pipe echo log only sees 
+ *  what goes through the pipe, so we also skip the ring when logging. */
+#ifndef VIDEOIO_SHM_RING_BYTES
+#  define VIDEOIO_SHM_RING_BYTES (64*1024*1024)
+#endif
+#if defined(ECHO_PIPE_COMMUNICATION) && !defined(VIDEOIO_NO_SHM_TRANSPORT)
+#  define VIDEOIO_NO_SHM_TRANSPORT
+#endif
+
 using namespace std;
 using namespace VideoIO;
 
@@ -57,6 +73,37 @@ static bool  initialized = false;
 static FILE  *toServer   = NULL;
 static FILE  *fromServer = NULL;
 static pid_t childPid    = -1;
+static ShmRing  shmRingStorage;
+static ShmRing *shmRing  = NULL; // non-NULL iff the server was given the ring
+
+/** Pipelining state (see the 'pipelining' open argument and speculate). */
+struct Speculation {
+  int  nextMsgId;
+  int  frameMsgId;
+  bool nextAnswered; // the server's answer to its "next" has been read
+  bool nextRead;     // its "next" was given to Matlab
+  bool nextWorked;
+};
+/** A "next" past the last frame closes the video on the server, so we 
+ *  only speculate when we know there is another frame to read. */
+struct PipelinedVideo {
+  PipelinedVideo() : numFrames(-1), frameNum(-1), frameNumKnown(false) {}
+  double numFrames;     // negative unless the plugin knows it exactly
+  double frameNum;
+  bool   frameNumKnown;
+};
+static map<Handle, PipelinedVideo> pipelinedVideos;
+static map<Handle, Speculation>    speculations; // pairs in flight, per handle
+/** The last regular "next" request, so we know when to start pipelining */
+static Handle      lastNextHandle = 0;
+static bool        lastNextWorked = false;
+
+class PendingResponse;
+/** The server answers requests for different handles in whatever order
+ *  they finish.  Responses that arrive before Matlab asks for them wait 
+ *  here, keyed by message id. */
+static map<int, PendingResponse*> stashedResponses;
+static void clearStashedResponses();
 
 /** As a MEX function, we launch a server process that implements the plugin.
  *  Find the server executable that's found in the same directory as this MEX 
@@ -66,6 +113,30 @@ string findServerProc() {
   return getMexPathname() + "Server";
 }
 
+/** If VIDEOIO_DAEMON_DIR is set and a daemon for our server (see the 
+ *  --daemon option in mexServerStdio.cpp) is listening on 
+ *  $VIDEOIO_DAEMON_DIR/<server name>.sock, we use it instead of starting
+ *  our own server.  The directory must be private to us and the daemon 
+ *  must run as our user (see connectDaemonSocket).  Returns the connected
+ *  socket or -1. */
+static int connectToDaemon(string const &serverProc)
+{
+  char const *dir = getenv("VIDEOIO_DAEMON_DIR");
+  if (dir == NULL || *dir == '\0') return -1;
+  string::size_type const slash = serverProc.rfind('/');
+  string const name = 
+    (slash == string::npos) ? serverProc : serverProc.substr(slash+1);
+  string const path = string(dir) + "/" + name + ".sock";
+  int const sock = connectDaemonSocket(path);
+  if (sock < 0) {
+    VERBOSE("No usable video server daemon at " << path << " (" << 
+            strerror(errno) << ").  Starting our own.");
+  } else {
+    VERBOSE("Connected to the video server daemon at " << path);
+  }
+  return sock;
+}
+
 /** When the mex function is interrupted by Ctrl-C or when it's about to be
  *  cleared, we want to force ourselves into a known state and kill off the 
  *  server.
@@ -97,6 +168,12 @@ void killServer() {
   }
   if (toServer)   { fclose(toServer);   toServer   = NULL; }
   if (fromServer) { fclose(fromServer); fromServer = NULL; }
+  clearStashedResponses(); // releases what they hold in the ring
+  shmRingStorage.detach();
+  shmRing     = NULL;
+  pipelinedVideos.clear();
+  speculations.clear();
+  lastNextWorked = false;
   initialized = false;
   VERBOSE("...killed " << findServerProc() << "\n");
 }
@@ -116,7 +193,41 @@ void initialize() {
   // seems rather unlikely since Matlab is single-threaded.  
   while (waitpid(0, NULL, WNOHANG) > 0);
     
-  string const serverProc = findServerProc();
+  string serverProc = findServerProc();
+
+  // The server inherits the ring's file descriptor and we tell it which
+  // one it is (a daemon receives it over the socket).  If we can't make a
+  // ring, everything goes through the pipe.
+  int shmFd = -1;
+#ifndef VIDEOIO_NO_SHM_TRANSPORT
+  if ((shmFd = shmRingStorage.create(VIDEOIO_SHM_RING_BYTES)) >= 0) {
+    shmRing = &shmRingStorage;
+  } else {
+    VERBOSE("Could not create a shared memory ring.  Using pipes only.");
+  }
+#endif
+
+  int const daemonSock = connectToDaemon(serverProc);
+  if (daemonSock >= 0) {
+    VrFatalIoCheckMsg(sendRingFd(daemonSock, shmFd),
+                      "Could not send our setup to the video server daemon.");
+    if (shmFd >= 0) close(shmFd);
+    int const outFd = dup(daemonSock);
+    VrFatalIoCheck(outFd >= 0);
+    mexAtExit(killServer);
+    VrFatalIoCheck(fromServer = fdopen(daemonSock, "r"));
+    VrFatalIoCheck(toServer   = fdopen(outFd,      "w"));
+    writeHandshake(toServer);
+    readHandshake(fromServer);
+    initialized = true;
+    return;
+  }
+
+  if (shmFd >= 0) {
+    std::stringstream cmd;
+    cmd << serverProc << " --shm-fd=" << shmFd;
+    serverProc = cmd.str();
+  }
   
   // Matlab likes to override the LD_LIBRARY_PATH environment variable.  
   // While this works well for their executable, it causes problems for
@@ -140,12 +251,17 @@ void initialize() {
   // Restore the LD_LIBRARY_PATH.
   VrFatalIoCheck(setenv("LD_LIBRARY_PATH", oldLdLibPath.c_str(), 1)==0);
 
+  // Our mapping of the ring stays valid after the descriptor is closed.
+  if (shmFd >= 0) close(shmFd);
+
   // Finish wiring ourselves up to the server process
   mexAtExit(killServer);
   VERBOSE("Started video server process with PID " << childPid 
           << " (infp=" << infp << ",outfp=" << outfp << ")\n");
   VrFatalIoCheck(fromServer = fdopen(outfp, "r"));
   VrFatalIoCheck(toServer   = fdopen(infp,  "w"));
+  writeHandshake(toServer);
+  readHandshake(fromServer);
   initialized = true;
 }
 
@@ -205,6 +321,354 @@ public:
   }
 };
 
+/** A server's response to one request */
+class PendingResponse {
+public:
+  PendingResponse() : type(Success), lhs(0), persistent(false) {}
+  ~PendingResponse() { clear(); }
+  void clear() { lhs.squeeze(); errMsg.clear(); }
+
+  /** Moves other's contents into this response */
+  void take(PendingResponse &other) {
+    clear();
+    type = other.type;
+    errMsg.swap(other.errMsg);
+    lhs.swap(other.lhs);
+  }
+
+  /** Lets the response survive until a later call to this mex function */
+  void makePersistent() {
+    for (size_t i=0; i<lhs.size(); i++) lhs[i]->makePersistent();
+    persistent = true;
+  }
+
+  /** Moves persistent data back into memory that Matlab may own.  Arrays
+   *  left in the shared memory ring are views and stay as they are. */
+  void makeTransient() {
+    if (!persistent) return;
+    for (size_t i=0; i<lhs.size(); i++) {
+      MatArray *old = lhs[i];
+      if (!old->ownsData()) continue;
+      lhs[i] = new MatArray(old);
+      delete old;
+    }
+    persistent = false;
+  }
+
+  ResponseType type;
+  string       errMsg; // for NonFatalError
+  MatArrayVec  lhs;    // for Success
+  bool         persistent;
+
+private:
+  PendingResponse(PendingResponse const &);
+  PendingResponse &operator=(PendingResponse const &);
+};
+
+static int sendRequest(int nlhs, MatArrayVec &rhs)
+{
+  TRACE;
+  const int reqMsgId = writeMessageHeader(toServer);
+  writeScalar<int>(nlhs, toServer);
+  writeScalar<int>((int)rhs.size(), toServer);
+  for (size_t i=0; i<rhs.size(); i++) {
+    writeMatArray(*rhs[i], toServer);
+  }
+  writeMessageFooter(toServer); // sends the array data, so squeeze after
+  rhs.squeeze();
+  VrFatalIoCheck(fflush(toServer) == 0);
+  return reqMsgId;
+}
+
+static void clearStashedResponses()
+{
+  map<int, PendingResponse*>::iterator i;
+  for (i = stashedResponses.begin(); i != stashedResponses.end(); i++) {
+    delete i->second;
+  }
+  stashedResponses.clear();
+}
+
+/** Reads the rest of a response whose header has already been read.  
+ *  Responses that are stashed for later pass leaveInRing, so that their
+ *  frames are only copied once, when they are delivered. */
+static void readResponseBody(PendingResponse &resp, bool leaveInRing = false)
+{
+  TRACE;
+  resp.clear();
+
+  resp.type = (ResponseType)readScalar<int>(fromServer);
+  VERBOSE("Response: " << resp.type);
+  switch (resp.type) {
+  case Success:
+    {
+      const int nlhsReturned = readScalar<int>(fromServer);
+      VERBOSE(nlhsReturned << " lhs args returned");
+      for (int i=0; i<nlhsReturned; i++) {
+        resp.lhs.push_back(
+          readMatArray(fromServer, shmRing, leaveInRing).release());
+      }
+    }
+    readMessageFooter(fromServer);
+    break;
+
+  case FatalError:
+    VrFatalThrow(readString(fromServer));
+    // No need to read the footer--this is panic mode
+    break;
+
+  case NonFatalError:
+    resp.errMsg = readString(fromServer);
+    // *must* read footer before erroring out!
+    readMessageFooter(fromServer);
+    break;
+
+  default:
+    VrFatalThrow("Unexpected response type from server: " << resp.type);
+    // No need to read the pipe's footer--this is panic mode
+  }
+}
+
+static void readResponse(int reqMsgId, PendingResponse &resp)
+{
+  TRACE;
+  map<int, PendingResponse*>::iterator s = stashedResponses.find(reqMsgId);
+  if (s != stashedResponses.end()) {
+    resp.take(*s->second);
+    resp.makeTransient();
+    delete s->second;
+    stashedResponses.erase(s);
+    return;
+  }
+
+  while (true) {
+    const int respMsgId = readMessageHeader(fromServer);
+    if (respMsgId == reqMsgId) {
+      readResponseBody(resp);
+      return;
+    }
+    // Only requests we have sent and not yet collected can be answered.
+    VrFatalCheckMsg(respMsgId >= 0 && 
+                    respMsgId < lastAutoMsgIdForIncludingModule &&
+                    stashedResponses.count(respMsgId) == 0,
+                    "Received response for message #" << respMsgId << 
+                    ", but expected a response for #" << reqMsgId);
+    auto_ptr<PendingResponse> early(new PendingResponse());
+    readResponseBody(*early, true);
+    early->makePersistent();
+    stashedResponses[respMsgId] = early.release();
+  }
+}
+
+/** True iff resp is a successful response holding a single non-zero 
+ *  scalar, i.e. what "next" and "step" return when they worked. */
+static bool responseIsTrue(PendingResponse const &resp)
+{
+  return resp.type == Success && resp.lhs.size() == 1 &&
+    resp.lhs[0]->mx() == MatDataTypeConstants::mxDOUBLE_CLASS &&
+    resp.lhs[0]->numElm() == 1 && *(double const*)resp.lhs[0]->data() != 0;
+}
+
+static void deliverResponse(PendingResponse &resp, int nlhs, mxArray *plhs[],
+                            CtrlCTrap &trap)
+{
+  TRACE;
+  if (resp.type == NonFatalError) {
+    string const errMsg = resp.errMsg;
+    resp.clear();
+    trap.release(); // makes R13sp1 work (it skips destructors)
+    // communication is done, so the channel isn't corrupted--no need
+    // to make this fatal.
+    mexErrMsgTxt(errMsg.c_str());
+  }
+
+  const int nlhsReturned = (int)resp.lhs.size();
+  VERBOSE(nlhsReturned << " lhs args returned (" << nlhs
+          << " slots should be filled)");
+  VrRecoverableCheckMsg(nlhsReturned <= nlhs ||
+                        (nlhsReturned == 1 && nlhs == 0),
+    "Expected " << nlhs << " left hand arguments from the server, but " 
+    << nlhsReturned << " were returned instead.");
+  for (int i=0; i<nlhsReturned; i++) {
+    resp.lhs[i]->transferToMat(plhs[i]);
+  }
+  resp.clear();
+}
+
+/** Copies the frame returned by a "getframe" request into the array 
+ *  Matlab passed to "getframeinto".  That array's data is overwritten in
+ *  place, which videoReader/getframeinto only allows with 'inplace'. */
+static void deliverFrameInto(PendingResponse &resp, mxArray const *dst,
+                             CtrlCTrap &trap)
+{
+  TRACE;
+  if (resp.type == Success) {
+    if (resp.lhs.size() != 1 ||
+        resp.lhs[0]->mx() != MatDataTypeConstants::mxUINT8_CLASS ||
+        resp.lhs[0]->numElm() != mxGetNumberOfElements(dst) ||
+        resp.lhs[0]->dims()[0] != (int)mxGetM(dst)) {
+      resp.type   = NonFatalError;
+      resp.errMsg = "The frame buffer passed to getframeinto does not match "
+        "the video's frame size.";
+    } else {
+      memcpy(mxGetData(dst), resp.lhs[0]->data(), resp.lhs[0]->numElm());
+    }
+    resp.lhs.squeeze();
+  }
+  deliverResponse(resp, 0, NULL, trap);
+}
+
+/** Builds the request for a parameterless operation on a handle */
+static void makeRequest(MatArrayVec &rhs, char const *op, Handle handle)
+{
+  rhs.squeeze();
+  rhs.push_back(string2mat(op).release());
+  rhs.push_back(scalar2mat<Handle>(handle).release());
+}
+
+/** Returns the named field of a successful "get" response, or NULL if it
+ *  isn't there. */
+static MatArray *infoFieldArray(PendingResponse &resp, char const *name)
+{
+  if (resp.type != Success || resp.lhs.size() != 2) return NULL;
+  MatArray *names = resp.lhs[0];
+  MatArray *vals  = resp.lhs[1];
+  if (names->mx() != MatDataTypeConstants::mxCELL_CLASS || 
+      vals->mx()  != MatDataTypeConstants::mxCELL_CLASS ||
+      names->numElm() != vals->numElm()) {
+    return NULL;
+  }
+  for (size_t i=0; i<names->numElm(); i++) {
+    MatArray *n = ((MatArray**)names->data())[i];
+    MatArray *v = ((MatArray**)vals->data())[i];
+    if (n->mx() == MatDataTypeConstants::mxCHAR_CLASS && 
+        mat2string(n) == name) {
+      return v;
+    }
+  }
+  return NULL;
+}
+
+/** Returns the named numeric field of a successful "get" response, or 
+ *  NULL if it isn't there. */
+static double *infoField(PendingResponse &resp, char const *name)
+{
+  MatArray *v = infoFieldArray(resp, name);
+  if (v == NULL || v->mx() != MatDataTypeConstants::mxDOUBLE_CLASS || 
+      v->numElm() != 1) {
+    return NULL;
+  }
+  return (double*)v->data();
+}
+
+/** Refreshes what we know about a pipelined video from a "get" response.
+ *  Estimated frame counts (e.g. from a container's header) are ignored: 
+ *  if one were too high, a speculative "next" would close the video. */
+static void updatePipelinedVideo(PipelinedVideo &pv, PendingResponse &resp)
+{
+  double const *numFrames = infoField(resp, "numFrames");
+  double const *frameNum  = infoField(resp, "approxFrameNum");
+  MatArray     *exact     = infoFieldArray(resp, "exactNumFrames");
+  bool const    isExact   = 
+    exact != NULL && exact->mx() == MatDataTypeConstants::mxCHAR_CLASS &&
+    mat2string(exact) == "1";
+  pv.numFrames = (numFrames && isExact) ? *numFrames : -1;
+  if (frameNum)  pv.frameNum  = *frameNum;
+  pv.frameNumKnown = (frameNum != NULL);
+}
+
+/** Asks the server where a pipelined video is (one round trip) */
+static void queryPipelinedVideo(Handle handle, PipelinedVideo &pv)
+{
+  TRACE;
+  MatArrayVec rhs(0);
+  makeRequest(rhs, "get", handle);
+  PendingResponse resp;
+  readResponse(sendRequest(2, rhs), resp);
+  updatePipelinedVideo(pv, resp);
+}
+
+/** True iff a speculative "next" on handle can't run off the end, i.e. 
+ *  the server knows exactly how many frames there are and we know where 
+ *  the video is. */
+static bool canSpeculate(Handle handle)
+{
+  map<Handle, PipelinedVideo>::iterator i = pipelinedVideos.find(handle);
+  if (i == pipelinedVideos.end()) return false;
+  PipelinedVideo &pv = i->second;
+  if (!pv.frameNumKnown) queryPipelinedVideo(handle, pv);
+  return pv.frameNumKnown && pv.numFrames >= 0 && 
+    pv.frameNum + 1 < pv.numFrames;
+}
+
+/** With pipelining, as soon as Matlab has been given a frame obtained by
+ *  "next" followed by "getframe", we send the same two requests again 
+ *  without waiting for Matlab to ask, unless that frame may be the last
+ *  one (see canSpeculate).  The server then decodes the next frame while
+ *  Matlab is busy with the current one.  If Matlab's next two requests on
+ *  that video are indeed "next" and "getframe", we answer them with the
+ *  responses to the speculative requests.  A "get" is answered alongside
+ *  them.  Any other request on the same video cancels the speculation 
+ *  first (see cancelSpeculation).  Requests on other videos leave it 
+ *  alone: the server works on different videos concurrently, so several
+ *  videos can be read ahead at once. */
+static void speculate(Handle handle)
+{
+  TRACE;
+  Speculation spec;
+  MatArrayVec rhs(0);
+  makeRequest(rhs, "next", handle);
+  spec.nextMsgId  = sendRequest(1, rhs);
+  makeRequest(rhs, "getframe", handle);
+  spec.frameMsgId = sendRequest(1, rhs);
+  spec.nextAnswered = false;
+  spec.nextRead     = false;
+  spec.nextWorked   = false;
+  speculations[handle] = spec;
+}
+
+/** Reads the answer to a speculative "next" without giving it to Matlab */
+static void answerSpeculativeNext(Speculation &spec)
+{
+  if (spec.nextAnswered) return;
+  PendingResponse resp;
+  readResponse(spec.nextMsgId, resp);
+  spec.nextAnswered = true;
+  spec.nextWorked   = responseIsTrue(resp);
+}
+
+/** Reads and discards the outstanding speculative responses for handle.
+ *  If the speculative "next" moved the video forward and Matlab never saw
+ *  it, we step back one frame when undo is true.  */
+static void cancelSpeculation(Handle handle, bool undo)
+{
+  TRACE;
+  map<Handle, Speculation>::iterator i = speculations.find(handle);
+  if (i == speculations.end()) return;
+  Speculation spec = i->second;
+  speculations.erase(i);
+
+  bool advanced = false;
+  if (!spec.nextRead) {
+    answerSpeculativeNext(spec);
+    advanced = spec.nextWorked;
+  }
+  PendingResponse resp;
+  readResponse(spec.frameMsgId, resp);
+
+  if (undo && advanced) {
+    VERBOSE("Undoing the speculative next on handle " << handle);
+    MatArrayVec rhs(0);
+    makeRequest(rhs, "step", handle);
+    rhs.push_back(scalar2mat<double>(-1).release());
+    readResponse(sendRequest(1, rhs), resp);
+    if (!responseIsTrue(resp)) {
+      PRINTWARN("Could not undo a speculative read on handle " << 
+                handle << ".  The video may be one frame ahead.");
+    }
+  }
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
   TRACE;
@@ -213,12 +677,51 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     if (!initialized) initialize();
 
     MatArrayVec rhs(nrhs); // auto_ptr's okay w/ no resize
+    string op;
+    Handle handle     = 0;
+    bool   haveHandle = false;
+    bool   pipelining = false;
+    mxArray const *frameDst = NULL;
     try {
       // Errors are recoverable as long as we don't write anything to the
       // communication channel.
       for (int i=0; i<nrhs; i++) {
         rhs[i] = new MatArray(prhs[i]);
       }
+      if (nrhs >= 1 && rhs[0]->mx() == MatDataTypeConstants::mxCHAR_CLASS) {
+        op = mat2string(rhs[0]);
+      }
+      if (nrhs >= 2 && rhs[1]->mx() == MatType<Handle>::mx() && 
+          rhs[1]->numElm() == 1) {
+        handle     = *(Handle const*)rhs[1]->data();
+        haveHandle = true;
+      }
+      // 'pipelining' is implemented here, so the server never sees it.
+      if (op == "open") {
+        for (size_t i=3; i+1<rhs.size(); i+=2) {
+          if (rhs[i]->mx() == MatDataTypeConstants::mxCHAR_CLASS &&
+              strcasecmp(mat2string(rhs[i]).c_str(), "pipelining") == 0) {
+            pipelining = (atoi(mat2string(rhs[i+1]).c_str()) != 0);
+            delete rhs[i];
+            delete rhs[i+1];
+            rhs.erase(rhs.begin() + i, rhs.begin() + i + 2);
+            break;
+          }
+        }
+      }
+      // 'getframeinto' is sent to the server as a plain 'getframe' so that
+      // the caller's buffer isn't shipped across the pipe and so pipelined
+      // reads can answer it.
+      if (op == "getframeinto" && haveHandle && nrhs == 3) {
+        VrRecoverableCheckMsg(mxIsUint8(prhs[2]) && nlhs == 0,
+          "getframeinto takes a uint8 frame buffer and returns nothing.");
+        frameDst = prhs[2];
+        delete rhs[0];
+        delete rhs[2];
+        rhs.pop_back();
+        rhs[0] = string2mat("getframe").release();
+        op     = "getframe";
+      }
     } catch(VrRecoverableException const &e) {
       VERBOSE("Recoverable exception:\n" + e.message);
       // Avoid some really nasty double-free problems by forcing rhs to
@@ -233,66 +736,99 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     // backends that hang, we may create timers that will do a hard kill.
     CtrlCTrap trap;
 
-    // Pass data to server
-    const int reqMsgId = writeMessageHeader(toServer);
-    writeScalar<int>(nlhs, toServer);
-    writeScalar<int>(nrhs, toServer);
-    for (int i=0; i<nrhs; i++) {
-      writeMatArray(*rhs[i], toServer);
-    }
-    rhs.squeeze();
-    writeMessageFooter(toServer);
-    VrFatalIoCheck(fflush(toServer) == 0);
+    bool const isPlain = haveHandle && rhs.size() == 2;
+    map<Handle, Speculation>::iterator spec = 
+      haveHandle ? speculations.find(handle) : speculations.end();
+    bool const onSpecHandle = (spec != speculations.end());
+    PendingResponse resp;
+    bool startPipeline = false;
 
-    // Get back response
-    const int respMsgId = readMessageHeader(fromServer);
-    VrFatalCheckMsg(reqMsgId == respMsgId,
-                    "Received response for message #" << respMsgId << ", but "
-                    "expected a response for #" << reqMsgId);
-
-    // Analyze the response
-    ResponseType const rt = (ResponseType)readScalar<int>(fromServer);
-    VERBOSE("Response: " << rt);
-    switch (rt) {
-    case Success:
-      {
-        const int nlhsReturned = readScalar<int>(fromServer);
-        VERBOSE(nlhsReturned << " lhs args returned (" << nlhs
-                << " slots should be filled)");
-        VrRecoverableCheckMsg(nlhsReturned <= nlhs ||
-                              (nlhsReturned == 1 && nlhs == 0),
-          "Expected " << nlhs << " left hand arguments from the server, but " 
-          << nlhsReturned << " were returned instead.");
-        for (int i=0; i<nlhsReturned; i++) {
-          readMatArray(fromServer)->transferToMat(plhs[i]);
-        }
+    if (onSpecHandle && isPlain && op == "next" && !spec->second.nextRead) {
+      // Matlab asked for what we already requested
+      rhs.squeeze();
+      if (spec->second.nextAnswered) {
+        resp.lhs.push_back(
+          scalar2mat<double>(spec->second.nextWorked ? 1 : 0).release());
+      } else {
+        readResponse(spec->second.nextMsgId, resp);
+        spec->second.nextAnswered = true;
+        spec->second.nextWorked   = responseIsTrue(resp);
+      }
+      spec->second.nextRead = true;
+      if (spec->second.nextWorked) pipelinedVideos[handle].frameNum++;
+
+    } else if (onSpecHandle && isPlain && op == "getframe" && 
+               spec->second.nextRead) {
+      rhs.squeeze();
+      readResponse(spec->second.frameMsgId, resp);
+      startPipeline = spec->second.nextWorked && resp.type == Success;
+      speculations.erase(spec);
+
+    } else {
+      // "get" doesn't move the video, so the speculation can stay.  The 
+      // server has already run (or will run first) the speculative next,
+      // so if Matlab hasn't seen it, the position is one frame ahead of 
+      // what Matlab expects.
+      bool const passThrough = onSpecHandle && op == "get";
+      bool hiddenNext = false;
+      if (passThrough && !spec->second.nextRead) {
+        answerSpeculativeNext(spec->second);
+        hiddenNext = spec->second.nextWorked;
       }
-      readMessageFooter(fromServer);
-      break;
-
-    case FatalError:
-      VrFatalThrow(readString(fromServer));
-      // No need to read the footer--this is panic mode
-      break;
-
-    case NonFatalError:
-      { 
-        string errMsg = readString(fromServer);
-        // *must* read footer before erroring out!
-        readMessageFooter(fromServer);
-        trap.release(); // makes R13sp1 work (it skips destructors)
-        // communication is done, so the channel isn't corrupted--no need
-        // to make this fatal.
-        mexErrMsgTxt(errMsg.c_str());
+
+      // Seeks and closes make the speculative next irrelevant.  For 
+      // anything else, the video must be where Matlab thinks it is.
+      if (onSpecHandle && !passThrough) {
+        cancelSpeculation(handle, !(op == "seek" || op == "seektime" || 
+                                    op == "close"));
       }
-      break;
 
-    default:
-      trap.release(); // makes R13sp1 work (it skips destructors)
-      VrFatalThrow("Unexpected response type from server: " << rt);
-      // No need to read the pipe's footer--this is panic mode
+      // Pass data to server and get back the response
+      readResponse(sendRequest(nlhs, rhs), resp);
+      if (hiddenNext) {
+        double *frameNum = infoField(resp, "approxFrameNum");
+        if (frameNum) (*frameNum)--;
+      }
+
+      map<Handle, PipelinedVideo>::iterator pv = 
+        haveHandle ? pipelinedVideos.find(handle) : pipelinedVideos.end();
+      if (pv != pipelinedVideos.end()) {
+        if (resp.type == Success) {
+          startPipeline = (op == "getframe" && isPlain && lastNextWorked && 
+                           lastNextHandle == handle);
+        }
+        // Only "next" moves the video by a known amount.  Anything else 
+        // that might move it makes canSpeculate ask the server again.
+        if (op == "next" && responseIsTrue(resp)) {
+          pv->second.frameNum++;
+        } else if (op == "get") {
+          updatePipelinedVideo(pv->second, resp);
+        } else if (op != "getframe") {
+          pv->second.frameNumKnown = false;
+        }
+      }
+      lastNextWorked = (op == "next" && responseIsTrue(resp));
+      lastNextHandle = handle;
+
+      if (op == "open" && resp.type == Success && resp.lhs.size() == 1 &&
+          resp.lhs[0]->mx() == MatType<Handle>::mx()) {
+        Handle const newHandle = *(Handle const*)resp.lhs[0]->data();
+        if (pipelining) {
+          // Cache the frame count now.  Asking for it again later would 
+          // cost a round trip.
+          queryPipelinedVideo(newHandle, pipelinedVideos[newHandle]);
+        } else {
+          pipelinedVideos.erase(newHandle);
+        }
+      } else if (op == "close" && haveHandle) {
+        pipelinedVideos.erase(handle);
+      }
     }
 
+    if (frameDst) deliverFrameInto(resp, frameDst, trap);
+    else          deliverResponse(resp, nlhs, plhs, trap);
+    if (startPipeline && canSpeculate(handle)) speculate(handle);
+
     if (trap.trapped()) {
       trap.release(); // makes R13sp1 work (it skips destructors)
       mexErrMsgTxt("User break");
@@ -36,9 +36,17 @@ SOFTWARE.
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <strings.h>
 #include "debug.h"
 #include "matarray.h"
 #include "pipecomm.h"
+#include "localsocket.h"
 #include "handleMexRequest.h"
 
 using namespace std;
@@ -47,61 +55,512 @@ using namespace VideoIO;
 // Users of this file are expected to link to all of the externs in
 // handleMexRequest.h.
 
-int obtainRequest(int &nlhs, MatArrayVector &rhs)
+/** 
+ * One client.  Normally there is exactly one, the mex function that 
+ * started us, talking to us through stdin and stdout.  When running as a 
+ * daemon (--daemon=PATH), there is one per connected socket.
+ */
+class Connection {
+public:
+  Connection(FILE *in, FILE *out) : 
+    in(in), out(out), ring(NULL), nPending(0) 
+  {
+    pthread_mutex_init(&outputMutex, NULL);
+    pthread_mutex_init(&stateMutex, NULL);
+    pthread_cond_init(&idle, NULL);
+  }
+
+  ~Connection() {
+    pthread_cond_destroy(&idle);
+    pthread_mutex_destroy(&stateMutex);
+    pthread_mutex_destroy(&outputMutex);
+  }
+
+  FILE * const    in;
+  FILE * const    out;
+  /** If the client gave us a shared memory ring, large response arrays 
+   *  are passed through it.  ring is NULL otherwise. */
+  ShmRing         ringStorage;
+  ShmRing        *ring;
+  /** Responses are written by the worker threads, one whole message at a
+   *  time. */
+  pthread_mutex_t outputMutex;
+
+  void requestQueued() {
+    pthread_mutex_lock(&stateMutex);
+    nPending++;
+    pthread_mutex_unlock(&stateMutex);
+  }
+
+  void requestDone() {
+    pthread_mutex_lock(&stateMutex);
+    if (--nPending == 0) pthread_cond_broadcast(&idle);
+    pthread_mutex_unlock(&stateMutex);
+  }
+
+  /** Waits until every queued request has been answered */
+  void waitUntilIdle() {
+    pthread_mutex_lock(&stateMutex);
+    while (nPending > 0) pthread_cond_wait(&idle, &stateMutex);
+    pthread_mutex_unlock(&stateMutex);
+  }
+
+  /** We remember which videos a client opened so that a daemon can close
+   *  them when the client goes away without doing so, and so that no 
+   *  client can use another's videos (handles are easy to guess). */
+  void handleOpened(Handle h) { 
+    pthread_mutex_lock(&stateMutex);
+    handles.insert(h);
+    pthread_mutex_unlock(&stateMutex);
+  }
+
+  void handleClosed(Handle h) { 
+    pthread_mutex_lock(&stateMutex);
+    handles.erase(h);
+    pthread_mutex_unlock(&stateMutex);
+  }
+
+  bool ownsHandle(Handle h) {
+    pthread_mutex_lock(&stateMutex);
+    bool const owned = (handles.count(h) > 0);
+    pthread_mutex_unlock(&stateMutex);
+    return owned;
+  }
+
+  set<Handle> openHandles() {
+    pthread_mutex_lock(&stateMutex);
+    set<Handle> const h(handles);
+    pthread_mutex_unlock(&stateMutex);
+    return h;
+  }
+
+private:
+  Connection(Connection const &);
+  Connection &operator=(Connection const &);
+
+  pthread_mutex_t stateMutex;
+  pthread_cond_t  idle;
+  int             nPending;
+  set<Handle>     handles;
+};
+
+class OutputLock {
+public:
+  OutputLock(Connection &c) : c(c) { pthread_mutex_lock(&c.outputMutex); }
+  ~OutputLock() { pthread_mutex_unlock(&c.outputMutex); }
+private:
+  Connection &c;
+};
+
+/** The handle static methods (e.g. videoWriter's "codecs") are called 
+ *  with.  It never names a video. */
+static const Handle STATIC_CALL_HANDLE = -1;
+
+/** Upper bound for the default number of worker threads (--threads=N 
+ *  overrides it). */
+static const int MAX_AUTO_WORKERS = 16;
+
+/** One request from a client, waiting to be handled */
+struct Request {
+  Connection    *conn;
+  int            msgId;
+  int            nlhs;
+  MatArrayVector rhs;
+  /** The operation and handle, for requests that have the usual 
+   *  (op, handle, ...) form. */
+  string         op;
+  Handle         handle;
+  bool           haveHandle;
+};
+
+/** 
+ * Requests are handled by a pool of worker threads.  Requests that name 
+ * the same video handle are handled one at a time in the order they 
+ * arrived, but requests for different videos may run concurrently.  Each
+ * response carries the id of its request, so it doesn't matter that they
+ * may be sent in a different order than the requests came in.
+ */
+class RequestScheduler {
+public:
+  typedef long long Key;
+
+  RequestScheduler() : stopping(false), nextUnorderedKey(1LL << 32) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&workAvailable, NULL);
+  }
+
+  ~RequestScheduler() {
+    stop();
+    pthread_cond_destroy(&workAvailable);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  void start(int nWorkers) {
+    for (int i=0; i<nWorkers; i++) {
+      pthread_t t;
+      VrFatalCheckMsg(pthread_create(&t, NULL, &workerMain, this) == 0,
+                      "Could not start server worker thread #" << i);
+      workers.push_back(t);
+    }
+    VERBOSE("Started " << nWorkers << " worker threads.");
+  }
+
+  /** Takes ownership of req.  Requests that don't operate on an existing
+   *  handle (e.g. "open") get a key of their own so they never wait. */
+  void enqueue(Request *req) {
+    bool const ordered = 
+      req->haveHandle && strcasecmp(req->op.c_str(), "open") != 0;
+
+    req->conn->requestQueued();
+    pthread_mutex_lock(&mutex);
+    const Key key = ordered ? (Key)req->handle : nextUnorderedKey++;
+    QueueMap::iterator q = queues.find(key);
+    if (q == queues.end()) {
+      queues[key].push_back(req);
+      ready.push_back(key);
+      pthread_cond_signal(&workAvailable);
+    } else {
+      // a worker has it or will pick it up
+      q->second.push_back(req);
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+
+  /** Finishes all queued requests, then stops the workers. */
+  void stop() {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&workAvailable);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i=0; i<workers.size(); i++) {
+      pthread_join(workers[i], NULL);
+    }
+    workers.clear();
+  }
+
+private:
+  typedef map<Key, deque<Request*> > QueueMap;
+
+  static void *workerMain(void *arg) {
+    ((RequestScheduler*)arg)->work();
+    return NULL;
+  }
+
+  void work();
+
+  pthread_mutex_t   mutex;
+  pthread_cond_t    workAvailable;
+  bool              stopping;
+  Key               nextUnorderedKey;
+  /** Queued requests per key.  A key is present while it has queued 
+   *  requests or while a worker is handling one of its requests. */
+  QueueMap          queues;
+  /** Keys with queued requests that no worker is handling */
+  deque<Key>        ready;
+  vector<pthread_t> workers;
+};
+
+static RequestScheduler scheduler;
+
+static void handleRequest(Request const &req);
+
+void RequestScheduler::work()
 {
   TRACE;
+  pthread_mutex_lock(&mutex);
+  while (true) {
+    while (ready.empty() && !stopping) {
+      pthread_cond_wait(&workAvailable, &mutex);
+    }
+    if (ready.empty()) break;
+
+    const Key key = ready.front();
+    ready.pop_front();
+    deque<Request*> &q = queues[key];
+    Request *req = q.front();
+    q.pop_front();
+    pthread_mutex_unlock(&mutex);
+
+    handleRequest(*req);
+    delete req;
+
+    pthread_mutex_lock(&mutex);
+    QueueMap::iterator i = queues.find(key);
+    if (i->second.empty()) {
+      queues.erase(i);
+    } else {
+      ready.push_back(key);
+      pthread_cond_signal(&workAvailable);
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+}
 
-  const int msgId = readMessageHeader();
-  nlhs = readScalar<int>();
-  const int nrhs = readScalar<int>();
+auto_ptr<Request> obtainRequest(Connection &conn)
+{
+  TRACE;
+
+  auto_ptr<Request> req(new Request());
+  req->conn  = &conn;
+  req->msgId = readMessageHeader(conn.in);
+  req->nlhs  = readScalar<int>(conn.in);
+  const int nrhs = readScalar<int>(conn.in);
   for (int i=0; i<nrhs; i++) {
-    rhs.push_back(readMatArray().release());
+    req->rhs.push_back(readMatArray(conn.in).release());
+  }
+  readMessageFooter(conn.in);
+
+  MatArrayVector const &rhs = req->rhs;
+  if (rhs.size() > 0 && rhs[0]->mx() == MatDataTypeConstants::mxCHAR_CLASS) {
+    req->op = mat2string(rhs[0]);
+    VERBOSE("Request has " << rhs.size() << " arguments with \"" <<
+            req->op << "\" as the first argument.");
   }
-  readMessageFooter();
-  return msgId;
+  req->haveHandle = 
+    rhs.size() >= 2 && !req->op.empty() &&
+    rhs[1]->mx() == MatType<Handle>::mx() && rhs[1]->numElm() == 1;
+  req->handle = req->haveHandle ? *(Handle const*)rhs[1]->data() : 0;
+  return req;
 }
 
-void sendNonFatalResponse(int msgId, std::string const &errMsg) 
+void sendNonFatalResponse(Connection &conn, int msgId, 
+                          std::string const &errMsg) 
 {
   TRACE;
 
-  writeMessageHeader(stdout, msgId);
-  writeScalar<int>(NonFatalError);
-  writeString(errMsg);
-  writeMessageFooter();
-  VrFatalIoCheck(fflush(stdout) == 0);
+  OutputLock lock(conn);
+  writeMessageHeader(conn.out, msgId);
+  writeScalar<int>(NonFatalError, conn.out);
+  writeString(errMsg, conn.out);
+  writeMessageFooter(conn.out);
+  VrFatalIoCheck(fflush(conn.out) == 0);
   VERBOSE("server sent non-fatal response: " << errMsg.c_str());
 }
 
-void sendFatalResponse(int msgId, std::string const &errMsg) 
+void sendFatalResponse(Connection &conn, int msgId, 
+                       std::string const &errMsg) 
 {
   TRACE;
 
-  writeMessageHeader(stdout, msgId);
-  writeScalar<int>(FatalError);
-  writeString(errMsg);
-  writeMessageFooter();
-  VrFatalIoCheck(fflush(stdout) == 0);
+  OutputLock lock(conn);
+  writeMessageHeader(conn.out, msgId);
+  writeScalar<int>(FatalError, conn.out);
+  writeString(errMsg, conn.out);
+  writeMessageFooter(conn.out);
+  VrFatalIoCheck(fflush(conn.out) == 0);
   VERBOSE("server sent fatal response: " << errMsg.c_str());
 }
 
-void sendSuccessResponse(int msgId, MatArrayVector const &lhs) 
+void sendSuccessResponse(Connection &conn, int msgId, 
+                         MatArrayVector const &lhs) 
 {
   TRACE;
 
-  writeMessageHeader(stdout, msgId);
-  writeScalar<int>(Success);
+  OutputLock lock(conn);
+  writeMessageHeader(conn.out, msgId);
+  writeScalar<int>(Success, conn.out);
   
-  writeScalar<int>((int)lhs.size());
+  writeScalar<int>((int)lhs.size(), conn.out);
   for (size_t i=0; i<lhs.size(); i++) {
-    writeMatArray(*lhs[i]);
+    writeMatArray(*lhs[i], conn.out, conn.ring);
   }
 
-  writeMessageFooter();
-  VrFatalIoCheck(fflush(stdout) == 0);
+  writeMessageFooter(conn.out);
+  VrFatalIoCheck(fflush(conn.out) == 0);
   VERBOSE("server is sending " << lhs.size() << " vars.");
 }
 
+static void handleRequest(Request const &req)
+{
+  TRACE;
+  VERBOSE("Handling request " << req.msgId << "...");
+  Connection &conn = *req.conn;
+  MatArrayVector lhs;
+  try {
+    try {
+      VrRecoverableCheckMsg(
+        !req.haveHandle || req.op == "open" || 
+        req.handle == STATIC_CALL_HANDLE || conn.ownsHandle(req.handle),
+        "Handle " << req.handle << " was not opened by this client.");
+      handleMexRequest(lhs, req.nlhs, req.rhs);
+
+      if (req.op == "open" && lhs.size() == 1 && 
+          lhs[0]->mx() == MatType<Handle>::mx() && lhs[0]->numElm() == 1) {
+        conn.handleOpened(*(Handle const*)lhs[0]->data());
+      } else if (req.op == "close" && req.haveHandle) {
+        conn.handleClosed(req.handle);
+      }
+
+      VERBOSE("Sending response...");
+      sendSuccessResponse(conn, req.msgId, lhs);
+
+    } catch (VrRecoverableException const &e) {
+      sendNonFatalResponse(conn, req.msgId, e.message);
+    } catch (VrFatalError const &e) {
+      sendFatalResponse(conn, req.msgId, e.message);
+    } catch (...) {
+      sendFatalResponse(conn, req.msgId, "Unexpected exception trapped!");
+    }
+  } catch (VrFatalError const &e) {
+    // The client has most likely gone away.  Whoever reads its requests
+    // notices that too and cleans up.
+    PRINTERROR("Could not send the response to request " << req.msgId << 
+               ":\n" << e.message);
+  }
+  conn.requestDone();
+}
+
+/** Reads requests from conn and queues them until the client hangs up, at
+ *  which point an exception is thrown. */
+static void serveConnection(Connection &conn)
+{
+  TRACE;
+  readHandshake(conn.in);
+  writeHandshake(conn.out);
+  while (true) {
+    VERBOSE("Obtaining request...");
+    scheduler.enqueue(obtainRequest(conn).release());
+  }
+}
+
+/** Closes the videos a daemon client left open.  Other clients can't be
+ *  using them: handleRequest only accepts a handle from the client that 
+ *  opened it. */
+static void closeAbandonedVideos(Connection &conn)
+{
+  TRACE;
+  set<Handle> const handles = conn.openHandles();
+  for (set<Handle>::const_iterator h=handles.begin(); h!=handles.end(); h++) {
+    VERBOSE("Closing abandoned video " << *h);
+    MatArrayVector rhs, lhs;
+    rhs.push_back(string2mat("close").release());
+    rhs.push_back(scalar2mat<Handle>(*h).release());
+    try {
+      handleMexRequest(lhs, 0, rhs);
+    } catch (VrRecoverableException const &e) {
+      PRINTWARN("Could not close video " << *h << ":\n" << e.message);
+    }
+  }
+}
+
+/** Receives a new daemon client's ring (see sendRingFd) and wraps its 
+ *  socket in a Connection.  Returns NULL if that fails. */
+static Connection *openDaemonConnection(int fd)
+{
+  TRACE;
+  int ringFd;
+  FILE *in = NULL, *out = NULL;
+  int const outFd = dup(fd);
+  if (!recvRingFd(fd, ringFd) || outFd < 0 ||
+      (in  = fdopen(fd,    "r")) == NULL || 
+      (out = fdopen(outFd, "w")) == NULL) {
+    PRINTWARN("Could not set up a client connection.");
+    if (ringFd >= 0) close(ringFd);
+    if (in) fclose(in); else close(fd);
+    if (outFd >= 0) close(outFd);
+    return NULL;
+  }
+
+  Connection *conn = new Connection(in, out);
+  if (ringFd >= 0) {
+    // Even if we can't use the ring, the client expects us to say so
+    // for every array (see writeMatArray).
+    conn->ring = &conn->ringStorage;
+    if (!conn->ring->attach(ringFd)) {
+      PRINTWARN("Could not map a client's shared memory ring.  All of "
+                "its data will be sent through the socket.");
+    }
+  }
+  return conn;
+}
+
+/** Thread body for one daemon client.  arg is the accepted socket.  The
+ *  setup happens here rather than in runDaemon so that a client that 
+ *  connects and then says nothing can't hold up everyone else. */
+static void *daemonConnectionMain(void *arg)
+{
+  TRACE;
+  Connection *conn = openDaemonConnection((int)(long)arg);
+  if (conn == NULL) return NULL;
+  try {
+    serveConnection(*conn);
+  } catch (VrRecoverableException const &e) {
+    VERBOSE("Client disconnected:\n" << e.message);
+  } catch (VrFatalError const &e) {
+    VERBOSE("Client disconnected:\n" << e.message);
+  }
+
+  try {
+    conn->waitUntilIdle();
+    closeAbandonedVideos(*conn);
+  } catch (VrFatalError const &e) {
+    PRINTERROR("Fatal error while cleaning up after a client:\n" << 
+               e.message);
+  }
+
+  releaseMessageBuffer(conn->in);
+  releaseMessageBuffer(conn->out);
+  fclose(conn->in);
+  fclose(conn->out);
+  delete conn;
+  return NULL;
+}
+
+/** Accepts clients on the Unix domain socket at path forever.  Every 
+ *  client gets its own thread for reading requests, and all of them share
+ *  the worker pool and the open videos' state (e.g. keyframe indexes). */
+static void runDaemon(string const &path)
+{
+  TRACE;
+  // A client that disappears mid-response must not take the daemon down.
+  signal(SIGPIPE, SIG_IGN);
+
+  int const listenFd = listenLocalSocket(path);
+  VrFatalCheckMsg(listenFd >= 0, 
+                  "Could not listen on \"" << path << "\": " << 
+                  strerror(errno) << ".  Its directory must be owned by "
+                  "us and have no group or other permissions (mode 700).");
+  VERBOSE("Listening on " << path);
+
+  while (true) {
+    int const fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      VrFatalCheckMsg(errno == EINTR || errno == ECONNABORTED,
+                      "Could not accept a connection on \"" << path << 
+                      "\": " << strerror(errno));
+      continue;
+    }
+    if (!localSocketPeerIsUs(fd)) {
+      PRINTWARN("Refused a connection from another user.");
+      close(fd);
+      continue;
+    }
+
+    pthread_t      t;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&t, &attr, &daemonConnectionMain, 
+                       (void*)(long)fd) != 0) {
+      PRINTWARN("Could not start a thread for a new client.");
+      close(fd);
+    }
+    pthread_attr_destroy(&attr);
+  }
+}
+
+static int defaultWorkerCount()
+{
+#ifdef ECHO_PIPE_COMMUNICATION
+  // keep the communication log readable
+  return 1;
+#else
+  const long nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nCpus < 1) return 1;
+  return (nCpus > MAX_AUTO_WORKERS) ? MAX_AUTO_WORKERS : (int)nCpus;
+#endif
+}
+
 int main(int argc, char **argv) 
 {
   TRACE;
@@ -113,47 +572,48 @@ int main(int argc, char **argv)
                       "Unable to open log file: \"" << logfname << "\".");
 #endif
 
-    while (true) {
-      VERBOSE("Obtaining request...");
-      int nlhs;
-      MatArrayVector rhs;
-      const int msgId = obtainRequest(nlhs, rhs);
-
-      if (rhs.size() > 0 && 
-          rhs[0]->mx() == MatDataTypeConstants::mxCHAR_CLASS) {
-        VERBOSE("Request has " << rhs.size() << " arguments with \"" <<
-                mat2string(rhs[0]) << "\" as the first argument.");
-      }
-      
-      VERBOSE("Handling request...");
-      MatArrayVector lhs;
-      try {
-        handleMexRequest(lhs, nlhs, rhs);
-
-        VERBOSE("Sending response...");
-        sendSuccessResponse(msgId, lhs);
-
-      } catch (VrRecoverableException const &e) {
-        sendNonFatalResponse(msgId, e.message);
-      } catch (VrFatalError const &e) {
-        sendFatalResponse(msgId, e.message);
-      } catch (...) {
-        sendFatalResponse(msgId, "Unexpected exception trapped!");
+    static Connection stdioConn(stdin, stdout);
+    int    nWorkers = defaultWorkerCount();
+    string daemonPath;
+    for (int i=1; i<argc; i++) {
+      int fd, n;
+      if (sscanf(argv[i], "--threads=%d", &n) == 1 && n > 0) {
+        nWorkers = n;
+      } else if (strncmp(argv[i], "--daemon=", 9) == 0) {
+        daemonPath = argv[i] + 9;
+      } else if (sscanf(argv[i], "--shm-fd=%d", &fd) == 1) {
+        // Even if we can't use the ring, the client expects us to say so
+        // for every array (see writeMatArray).
+        stdioConn.ring = &stdioConn.ringStorage;
+        if (!stdioConn.ring->attach(fd)) {
+          PRINTWARN("Could not map the shared memory ring (fd " << fd << 
+                    ").  All data will be sent through the pipe.");
+        }
       }
     }
 
+    scheduler.start(nWorkers);
+    if (!daemonPath.empty()) {
+      runDaemon(daemonPath);
+    } else {
+      serveConnection(stdioConn);
+    }
+
   } catch (VrRecoverableException const &e) {
     PRINTERROR("Otherwise recoverable server exception "
                "(server is exiting):\n" + e.message);
+    scheduler.stop();
     cleanup();
     exit(1);
   } catch (VrFatalError const &e) {
     PRINTERROR("Fatal server exception (server is exiting):\n" + e.message);
+    scheduler.stop();
     cleanup();
     exit(2);
   } catch (...) {
     PRINTERROR("Fatal server exception (server is exiting):\n" 
                "Unexpected exception (unknown type)!");
+    scheduler.stop();
     cleanup();
     exit(3);
   }
@@ -42,6 +42,7 @@ SOFTWARE.
 #include <string>
 #include <sstream>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include "debug.h"
 
@@ -133,6 +134,32 @@ namespace VideoIO
       return (T)tmpVal;
     }
 
+    // Parses a value holding exactly n integers separated by whitespace
+    // and/or commas (e.g. "10 20 320 240", which is what num2str gives for
+    // a Matlab vector, or "10,20,320,240") into vals.  Returns false if the
+    // value is malformed or has the wrong number of entries.  Updates
+    // checkedKeys.
+    template <class T>
+    bool parseIntList(const char *key, T *vals, int n) {
+      TRACE;
+      KeyValueMap::const_iterator iter = find(key);
+      VrRecoverableCheckMsg(iter != end(),
+        "No mapping exists for " << key);
+      char const *str = iter->second.c_str();
+      int nParsed = 0;
+      while (true) {
+        while (isspace(*str) || *str == ',') str++;
+        if (*str == '\0') break;
+        char *errLoc = NULL;
+        errno = 0;
+        long int tmpVal = strtol(str, &errLoc, 0);
+        if (errLoc == str || errno == ERANGE || nParsed == n) return false;
+        vals[nParsed++] = (T)tmpVal;
+        str = errLoc;
+      }
+      return nParsed == n;
+    }
+
     // Sometimes we want to require that arguments come in pairs, for
     // example if "fpsNum" is specified, we also need "fpsDenom".  This
     // function does both-or-nothing parsing.
@@ -39,12 +39,16 @@ SOFTWARE.
 
 #include <string>
 #include <sstream>
+#include <vector>
+#include <map>
 #include <stdio.h>
 #include <memory>
 #include <errno.h>
+#include <pthread.h>
 #include "debug.h"
 #include "handle.h"
 #include "matarray.h"
+#include "shmring.h"
 
 namespace VideoIO 
 {
@@ -63,6 +67,19 @@ namespace VideoIO
   *  and mexServerStdio.cpp.  It's small and simple enough that it wasn't 
   *  worth the effort to make a set of message classes with complicated 
   *  serializers and deserializers.
+  *
+  *  Normally, each message is sent as a binary MessageFrame header followed
+  *  by its payload.  Scalars, strings and other small fields are assembled
+  *  in (and parsed from) a memory buffer so that they cost one fwrite/fread
+  *  call instead of one stdio call per field.  Binary data of at least 
+  *  VIDEOIO_COMM_BULK_MIN bytes (frames, mostly) is not copied into that 
+  *  buffer: it follows the buffered fields, written straight from the 
+  *  caller's memory and read straight into the destination.  Only the 
+  *  buffered fields are checksummed.  With TEXT_COMMUNICATIONS, messages are 
+  *  instead wrapped in VIDEOIO_COMM_TAG tags and all fields are written as
+  *  text.  Either way, the client and server exchange a handshake message 
+  *  right after the server starts (see writeHandshake) so that mismatched
+  *  builds fail with a clear error.
   */
 
 #ifdef ECHO_PIPE_COMMUNICATION
@@ -73,6 +90,162 @@ namespace VideoIO
 #define VIDEOIO_COMM_HEADER_PATTERN "<" VIDEOIO_COMM_TAG " id=\"%d\">\n" 
 #define VIDEOIO_COMM_FOOTER "\n</" VIDEOIO_COMM_TAG ">\n"
 
+#define VIDEOIO_COMM_MAGIC        0x4d6f6956 /* "VioM" */
+#define VIDEOIO_COMM_VERSION      2
+#define VIDEOIO_COMM_HANDSHAKE_ID (-1)
+/** Larger payloads are taken to be corruption rather than allocated */
+#define VIDEOIO_COMM_MAX_PAYLOAD  (1 << 30)
+/** writeBinaryData and readBinaryData calls at least this large bypass the
+ *  message buffer.  Both ends must agree, so it is part of the protocol. */
+#define VIDEOIO_COMM_BULK_MIN     4096
+
+#ifndef TEXT_COMMUNICATIONS
+  struct MessageFrame {
+    uint32 magic;         // VIDEOIO_COMM_MAGIC
+    uint32 version;       // VIDEOIO_COMM_VERSION
+    int32  msgId;
+    uint32 checksum;      // adler32 of the buffered part of the payload
+    uint64 payloadLength; // in bytes, buffered part only
+    uint64 bulkLength;    // in bytes, sent after the buffered part
+  };
+
+  /** Binary data that a message sends without buffering it */
+  struct BulkData {
+    BulkData(void const *data, size_t sz) : data(data), sz(sz) {}
+    void const *data;
+    size_t      sz;
+  };
+
+  /** The message currently being written to or read from a stream */
+  struct MessageBuffer {
+    MessageBuffer() : active(false), msgId(-1), pos(0), bulkLeft(0) {}
+    bool                       active;
+    int                        msgId;
+    std::vector<unsigned char> data;
+    /** read position in data */
+    size_t                     pos;
+    /** written after data by writeMessageFooter */
+    std::vector<BulkData>      bulk;
+    /** bytes of bulk data still to be read from the stream */
+    uint64                     bulkLeft;
+  };
+
+  /** Each stream has one message buffer.  The multithreaded server reads
+   *  requests and writes responses on different threads, so the lookup is
+   *  locked.  Writers must still serialize whole messages themselves. */
+  inline MessageBuffer &messageBuffer(FILE *f, bool release = false)
+  {
+    static std::map<FILE*, MessageBuffer> buffers;
+    static MessageBuffer                  released;
+    static pthread_mutex_t                buffersMutex = 
+      PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&buffersMutex);
+    MessageBuffer *mb = &released;
+    if (release) buffers.erase(f);
+    else         mb = &buffers[f];
+    pthread_mutex_unlock(&buffersMutex);
+    return *mb;
+  }
+
+  /** The messages this thread is in the middle of writing and reading.  
+   *  The headers look the buffers up once so that the per-field writeRaw 
+   *  and readRaw calls don't take the map lock. */
+  struct CurrentMessages {
+    FILE          *out;
+    MessageBuffer *outBuffer;
+    FILE          *in;
+    MessageBuffer *inBuffer;
+  };
+
+  inline CurrentMessages &currentMessages()
+  {
+    static __thread CurrentMessages cm;
+    return cm;
+  }
+
+  /** Call before closing a stream that may have been used for messages */
+  inline void releaseMessageBuffer(FILE *f)
+  {
+    CurrentMessages &cm = currentMessages();
+    if (cm.out == f) cm.out = NULL;
+    if (cm.in  == f) cm.in  = NULL;
+    messageBuffer(f, true);
+  }
+
+  inline uint32 adler32(unsigned char const *d, size_t n)
+  {
+    uint32 a = 1, b = 0;
+    while (n > 0) {
+      // 5552 is the most bytes we can sum before b might overflow
+      size_t chunk = (n < 5552) ? n : 5552;
+      n -= chunk;
+      while (chunk--) { a += *d++; b += a; }
+      a %= 65521;
+      b %= 65521;
+    }
+    return (b << 16) | a;
+  }
+
+  /** Appends to the current message if there is one, else writes to out */
+  inline void writeRaw(void const *data, size_t sz, FILE *out)
+  {
+    CurrentMessages &cm = currentMessages();
+    if (cm.out == out) {
+      unsigned char const *d = (unsigned char const *)data;
+      cm.outBuffer->data.insert(cm.outBuffer->data.end(), d, d + sz);
+    } else {
+      size_t written = fwrite(data, 1, sz, out);
+      VrFatalIoCheckMsg(written == sz, 
+        "Expected " << sz << " bytes to be written, but only " << written << 
+        " were actually written.");
+    }
+  }
+
+  /** Reads from the current message if there is one, else from in */
+  inline void readRaw(void *data, size_t sz, FILE *in)
+  {
+    CurrentMessages &cm = currentMessages();
+    if (cm.in == in) {
+      MessageBuffer &mb = *cm.inBuffer;
+      VrFatalCheckMsg(sz <= mb.data.size() - mb.pos, 
+        "Tried to read " << sz << " bytes, but only " << 
+        mb.data.size() - mb.pos << " remain in message " << mb.msgId << ".");
+      memcpy(data, &mb.data[mb.pos], sz);
+      mb.pos += sz;
+    } else {
+      VrFatalIoCheck(fread(data, 1, sz, in) == sz);
+    }
+  }
+
+  /** Like writeRaw, but large blocks are only remembered here and written
+   *  by writeMessageFooter, so data must stay valid until then. */
+  inline void writeBulk(void const *data, size_t sz, FILE *out)
+  {
+    CurrentMessages &cm = currentMessages();
+    if (cm.out == out && sz >= VIDEOIO_COMM_BULK_MIN) {
+      cm.outBuffer->bulk.push_back(BulkData(data, sz));
+    } else {
+      writeRaw(data, sz, out);
+    }
+  }
+
+  /** Counterpart of writeBulk: large blocks come straight from in */
+  inline void readBulk(void *data, size_t sz, FILE *in)
+  {
+    CurrentMessages &cm = currentMessages();
+    if (cm.in == in && sz >= VIDEOIO_COMM_BULK_MIN) {
+      MessageBuffer &mb = *cm.inBuffer;
+      VrFatalCheckMsg(sz <= mb.bulkLeft, 
+        "Tried to read " << sz << " bytes of binary data, but only " << 
+        mb.bulkLeft << " remain in message " << mb.msgId << ".");
+      VrFatalIoCheck(fread(data, 1, sz, in) == sz);
+      mb.bulkLeft -= sz;
+    } else {
+      readRaw(data, sz, in);
+    }
+  }
+#endif
+
   typedef enum {
     Success, FatalError, NonFatalError
   } ResponseType;
@@ -88,7 +261,7 @@ namespace VideoIO
     s << val << " ";
     VrFatalIoCheck(fputs(s.str().c_str(), out));
 #else
-    VrFatalIoCheck(fwrite(&val, sizeof(T), 1, out) == 1);
+    writeRaw(&val, sizeof(T), out);
 #endif
   }
 
@@ -105,6 +278,7 @@ namespace VideoIO
 
   inline void writeStringLowLevel(std::string s, FILE *out = stdout)
   {
+#ifdef TEXT_COMMUNICATIONS
     std::stringstream escaped;
     for (int i=0; i<s.size(); i++) {
       switch (s[i]) {
@@ -113,12 +287,12 @@ namespace VideoIO
         default: escaped << s[i];
       }
     }
-#ifdef TEXT_COMMUNICATIONS
     VrFatalIoCheck(fputs(escaped.str().c_str(), out));
     VrFatalIoCheck(fputc('\n', out) == '\n');
 #else
-    VrFatalIoCheck(fputs(escaped.str().c_str(), out));
-    VrFatalIoCheck(fputc('\n', out) == '\n');
+    uint64 const len = s.size();
+    writeRaw(&len, sizeof(len), out);
+    writeRaw(s.data(), s.size(), out);
 #endif
   }
 
@@ -141,13 +315,12 @@ namespace VideoIO
       VrFatalIoCheck(fprintf(out, "%02x ", (int)(*d++)) > 0);
     }
 #else
-    size_t written = fwrite(data, 1, sz, out);
-    VrFatalIoCheckMsg(written == sz, 
-      "Expected " << sz << " bytes to be written, but only " << written << 
-      " were actually written.");
+    writeBulk(data, sz, out);
 #endif
   }
 
+  /** Without TEXT_COMMUNICATIONS, large blocks of data are written by 
+   *  writeMessageFooter, so they must stay valid until it is called. */
   inline void writeBinaryData(void const *data, size_t sz, FILE *out = stdout)
   {
     TRACE;
@@ -165,9 +338,22 @@ namespace VideoIO
   {
     TRACE;
 
+#ifdef TEXT_COMMUNICATIONS
     // Directly write, not using writeString since we don't want it messing 
     // with newlines or anything.    
     VrFatalIoCheck(fprintf(out, VIDEOIO_COMM_HEADER_PATTERN, msgId) > 0);
+#else
+    // The frame header is written by writeMessageFooter, once we know 
+    // how long the payload is.
+    MessageBuffer &mb = messageBuffer(out);
+    mb.active = true;
+    mb.msgId  = msgId;
+    mb.data.clear();
+    mb.bulk.clear();
+    CurrentMessages &cm = currentMessages();
+    cm.out       = out;
+    cm.outBuffer = &mb;
+#endif
 #ifdef ECHO_PIPE_COMMUNICATION
     VrFatalIoCheck(fprintf(wecho, VIDEOIO_COMM_HEADER_PATTERN, msgId) > 0);
     VrFatalIoCheck(fflush(wecho) == 0);
@@ -179,16 +365,44 @@ namespace VideoIO
   inline void writeMessageFooter(FILE *out = stdout)
   {
     TRACE;
+#ifdef TEXT_COMMUNICATIONS
     // Directly write, not using writeString since we don't want it messing 
     // with newlines or anything.
     VrFatalIoCheck(fputs(VIDEOIO_COMM_FOOTER, out));
+#else
+    CurrentMessages &cm = currentMessages();
+    VrFatalCheckMsg(cm.out == out && cm.outBuffer->active, 
+                    "Message footer written without a header.");
+    MessageBuffer &mb = *cm.outBuffer;
+    mb.active = false;
+    cm.out    = NULL;
+
+    MessageFrame frame;
+    frame.magic         = VIDEOIO_COMM_MAGIC;
+    frame.version       = VIDEOIO_COMM_VERSION;
+    frame.msgId         = mb.msgId;
+    frame.payloadLength = mb.data.size();
+    frame.checksum      = mb.data.empty() ? adler32(NULL, 0) : 
+                          adler32(&mb.data[0], mb.data.size());
+    frame.bulkLength    = 0;
+    for (size_t i=0; i<mb.bulk.size(); i++) frame.bulkLength += mb.bulk[i].sz;
+    writeRaw(&frame, sizeof(frame), out);
+    if (!mb.data.empty()) writeRaw(&mb.data[0], mb.data.size(), out);
+    for (size_t i=0; i<mb.bulk.size(); i++) {
+      writeRaw(mb.bulk[i].data, mb.bulk[i].sz, out);
+    }
+    mb.bulk.clear();
+#endif
 #ifdef ECHO_PIPE_COMMUNICATION
     VrFatalIoCheck(fputs(VIDEOIO_COMM_FOOTER, wecho));
     VrFatalIoCheck(fflush(wecho) == 0);
 #endif
   }
 
-  inline void writeMatArray(MatArray const &arr, FILE *out = stdout)
+  /** If ring is non-NULL, the reader must pass a ring to readMatArray 
+   *  too.  Large arrays are then stored in the ring when there is room. */
+  inline void writeMatArray(MatArray const &arr, FILE *out = stdout, 
+                            ShmRing *ring = NULL)
   {
     TRACE;
 
@@ -200,10 +414,16 @@ namespace VideoIO
     if (arr.mx() == MatDataTypeConstants::mxCELL_CLASS) {
       MatArray const **a = (MatArray const **)arr.data();
       for (size_t i=0; i<arr.numElm(); i++) {
-        writeMatArray(*a++, out);
+        writeMatArray(*a++, out, ring);
       }
     } else {
       uint64 nBytes = arr.numElm() * MatDataTypeConstants::elmSize(arr.mx()); 
+      if (ring) {
+        int64 const offset = ring->alloc(nBytes);
+        if (offset >= 0) memcpy(ring->at(offset), arr.data(), nBytes);
+        writeScalar<int64>(offset, out);
+        if (offset >= 0) return;
+      }
       writeBinaryData(arr.data(), nBytes, out);
     }
   }
@@ -234,7 +454,7 @@ namespace VideoIO
     return val;
 #else
     T val;
-    VrFatalIoCheck(fread(&val, sizeof(T), 1, in) == 1);
+    readRaw(&val, sizeof(T), in);
     return val;
 #endif
   }
@@ -242,9 +462,15 @@ namespace VideoIO
   inline std::string readString(FILE *in = stdin)
   {
     TRACE;
-#ifdef TEXT_COMMUNICATIONS
+#ifndef TEXT_COMMUNICATIONS
+    uint64 len;
+    readRaw(&len, sizeof(len), in);
+    std::string str((size_t)len, '\0');
+    if (len > 0) readRaw(&str[0], (size_t)len, in);
+    VERBOSE("Read string: '" << str << "'\n");
+    return str;
+#else
     eatLeadingWhitespace(in);
-#endif
     std::stringstream s;
     bool done = false;
     bool escapeJustRead = false;
@@ -272,6 +498,7 @@ namespace VideoIO
     }
     VERBOSE("Read string: '" << s.str() << "'\n");
     return s.str();
+#endif
   }
 
   inline void readBinaryData(void *data, size_t sz, FILE *in = stdin)
@@ -285,7 +512,7 @@ namespace VideoIO
       *d++ = v;
     }
 #else
-    VrFatalIoCheck(fread(data, 1, sz, in) == sz);
+    readBulk(data, sz, in);
 #endif
   }
 
@@ -293,6 +520,59 @@ namespace VideoIO
   {
     TRACE;
 
+#ifndef TEXT_COMMUNICATIONS
+    CurrentMessages &cm = currentMessages();
+    cm.in = NULL;
+    MessageBuffer &mb = messageBuffer(in);
+    mb.active = false;
+
+    // A reader that gave up on the previous message may have left some of
+    // its binary data in the stream.
+    while (mb.bulkLeft > 0) {
+      char skip[4096];
+      size_t const n = (mb.bulkLeft < sizeof(skip)) ? 
+        (size_t)mb.bulkLeft : sizeof(skip);
+      VrFatalIoCheck(fread(skip, 1, n, in) == n);
+      mb.bulkLeft -= n;
+    }
+
+    MessageFrame frame;
+    VrFatalCheckMsg(fread(&frame, sizeof(frame), 1, in) == 1,
+                    "EOF found while trying to read a message header.  "
+                    "The server process probably died.");
+    VrFatalCheckMsg(frame.magic == VIDEOIO_COMM_MAGIC,
+                    "Corrupt message header (magic number 0x" << std::hex <<
+                    frame.magic << ").  If one side was built with "
+                    "TEXT_COMMUNICATIONS, both must be.");
+    VrFatalCheckMsg(frame.version == VIDEOIO_COMM_VERSION,
+                    "Protocol version " << frame.version << " received, "
+                    "but version " << VIDEOIO_COMM_VERSION << " was "
+                    "expected.  The mex function and its server were "
+                    "probably built from different versions of videoIO.");
+
+    VrFatalCheckMsg(frame.payloadLength <= VIDEOIO_COMM_MAX_PAYLOAD &&
+                    frame.bulkLength <= VIDEOIO_COMM_MAX_PAYLOAD,
+                    "Message " << frame.msgId << " claims a payload of " <<
+                    frame.payloadLength << "+" << frame.bulkLength << 
+                    " bytes.  The stream is probably corrupt.");
+    mb.data.resize((size_t)frame.payloadLength);
+    if (!mb.data.empty()) {
+      VrFatalIoCheck(fread(&mb.data[0], 1, mb.data.size(), in) == 
+                     mb.data.size());
+    }
+    VrFatalCheckMsg(frame.checksum == (mb.data.empty() ? adler32(NULL, 0) :
+                                       adler32(&mb.data[0], mb.data.size())),
+                    "Checksum mismatch in message " << frame.msgId << ".");
+    mb.msgId    = frame.msgId;
+    mb.pos      = 0;
+    mb.bulkLeft = frame.bulkLength;
+    mb.active   = true;
+    cm.in       = in;
+    cm.inBuffer = &mb;
+
+    VERBOSE("Read header for message " << frame.msgId);
+    return frame.msgId;
+#else
     int msgId = -1;
 
     std::string s;
@@ -324,11 +604,26 @@ namespace VideoIO
 
     VERBOSE("Read header for message " << msgId);
     return msgId;
+#endif
   }
 
   inline void readMessageFooter(FILE *in = stdin)
   {
     TRACE;
+#ifndef TEXT_COMMUNICATIONS
+    CurrentMessages &cm = currentMessages();
+    VrFatalCheckMsg(cm.in == in && cm.inBuffer->active, 
+                    "Message footer read without a header.");
+    MessageBuffer &mb = *cm.inBuffer;
+    mb.active = false;
+    cm.in     = NULL;
+    VrFatalCheckMsg(mb.pos == mb.data.size(),
+                    mb.data.size() - mb.pos << " unread bytes left at the "
+                    "end of message " << mb.msgId << ".");
+    VrFatalCheckMsg(mb.bulkLeft == 0,
+                    mb.bulkLeft << " unread bytes of binary data left at "
+                    "the end of message " << mb.msgId << ".");
+#else
     while (true) {
       const char *footer = VIDEOIO_COMM_FOOTER;
       int currChar;
@@ -338,9 +633,60 @@ namespace VideoIO
         VrFatalIoCheck(currChar != EOF);
       } while ((char)currChar == *footer++);
     }
+#endif
   }
 
-  inline std::auto_ptr<MatArray> readMatArray(FILE *in = stdin)
+  /** The client sends a handshake message right after starting the 
+   *  server, and the server answers with one of its own.  This catches a
+   *  mex function and server that were built with different protocols. */
+  inline void writeHandshake(FILE *out = stdout)
+  {
+    TRACE;
+    writeMessageHeader(out, VIDEOIO_COMM_HANDSHAKE_ID);
+    writeScalar<int>(VIDEOIO_COMM_VERSION, out);
+    writeMessageFooter(out);
+    VrFatalIoCheck(fflush(out) == 0);
+  }
+
+  inline void readHandshake(FILE *in = stdin)
+  {
+    TRACE;
+    const int msgId = readMessageHeader(in);
+    VrFatalCheckMsg(msgId == VIDEOIO_COMM_HANDSHAKE_ID,
+                    "Expected a protocol handshake, but received message #" 
+                    << msgId << " instead.");
+    const int version = readScalar<int>(in);
+    VrFatalCheckMsg(version == VIDEOIO_COMM_VERSION,
+                    "Protocol version " << version << " received, but "
+                    "version " << VIDEOIO_COMM_VERSION << " was expected.");
+    readMessageFooter(in);
+  }
+
+  /** An array whose data stays in a ShmRing (see readMatArray).  Its 
+   *  ring space is released when it is destroyed. */
+  class RingMatArray : public MatArray {
+  public:
+    RingMatArray(uint8 mx, std::vector<int> const &dims, ShmRing *ring, 
+                 int64 offset, size_t nBytes) : 
+      MatArray(mx, dims, ring->at(offset), VIEW_DATA), 
+      ring(ring), offset(offset), nBytes(nBytes)
+    { ring->hold(offset); }
+    virtual ~RingMatArray() { ring->release(offset, nBytes); }
+
+  private:
+    ShmRing *ring;
+    int64    offset;
+    size_t   nBytes;
+  };
+
+  /** If ring is non-NULL, arrays the writer stored in it are copied 
+   *  straight into the buffer of the returned array, which transferToMat
+   *  then hands to Matlab as it is, so each byte is copied once.  With 
+   *  leaveInRing, such arrays are returned as RingMatArray views instead, 
+   *  for responses that have to outlive the current mex call. */
+  inline std::auto_ptr<MatArray> readMatArray(FILE *in = stdin, 
+                                              ShmRing *ring = NULL,
+                                              bool leaveInRing = false)
   {
     TRACE;
     uint8  mx    = readScalar<int>(in);
@@ -349,9 +695,22 @@ namespace VideoIO
     std::vector<int> dims(ndims);
     readBinaryData(&dims[0], ndims*sizeof(dims[0]), in); 
 
+    int64 const offset = (ring && mx != MatDataTypeConstants::mxCELL_CLASS) ?
+      readScalar<int64>(in) : -1;
+    VrFatalCheckMsg(offset < 0 || ring->usable(), 
+                    "Received shared memory data, but there's no ring.");
+
     std::auto_ptr<MatArray> arr;
+    size_t nBytes = 0;
     try {
+      if (offset >= 0 && leaveInRing) {
+        nBytes = MatDataTypeConstants::elmSize(mx);
+        for (size_t i=0; i<dims.size(); i++) nBytes *= dims[i];
+        arr.reset(new RingMatArray(mx, dims, ring, offset, nBytes));
+        return arr;
+      }
       arr.reset(new MatArray(mx, dims));
+      nBytes = arr->numElm() * MatDataTypeConstants::elmSize(arr->mx());
     } catch(VrRecoverableException const &e) {
       // We're leaving the rest of the input stream unread, so this is fatal.
       // To make this more robust in the future, we should still read all of
@@ -363,10 +722,12 @@ namespace VideoIO
     if (arr->mx() == MatDataTypeConstants::mxCELL_CLASS) {
       MatArray **a = (MatArray **)arr->data();
       for (size_t i=0; i<arr->numElm(); i++) {
-        *a++ = readMatArray(in).release();
+        *a++ = readMatArray(in, ring, leaveInRing).release();
       }
+    } else if (offset >= 0) {
+      memcpy(arr->data(), ring->at(offset), nBytes);
+      ring->release(offset, nBytes);
     } else {
-      size_t nBytes = arr->numElm() * MatDataTypeConstants::elmSize(arr->mx());
       readBinaryData(arr->data(), nBytes, in);
     }
 
@@ -38,6 +38,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "registry.h"
 #include "debug.h"
 
+#if !(defined(WIN32) || defined(WIN64) || defined(_WIN32) || defined(_WIN64))
+#  include <pthread.h>
+#  define VIDEOIO_THREADSAFE_REGISTRY
+#endif
+
 using namespace std;
 
 namespace VideoIO 
@@ -47,11 +52,27 @@ namespace VideoIO
   // of mixing up handles if the MEX function gets cleared, we use a hash on
   // the current timestamp for our first handle.
   static Handle nextHandle = (Handle)time(NULL);
+
+  // The popen2 servers handle requests for different videos on different
+  // worker threads, so the handle counter and every manager's map of open 
+  // videos are guarded by a single lock.  The Windows plugins are only used
+  // from single-threaded mex functions and do without it.
+#ifdef VIDEOIO_THREADSAFE_REGISTRY
+  static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+  class RegistryLock {
+  public:
+    RegistryLock()  { pthread_mutex_lock(&registryMutex); }
+    ~RegistryLock() { pthread_mutex_unlock(&registryMutex); }
+  };
+#else
+  class RegistryLock {};
+#endif
   
   template<class VideoType>
   VideoType *VideoManager<VideoType>::lookupVideo(Handle handle)
   {
     TRACE;    
+    RegistryLock lock;
     typename map<Handle, VideoType*>::iterator i = openVideos.find(handle);
     if (i == openVideos.end()) {
       VrRecoverableThrow("Handle " << handle << 
@@ -66,6 +87,7 @@ namespace VideoIO
   Handle VideoManager<VideoType>::registerVideo(VideoType *vid)
   {
     TRACE;
+    RegistryLock lock;
     Handle newHandle = nextHandle++;
     openVideos[newHandle] = vid;
     return newHandle;
@@ -75,22 +97,34 @@ namespace VideoIO
   void VideoManager<VideoType>::deleteVideo(Handle handle)
   {
     TRACE;
-    VideoType *vid = lookupVideo(handle);
-    if (vid) {
-      openVideos.erase(handle);
-      delete vid;
+    VideoType *vid = NULL;
+    {
+      RegistryLock lock;
+      typename map<Handle, VideoType*>::iterator i = openVideos.find(handle);
+      VrRecoverableCheckMsg(i != openVideos.end(),
+                            "Handle " << handle << 
+                            " is not a valid video handle.");
+      vid = i->second;
+      openVideos.erase(i);
     }
+    // Closing a video can take a while (e.g. flushing an encoder), so we 
+    // do it outside the lock.
+    delete vid;
   }
 
   template<class VideoType>
   void VideoManager<VideoType>::deleteAllVideos()
   {
     TRACE;
+    map<Handle, VideoType*> doomed;
+    {
+      RegistryLock lock;
+      doomed.swap(openVideos);
+    }
     typename map<Handle, VideoType*>::iterator i;
-    for (i = openVideos.begin(); i != openVideos.end(); i++) {
+    for (i = doomed.begin(); i != doomed.end(); i++) {
       delete i->second;
     }
-    openVideos.clear();
   }
   
   template class VideoManager<IVideo>;  
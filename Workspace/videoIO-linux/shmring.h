@@ -0,0 +1,237 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+#include <set>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "matarray.h"
+
+namespace VideoIO 
+{
+
+  /** A shared memory ring buffer that lets a popen2 server hand bulk array
+   *  data (i.e. frames) to the mex function without pushing them through a
+   *  pipe.  The client creates the segment and passes its file descriptor
+   *  to the server on the command line (see mexClientPopen2.cpp).
+   *
+   *  The pipe still carries every message: an array stored in the ring is 
+   *  sent as its offset instead of its data (see writeMatArray in 
+   *  pipecomm.h).  Since the client only looks in the ring after reading 
+   *  such a message, the data is guaranteed to be there and no extra 
+   *  signalling is needed.  Only the server allocates space and only the
+   *  client releases it, both in the order the arrays appear in the pipe, 
+   *  so the only shared bookkeeping is a "consumed" counter in the 
+   *  segment's header.  When the ring is full, the server simply sends
+   *  the data inline.  The client may hold on to an array past later 
+   *  ones (see hold); the counter then stops short of it.
+   */
+  class ShmRing {
+  public:
+    /** Arrays smaller than this aren't worth putting in the ring */
+    static const size_t MIN_PAYLOAD_BYTES = 4096;
+
+    inline ShmRing() : 
+      base(NULL), mappedBytes(0), capacity(0), head(0), releasedEnd(0) {}
+    inline ~ShmRing() { detach(); }
+
+    /** Client side: creates an unnamed segment with room for capacity
+     *  bytes of data.  Returns a file descriptor for it that child 
+     *  processes inherit, or -1 on failure. */
+    inline int  create(size_t capacity);
+    /** Server side: maps the segment and closes fd.  Returns false if fd
+     *  is not a ring made by create, in which case alloc always fails. */
+    inline bool attach(int fd);
+    inline void detach();
+    inline bool usable() const { return base != NULL; }
+
+    /** Server side: reserves n contiguous bytes and returns their offset,
+     *  or -1 if the data should be sent inline instead. */
+    inline int64 alloc(size_t n);
+    /** Client side: frees the n bytes at offset and everything before 
+     *  them that isn't held. */
+    inline void  release(int64 offset, size_t n);
+    /** Client side: keeps the array at offset in place until it is 
+     *  released itself, even if arrays after it are released first. */
+    inline void  hold(int64 offset) { held.insert((uint64)offset); }
+    inline void *at(int64 offset) { 
+      return base + HEADER_BYTES + (uint64)offset % capacity; 
+    }
+
+  private:
+    static const size_t HEADER_BYTES = 64; // keeps the data cache aligned
+    static const uint32 MAGIC        = 0x56696f52; // "VioR"
+    static const uint32 VERSION      = 1;
+
+    struct Header {
+      uint32          magic;
+      uint32          version;
+      uint64          capacity;
+      /** Offset just past the last byte the client has read.  Offsets 
+       *  grow forever; they are reduced modulo capacity by at(). */
+      volatile uint64 consumed;
+    };
+
+    inline Header *header() { return (Header*)base; }
+    inline bool    map(int fd, size_t sz);
+
+    unsigned char *base;
+    size_t         mappedBytes;
+    uint64         capacity;
+    /** Server side: offset of the next allocation */
+    uint64         head;
+    /** Client side: end of the last array released, and the starts of 
+     *  the arrays being held */
+    uint64           releasedEnd;
+    std::set<uint64> held;
+  };
+
+  //------ ShmRing implementation --------------------------------------------
+
+  int ShmRing::create(size_t cap)
+  {
+    TRACE;
+    detach();
+
+    static int nCreated = 0;
+    std::stringstream name;
+    name << "/videoIO-" << getpid() << "-" << nCreated++;
+    int const fd = shm_open(name.str().c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+    if (fd < 0) return -1;
+    // The server inherits fd, so nobody needs to find the segment by name.
+    // Unlinking right away guarantees it disappears with the processes.
+    shm_unlink(name.str().c_str());
+
+    int const flags = fcntl(fd, F_GETFD);
+    if (ftruncate(fd, HEADER_BYTES + cap) != 0 || 
+        !map(fd, HEADER_BYTES + cap) ||
+        flags < 0 || fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC) != 0) {
+      detach();
+      close(fd);
+      return -1;
+    }
+
+    header()->magic    = MAGIC;
+    header()->version  = VERSION;
+    header()->capacity = cap;
+    header()->consumed = 0;
+    capacity    = cap;
+    head        = 0;
+    releasedEnd = 0;
+    held.clear();
+    return fd;
+  }
+
+  bool ShmRing::attach(int fd)
+  {
+    TRACE;
+    detach();
+
+    struct stat st;
+    bool const ok = (fstat(fd, &st) == 0 && 
+                     (size_t)st.st_size > HEADER_BYTES && 
+                     map(fd, (size_t)st.st_size));
+    close(fd);
+    if (!ok) return false;
+
+    if (header()->magic != MAGIC || header()->version != VERSION ||
+        header()->capacity != mappedBytes - HEADER_BYTES) {
+      detach();
+      return false;
+    }
+    capacity = header()->capacity;
+    head     = header()->consumed;
+    return true;
+  }
+
+  void ShmRing::detach()
+  {
+    if (base) munmap(base, mappedBytes);
+    base        = NULL;
+    mappedBytes = 0;
+    capacity    = 0;
+    held.clear();
+  }
+
+  bool ShmRing::map(int fd, size_t sz)
+  {
+    void *p = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return false;
+    base        = (unsigned char*)p;
+    mappedBytes = sz;
+    return true;
+  }
+
+  int64 ShmRing::alloc(size_t n)
+  {
+    if (!usable() || n < MIN_PAYLOAD_BYTES || n > capacity) return -1;
+
+    // Data must be contiguous, so skip the tail end of the buffer if 
+    // needed.  The skipped bytes are freed along with the data after them.
+    uint64 start = head;
+    uint64 const phys = start % capacity;
+    if (phys + n > capacity) start += capacity - phys;
+
+    __sync_synchronize();
+    if (start + n - header()->consumed > capacity) return -1;
+
+    head = (start + n + 15) & ~(uint64)15;
+    return (int64)start;
+  }
+
+  void ShmRing::release(int64 offset, size_t n)
+  {
+    if (!usable()) return;
+    held.erase((uint64)offset);
+    if ((uint64)offset + n > releasedEnd) releasedEnd = (uint64)offset + n;
+    uint64 const consumed = 
+      (held.empty() || releasedEnd < *held.begin()) ? 
+      releasedEnd : *held.begin();
+
+    // make sure we're done reading before the server may overwrite
+    __sync_synchronize();
+    header()->consumed = consumed;
+  }
+
+}; /* namespace VideoIO */
+
+#endif
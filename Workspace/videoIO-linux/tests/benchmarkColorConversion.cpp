@@ -0,0 +1,287 @@
+// $Date: 2008-11-17 17:39:15 -0500 (Mon, 17 Nov 2008) $
+// $Revision: 706 $
+
+/*
+videoIO: granting easy, flexible, and efficient read/write access to video 
+                 files in Matlab on Windows and GNU/Linux platforms.
+    
+Copyright (c) 2006 Gerald Dalley
+  
+Permission is hereby granted, free of charge, to any person obtaining a copy 
+of this software and associated documentation files (the "Software"), to deal 
+in the Software without restriction, including without limitation the rights 
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+copies of the Software, and to permit persons to whom the Software is 
+furnished to do so, subject to the following conditions:
+
+    Portions of this software link to code licensed under the Gnu General 
+    Public License (GPL).  As such, they must be licensed by the more 
+    restrictive GPL license rather than this MIT license.  If you compile 
+    those files, this library and any code of yours that uses it automatically
+    becomes subject to the GPL conditions.  Any source files supplied by 
+    this library that bear this restriction are clearly marked with internal
+    comments.
+
+The above copyright notice and this permission notice shall be included in all 
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+SOFTWARE.
+*/
+
+// Microbenchmark for the fused YUV->Matlab conversion used by the video 
+// readers.  It compares three ways of getting a decoded YUV420P frame into
+// Matlab's column-major RGB layout:
+//
+//   two-pass:      sws_scale to packed BGR, then a naive transpose (this is
+//                  what FfmpegIVideo used to do)
+//   fused scalar:  yuvToMatlab with the SIMD kernels disabled
+//   fused SIMD:    yuvToMatlab with the SIMD kernels enabled (if available)
+//
+// It then does the same for the writers' direction (Matlab RGB -> YUV420P,
+// naive transpose + sws_scale vs. matlabToYuv) and checks that the SIMD
+// writer kernel is bit-exact with the scalar one.
+//
+// Build and run with:
+//   make benchmarkColorConversion
+//   tests/benchmarkColorConversion
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+#include "FfmpegCommon.h"
+#include "ColorConversion.h"
+
+using namespace std;
+using namespace VideoIO;
+
+/** The previous conversion code (transpose + BGR->RGB), kept for reference */
+static void bgrToMatlabNaive(unsigned char *out, unsigned char const *bgr,
+                             int w, int h, int d)
+{
+  const int dy = w*d;
+  for (int c=0; c<d; c++) {
+    for (int x=0; x<w; x++) {
+      unsigned char const *b = &bgr[x*d + (d-1-c)];
+      for (int y=0; y<h; y++) {
+        *out++ = *b; 
+        b += dy;
+      }
+    }
+  }
+}
+
+/** The previous writer conversion code (transpose + RGB->BGR) */
+static void matlabToBgrNaive(unsigned char *bgr, unsigned char const *in,
+                             int w, int h, int d)
+{
+  const int dy = w*d;
+  for (int c=0; c<d; c++) {
+    for (int x=0; x<w; x++) {
+      unsigned char *b = &bgr[x*d + (d-1-c)];
+      for (int y=0; y<h; y++) {
+        *b = *in++;
+        b += dy;
+      }
+    }
+  }
+}
+
+static double now() 
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static void benchmark(int w, int h)
+{
+  // Enough iterations to do the same amount of work at every resolution
+  const int nIters = max(10, (500 * 320 * 240) / (w * h));
+
+  // Random, but repeatable, YUV420P input
+  const int cw = w/2, ch = h/2;
+  vector<unsigned char> y(w*h), u(cw*ch), v(cw*ch);
+  srand(w*h);
+  for (size_t i=0; i<y.size(); i++) y[i] = (unsigned char)(rand() & 0xff);
+  for (size_t i=0; i<u.size(); i++) u[i] = (unsigned char)(rand() & 0xff);
+  for (size_t i=0; i<v.size(); i++) v[i] = (unsigned char)(rand() & 0xff);
+
+  unsigned char const *const planes[3] = { &y[0], &u[0], &v[0] };
+  int const strides[3] = { w, cw, cw };
+
+  vector<unsigned char> twoPassOut(w*h*3), fusedOut(w*h*3), bgr(w*h*3);
+
+  // two-pass
+  AVPicture src, dst;
+  for (int i=0; i<3; i++) { 
+    src.data[i] = (uint8_t*)planes[i]; 
+    src.linesize[i] = strides[i]; 
+  }
+  avpicture_fill(&dst, &bgr[0], PIX_FMT_BGR24, w, h);
+#ifdef VIDEO_READER_USE_SWSCALER
+  SwsContext *ctx = sws_getCachedContext(NULL, w, h, PIX_FMT_YUV420P, 
+                                         w, h, PIX_FMT_BGR24,
+                                         SWS_POINT, NULL, NULL, NULL);
+  if (ctx == NULL) {
+    fprintf(stderr, "Could not create the swscale context\n");
+    exit(1);
+  }
+#endif
+  double t0 = now();
+  for (int i=0; i<nIters; i++) {
+#ifdef VIDEO_READER_USE_SWSCALER
+    sws_scale(ctx, src.data, src.linesize, 0, h, dst.data, dst.linesize);
+#else
+    img_convert(&dst, PIX_FMT_BGR24, &src, PIX_FMT_YUV420P, w, h);
+#endif
+    bgrToMatlabNaive(&twoPassOut[0], &bgr[0], w, h, 3);
+  }
+  const double twoPassMs = (now() - t0) * 1000 / nIters;
+#ifdef VIDEO_READER_USE_SWSCALER
+  sws_freeContext(ctx);
+#endif
+
+  // fused scalar
+  setColorConversionSimd(false);
+  t0 = now();
+  for (int i=0; i<nIters; i++) {
+    yuvToMatlab(&fusedOut[0], w, h, planes, strides, YUV_420, YUV_MPEG_RANGE);
+  }
+  const double scalarMs = (now() - t0) * 1000 / nIters;
+
+  // fused SIMD
+  double simdMs = -1;
+  if (colorConversionSimdAvailable()) {
+    setColorConversionSimd(true);
+    t0 = now();
+    for (int i=0; i<nIters; i++) {
+      yuvToMatlab(&fusedOut[0], w, h, planes, strides, 
+                  YUV_420, YUV_MPEG_RANGE);
+    }
+    simdMs = (now() - t0) * 1000 / nIters;
+  }
+
+  // The fused kernels and swscale round differently (and swscale's
+  // accuracy depends on its build), so we just report the difference.
+  int maxDiff = 0;
+  for (size_t i=0; i<fusedOut.size(); i++) {
+    maxDiff = max(maxDiff, abs((int)fusedOut[i] - (int)twoPassOut[i]));
+  }
+
+  printf("%4dx%-4d  two-pass %7.2f ms   fused scalar %7.2f ms (%4.1fx)   ",
+         w, h, twoPassMs, scalarMs, twoPassMs / scalarMs);
+  if (simdMs >= 0) {
+    printf("fused SIMD %7.2f ms (%4.1fx)", simdMs, twoPassMs / simdMs);
+  } else {
+    printf("fused SIMD      n/a");
+  }
+  printf("   max |diff| %d\n", maxDiff);
+}
+
+static void benchmarkWriter(int w, int h)
+{
+  const int nIters = max(10, (500 * 320 * 240) / (w * h));
+
+  // Random, but repeatable, Matlab-layout RGB input
+  vector<unsigned char> in(w*h*3), bgr(w*h*3);
+  srand(w*h);
+  for (size_t i=0; i<in.size(); i++) in[i] = (unsigned char)(rand() & 0xff);
+
+  const int cw = w/2, ch = h/2;
+  vector<unsigned char> twoPassY(w*h), twoPassU(cw*ch), twoPassV(cw*ch);
+  vector<unsigned char> scalarY(w*h), scalarU(cw*ch), scalarV(cw*ch);
+  vector<unsigned char> simdY(w*h),   simdU(cw*ch),   simdV(cw*ch);
+  int strides[3] = { w, cw, cw };
+
+  // two-pass
+  AVPicture src, dst;
+  avpicture_fill(&src, &bgr[0], PIX_FMT_BGR24, w, h);
+  dst.data[0] = &twoPassY[0]; dst.data[1] = &twoPassU[0]; 
+  dst.data[2] = &twoPassV[0];
+  for (int i=0; i<3; i++) dst.linesize[i] = strides[i];
+#ifdef VIDEO_READER_USE_SWSCALER
+  SwsContext *ctx = sws_getCachedContext(NULL, w, h, PIX_FMT_BGR24, 
+                                         w, h, PIX_FMT_YUV420P,
+                                         SWS_POINT, NULL, NULL, NULL);
+  if (ctx == NULL) {
+    fprintf(stderr, "Could not create the swscale context\n");
+    exit(1);
+  }
+#endif
+  double t0 = now();
+  for (int i=0; i<nIters; i++) {
+    matlabToBgrNaive(&bgr[0], &in[0], w, h, 3);
+#ifdef VIDEO_READER_USE_SWSCALER
+    sws_scale(ctx, src.data, src.linesize, 0, h, dst.data, dst.linesize);
+#else
+    img_convert(&dst, PIX_FMT_YUV420P, &src, PIX_FMT_BGR24, w, h);
+#endif
+  }
+  const double twoPassMs = (now() - t0) * 1000 / nIters;
+#ifdef VIDEO_READER_USE_SWSCALER
+  sws_freeContext(ctx);
+#endif
+
+  // fused scalar
+  unsigned char *const scalarPlanes[3] = 
+    { &scalarY[0], &scalarU[0], &scalarV[0] };
+  setColorConversionSimd(false);
+  t0 = now();
+  for (int i=0; i<nIters; i++) {
+    matlabToYuv(scalarPlanes, strides, &in[0], w, h, 3, 
+                YUV_420, YUV_MPEG_RANGE);
+  }
+  const double scalarMs = (now() - t0) * 1000 / nIters;
+
+  // fused SIMD
+  double simdMs = -1;
+  bool   exact  = true;
+  if (colorConversionSimdAvailable()) {
+    unsigned char *const simdPlanes[3] = { &simdY[0], &simdU[0], &simdV[0] };
+    setColorConversionSimd(true);
+    t0 = now();
+    for (int i=0; i<nIters; i++) {
+      matlabToYuv(simdPlanes, strides, &in[0], w, h, 3, 
+                  YUV_420, YUV_MPEG_RANGE);
+    }
+    simdMs = (now() - t0) * 1000 / nIters;
+    exact = (simdY == scalarY && simdU == scalarU && simdV == scalarV);
+  }
+
+  int maxDiff = 0;
+  for (size_t i=0; i<scalarY.size(); i++) {
+    maxDiff = max(maxDiff, abs((int)scalarY[i] - (int)twoPassY[i]));
+  }
+
+  printf("%4dx%-4d  two-pass %7.2f ms   fused scalar %7.2f ms (%4.1fx)   ",
+         w, h, twoPassMs, scalarMs, twoPassMs / scalarMs);
+  if (simdMs >= 0) {
+    printf("fused SIMD %7.2f ms (%4.1fx)", simdMs, twoPassMs / simdMs);
+  } else {
+    printf("fused SIMD      n/a");
+  }
+  printf("   max |Y diff| %d%s\n", maxDiff, 
+         exact ? "" : "   SIMD/scalar MISMATCH");
+}
+
+int main(int argc, char **argv)
+{
+  printf("SIMD kernels %savailable on this CPU\n", 
+         colorConversionSimdAvailable() ? "" : "NOT ");
+  printf("YUV420P -> Matlab (readers)\n");
+  benchmark(320,  240);
+  benchmark(640,  480);
+  benchmark(1920, 1080);
+  printf("Matlab -> YUV420P (writers)\n");
+  benchmarkWriter(320,  240);
+  benchmarkWriter(640,  480);
+  benchmarkWriter(1920, 1080);
+  return 0;
+}
@@ -97,8 +97,59 @@ for f=floor(rand(1,100)*(info.numFrames-1))
   assertSimilarImages(images(:,:,f+1), img);
 end
 
+%%% test time-based seeks %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+vrassert seektime(vr, 5 / info.fps);    % ? -> 5
+vrassert get(vr, 'approxFrameNum') == 5;
+img = getframe(vr); img = uint8(sum(double(img), 3) / size(img,3));
+assertSimilarImages(images(:,:,6), img);
+vrassert ~seektime(vr, -1);
+
+%%% test batched reads %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+vrassert seek(vr, 0);
+[frames, frameNums] = getframes(vr, 3);         % 0 -> 1,2,3
+vrassert isequal(frameNums, [1 2 3]);
+vrassert size(frames,4) == 3;
+[frames, frameNums] = getframes(vr, 2, 2);      % 3 -> 5,7
+vrassert isequal(frameNums, [5 7]);
+for i=1:numel(frameNums)
+  img = frames(:,:,:,i); img = uint8(sum(double(img), 3) / size(img,3));
+  assertSimilarImages(images(:,:,frameNums(i)+1), img);
+end
+
+%%% test reads into a reused buffer %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+buf = zeros([info.height info.width 3], 'uint8');
+for f=[2 4]
+  vrassert seek(vr, f);
+  buf = getframeinto(vr, buf, 'inplace');
+  vrassert isequal(buf, getframe(vr));
+  img = uint8(sum(double(buf), 3) / size(buf,3));
+  assertSimilarImages(images(:,:,f+1), img);
+end
+
+% without 'inplace', arrays sharing the buffer's data must not change
+shared = buf; before = buf + 0;
+vrassert seek(vr, 1);
+buf = getframeinto(vr, buf);
+vrassert isequal(buf, getframe(vr));
+vrassert isequal(shared, before);
+
 close(vr);
 
+%%% test the frame cache (for plugins that have one) %%%%%%%%%%%%%%%%%
+if isfield(info, 'frameCacheMB')
+  vr = videoReader(varargin{:}, 'frameCacheMB', 64);
+  for f=[0 1 2 1 0 2 3 1]                 % scrub back and forth
+    vrassert seek(vr, f);
+    img = getframe(vr); img = uint8(sum(double(img), 3) / size(img,3));
+    assertSimilarImages(images(:,:,f+1), img);
+  end
+  vrassert next(vr);                      % 1 -> 2, right after a hit
+  img = getframe(vr); img = uint8(sum(double(img), 3) / size(img,3));
+  assertSimilarImages(images(:,:,3), img);
+  vrassert get(vr, 'frameCacheHits') >= 4;
+  close(vr);
+end
+
 iexit('<<< doPreciseSeekTests(''%s'',...)', varargin{1});
 
 %-------------------------------------------------------------
@@ -0,0 +1,67 @@
+function testLibmpeg3OddSize(plugin)
+%testLibmpeg3OddSize
+%  Reads an MPEG-1 clip with odd frame dimensions through the libmpeg3
+%  plugin.  The default RGB and the 'gray' output formats must return
+%  full-sized frames, and 'yuv' must be refused since libmpeg3 only
+%  writes w/2 chroma samples per row.  The clip is written with the
+%  ffmpegPopen2 videoWriter plugin.
+%
+%testLibmpeg3OddSize(plugin)
+%  Tests the given libmpeg3 plugin instead of libmpeg3Popen2.
+%
+%Examples:
+%  testLibmpeg3OddSize
+%  testLibmpeg3OddSize libmpeg3Direct
+%
+% SEE ALSO:
+%   buildVideoIO
+%   videoReader
+%
+
+ienter;
+
+if nargin < 1, plugin = 'libmpeg3Popen2'; end
+
+width = 97; height = 73; nFrames = 10;
+
+try
+  tmpDir = tempname; mkdir(tmpDir);
+  fname = fullfile(tmpDir, 'testLibmpeg3OddSize.mpg');
+  vw = videoWriter(fname, 'plugin','ffmpegPopen2', 'codec','mpeg1video', ...
+    'width',width, 'height',height);
+  for i=1:nFrames
+    addframe(vw, psychedelicFrame(width, height, i));
+  end
+  close(vw);
+
+  iprintf('rgb');
+  vr = videoReader(fname, plugin);
+  vrassert next(vr);
+  frame = getframe(vr);
+  vrassert isequal(size(frame), [height width 3]);
+  close(vr);
+
+  iprintf('gray');
+  vr = videoReader(fname, plugin, 'outputFormat','gray');
+  vrassert next(vr);
+  frame = getframe(vr);
+  vrassert isequal(size(frame), [height width]);
+  close(vr);
+
+  iprintf('yuv');
+  refused = 0;
+  try
+    vr = videoReader(fname, plugin, 'outputFormat','yuv');
+    close(vr);
+  catch
+    refused = 1;
+  end
+  vrassert refused;
+
+  try rmdir(tmpDir, 's'); catch end
+catch
+  try rmdir(tmpDir, 's'); catch end
+  rethrow(lasterror);
+end
+
+iexit;
@@ -74,5 +74,100 @@ catch %#ok<CTCH>
   delete(tmpFile);
   rethrow(e);
 end
+
+% Write the same frames in one batch
+try
+  vw = videoWriter(tmpFile, plugin, 'width',w, 'height',h);
+  nBytes = addframes(vw, cat(4, frames{:}));
+  vrassert numel(nBytes) == N;
+  vrassert sum(nBytes) > 0;
+  vw = close(vw);
+  
+  vr = videoReader(tmpFile, readerPlugin);
+  info = get(vr);
+  for i=1:N-double(info.nHiddenFinalFrames) - 2
+    vrassert next(vr);  
+    diffImg = abs(double(imfilter(frames{i},filt)) - ...
+                  double(imfilter(getframe(vr),filt))); %#ok<NASGU>
+    vrassert all(all(rgb2gray(diffImg) < 10));
+  end
+  close(vr);
+  
+  delete(tmpFile);
+catch %#ok<CTCH>
+  e = lasterror; %#ok<LERR>
+  try close(vr); catch end %#ok<CTCH>
+  try close(vw); catch end %#ok<CTCH>
+  delete(tmpFile);
+  rethrow(e);
+end
+
+% Write grayscale frames: HxW ones with addframe and an HxWx1xN batch 
+% with addframes.  They should read back with R=G=B.
+grays = cellfun(@(f) f(:,:,1), frames, 'UniformOutput',false);
+grayBatch = cat(4, grays{:});
+vrassert isequal(size(grayBatch), [h w 1 N]);
+for batch=0:1
+  try
+    vw = videoWriter(tmpFile, plugin, 'width',w, 'height',h);
+    if batch
+      addframes(vw, grayBatch);
+    else
+      for i=1:N
+        addframe(vw, grays{i});
+      end
+    end
+    vw = close(vw);
+    checkWrittenFrames(tmpFile, readerPlugin, frames);
+    delete(tmpFile);
+  catch %#ok<CTCH>
+    e = lasterror; %#ok<LERR>
+    try close(vw); catch end %#ok<CTCH>
+    delete(tmpFile);
+    rethrow(e);
+  end
+end
+
+% Write through the encoder thread with a short queue (ffmpeg plugins only)
+if strncmpi(plugin, 'ffmpeg', 6)
+  try
+    vw = videoWriter(tmpFile, plugin, 'width',w, 'height',h, ...
+                     'asyncEncode',1, 'asyncQueueFrames',2);
+    for i=1:N
+      addframe(vw, frames{i});
+    end
+    vw = close(vw);
+    checkWrittenFrames(tmpFile, readerPlugin, frames);
+    delete(tmpFile);
+  catch %#ok<CTCH>
+    e = lasterror; %#ok<LERR>
+    try close(vw); catch end %#ok<CTCH>
+    delete(tmpFile);
+    rethrow(e);
+  end
+end
   
 iexit
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function checkWrittenFrames(tmpFile, readerPlugin, frames)
+%checkWrittenFrames(tmpFile, readerPlugin, frames)
+%   reads tmpFile back and compares it with the RGB frames that were 
+%   written, as the tests above do
+
+vr = videoReader(tmpFile, readerPlugin);
+try
+  info = get(vr);
+  filt = fspecial('gaussian', 5,2);
+  for i=1:numel(frames)-double(info.nHiddenFinalFrames) - 2
+    vrassert next(vr);  
+    diffImg = abs(double(imfilter(frames{i},filt)) - ...
+                  double(imfilter(getframe(vr),filt))); %#ok<NASGU>
+    vrassert all(all(rgb2gray(diffImg) < 10));
+  end
+  close(vr);
+catch %#ok<CTCH>
+  e = lasterror; %#ok<LERR>
+  try close(vr); catch end %#ok<CTCH>
+  rethrow(e);
+end
@@ -34,6 +34,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <climits>
+#include <cmath>
 #include "handleMexRequest.h"
 #include "IVideo.h"
 #include "matarray.h"
@@ -193,6 +195,21 @@ void seek(vector<MatArray*> &lhs, int nlhs, Handle handle,
   lhs.push_back(scalar2mat<double>(vid->seek(amt)).release());
 }
 
+void seektime(vector<MatArray*> &lhs, int nlhs, Handle handle, 
+              vector<MatArray*> const &rhs)
+{ 
+  TRACE;
+  nlhsCheck(nlhs, 1);
+  nrhsCheck(rhs,  1);
+
+  IVideo *vid = iVideoManager()->lookupVideo(handle);
+  VrRecoverableCheck(vid != NULL);
+
+  double const seconds = mat2scalar<double>(rhs[0]);
+
+  lhs.push_back(scalar2mat<double>(vid->seekTime(seconds)).release());
+}
+
 void getframe(vector<MatArray*> &lhs, int nlhs, Handle handle, 
               vector<MatArray*> const &rhs)
 { 
@@ -223,6 +240,106 @@ void getframe(vector<MatArray*> &lhs, int nlhs, Handle handle,
   lhs.push_back(mat.release());
 }
 
+/** Like getframe, but writes the frame into the caller's uint8 array 
+ *  instead of allocating a new one.  The array must already be HxWxD.
+ *  With the direct plugin, the input is a view of Matlab's own array, so
+ *  this writes behind copy-on-write's back; videoReader/getframeinto 
+ *  only sends it when the caller asked for that with 'inplace'.  The 
+ *  popen2 client never forwards this operation: it asks the server for 
+ *  a plain getframe and copies the result into the caller's array. */
+void getframeinto(vector<MatArray*> &lhs, int nlhs, Handle handle, 
+                  vector<MatArray*> const &rhs)
+{ 
+  TRACE;
+  nlhsCheck(nlhs, 0);
+  nrhsCheck(rhs,  1);
+
+  IVideo *vid = iVideoManager()->lookupVideo(handle);
+  VrRecoverableCheck(vid != NULL);
+
+  if (vid->currFrameNum() < 0) {
+    VrRecoverableThrow("Invalid frame.  Perhaps you have forgotten to first "
+                       "call next, step, or seek.");
+  }
+
+  MatArray *buf = rhs[0];
+  VrRecoverableCheckMsg(buf->mx() == MatDataTypeConstants::mxUINT8_CLASS,
+                        "The frame buffer must be a uint8 array.");
+  vector<int> const &dims = buf->dims();
+  VrRecoverableCheckMsg(
+    dims.size() >= 2 && dims[0] == vid->height() && dims[1] == vid->width() &&
+    (int)buf->numElm() == vid->height() * vid->width() * vid->depth(),
+    "The frame buffer must be " << vid->height() << "x" << vid->width() <<
+    "x" << vid->depth() << ".");
+
+  vid->currFrameInto((unsigned char*)buf->data());
+}
+
+/** Reads up to N frames in a single request.  The video is advanced N 
+ *  times, like calling step with the given stride (default 1, i.e. next)
+ *  N times, and each frame read is stored in an HxWxDxN uint8 array.  The
+ *  second output holds the frame number of each frame actually read.  If
+ *  the end of the video is reached first, both outputs are truncated. */
+void getframes(vector<MatArray*> &lhs, int nlhs, Handle handle, 
+               vector<MatArray*> const &rhs)
+{ 
+  TRACE;
+  nlhsCheck(nlhs, 2);
+  VrRecoverableCheckMsg(rhs.size() == 1 || rhs.size() == 2,
+                        "Expected a frame count and an optional stride, but " 
+                        << rhs.size() << " input args were found.");
+
+  IVideo *vid = iVideoManager()->lookupVideo(handle);
+  VrRecoverableCheck(vid != NULL);
+
+  // The comparisons also reject NaN and +/-Inf
+  double const n = mat2scalar<double>(rhs[0]);
+  VrRecoverableCheckMsg(n >= 1 && n <= INT_MAX && n == floor(n),
+                        "The number of frames must be a positive integer.");
+  double const s = (rhs.size() > 1) ? mat2scalar<double>(rhs[1]) : 1;
+  VrRecoverableCheckMsg(s >= -INT_MAX && s <= INT_MAX && s == floor(s) && 
+                        s != 0, "The stride must be a non-zero integer.");
+  int const stride = (int)s;
+
+  // Don't allocate room for more frames than the video has
+  int nRequested = (int)n;
+  int const nFrames = vid->numFrames();
+  if (nFrames >= 0 && nRequested > nFrames) nRequested = nFrames;
+
+  vector<int> dims;
+  dims.push_back(vid->height());
+  dims.push_back(vid->width());
+  dims.push_back(vid->depth());
+  dims.push_back(nRequested);
+  size_t const frameBytes = (size_t)dims[0] * dims[1] * dims[2];
+
+  auto_ptr<MatArray> frames(new MatArray(MatDataTypeConstants::mxUINT8_CLASS,
+                                         dims));
+  vector<int> frameNums;
+  for (int i=0; i<nRequested; i++) {
+    bool const advanced = (stride == 1) ? vid->next() : vid->step(stride);
+    if (!advanced) break;
+    memcpy((unsigned char*)frames->data() + i*frameBytes, 
+           &vid->currFrame()[0], frameBytes);
+    frameNums.push_back(vid->currFrameNum());
+  }
+
+  int const nRead = (int)frameNums.size();
+  if (nRead < nRequested) {
+    VERBOSE("Only " << nRead << " of " << nRequested << " frames were read");
+    frames->shrinkLastDim(nRead);
+  }
+
+  auto_ptr<MatArray> nums(new MatArray(MatDataTypeConstants::mxDOUBLE_CLASS,
+                                       1, nRead));
+  for (int i=0; i<nRead; i++) {
+    ((double*)nums->data())[i] = frameNums[i];
+  }
+
+  lhs.push_back(frames.release());
+  lhs.push_back(nums.release());
+}
+
 void close(vector<MatArray*> &lhs, int nlhs, Handle handle, 
            vector<MatArray*> const &rhs)
 { 
@@ -254,7 +371,10 @@ void VideoIO::handleMexRequest(vector<MatArray*> &lhs, int nlhs,
   else if (op == "next")     { next    (lhs, nlhs, handle, myRhs); }
   else if (op == "step")     { step    (lhs, nlhs, handle, myRhs); }
   else if (op == "seek")     { seek    (lhs, nlhs, handle, myRhs); }
+  else if (op == "seektime") { seektime(lhs, nlhs, handle, myRhs); }
   else if (op == "getframe") { getframe(lhs, nlhs, handle, myRhs); }
+  else if (op == "getframeinto") { getframeinto(lhs, nlhs, handle, myRhs); }
+  else if (op == "getframes") { getframes(lhs, nlhs, handle, myRhs); }
   else if (op == "close")    { close   (lhs, nlhs, handle, myRhs); }
   else {
     VrRecoverableThrow("Attempt to call unsupported operation " << op << ".");
@@ -69,6 +69,146 @@
 %    BOOL must be a scalar number where 0 is false, and any other number
 %    is true.  Strings are not allowed.  The default value is 1.
 %
+%  vr = videoReader(..., 'keyframeIndex',BOOL, ...)
+%    When BOOL is true, the first time a file is opened, we scan its
+%    packets (without decoding them) and record where the keyframes are.
+%    Seeks and backward steps then jump directly to the closest keyframe
+%    at or before the requested frame and only decode the frames in
+%    between, instead of decoding everything from the start of the file.
+%    The scan is fast compared to decoding, but it does require reading
+%    the whole file once.
+%
+%    Keyframe seeking assumes that frames after a keyframe never
+%    reference frames before it (closed GOPs).  If this is not true for
+%    your files, use BOOL=false.  The default value is 1.
+%
+%  vr = videoReader(..., 'indexFile',FNAME, ...)
+%    The keyframe index is cached in FNAME so that it does not need to
+%    be rebuilt every time the video is opened.  The cache is ignored if
+%    the video's size or modification time changes.  If FNAME cannot be
+%    written, the index is simply rebuilt each time.  By default, the 
+%    index is kept in $TMPDIR/videoIO-index-<uid> (or /tmp/... if TMPDIR
+%    is not set), which must be a directory that only you can write to,
+%    and nothing is written next to the video.
+%
+%  vr = videoReader(..., 'packetFrameCount',BOOL, ...)
+%    Many containers only store an estimate of the number of frames (or
+%    none at all), in which case get(vr,'numFrames') is computed from the
+%    duration and frame rate and may be off by a few frames.  When BOOL
+%    is true, the packet scan used for the keyframe index (which is done
+%    even if keyframeIndex is false) also counts the non-empty video 
+%    packets and records their timestamps, and numFrames reports that 
+%    count instead (with nHiddenFinalFrames set to 0).  For almost all
+%    files this is the number of frames.  It is not for files whose 
+%    packets may hold two frames or none, notably AVIs with "packed" 
+%    B-frames (common with DivX and XviD).  The count and timestamps are
+%    cached in the index file, so only the first open pays for the scan.
+%    The timestamps also let SEEKTIME handle variable frame rate videos 
+%    exactly.  The default value is 0.
+%
+%  vr = videoReader(..., 'prefetchFrames',N, ...)
+%    If N > 0, a background thread decodes and converts up to N frames
+%    ahead of the current one while your code is busy processing the
+%    current frame.  NEXT then usually just hands over a frame that is
+%    already ready.  This is most useful when your per-frame processing
+%    and decoding take similar amounts of time.  Each queued frame uses
+%    as much memory as one frame returned by GETFRAME.  Seeks and
+%    backward steps discard the queued frames.  The default value is 0
+%    (no decode-ahead thread).
+%
+%  vr = videoReader(..., 'frameCacheMB',MB, ...)
+%    Keeps up to MB megabytes of the most recently returned frames, 
+%    already converted, in memory.  SEEK and STEP to a cached frame then
+%    skip the decoder entirely, which helps code that revisits the same
+%    frames over and over (e.g. scrubbing back and forth, or comparing a
+%    frame with its neighbors).  GET reports the cache's hits, misses, 
+%    and evictions as 'frameCacheHits', 'frameCacheMisses', and 
+%    'frameCacheEvictions'.  The default value is 0 (no cache).
+%
+%  vr = videoReader(..., 'sharedFrameCache',BOOL, ...)
+%    When BOOL is true, the frames cached because of 'frameCacheMB' go 
+%    into a single cache shared by every video opened this way in the 
+%    same server process, instead of a cache of the video's own.  Videos
+%    of the same file, read with the same 'outputFormat', 'cropRect', 
+%    'outWidth', and 'outHeight', then get each other's frames without 
+%    decoding them.  This is mostly useful with a shared daemon (see 
+%    below).  The shared cache is as large as the largest 'frameCacheMB' 
+%    any of its videos asked for, and GET reports its statistics for the
+%    whole process.  The default value is 0.
+%
+%  vr = videoReader(..., 'pipelining',BOOL, ...)
+%    When BOOL is true, the mex function asks the server for the next
+%    frame as soon as it has handed the current one to Matlab, so the
+%    server decodes frame k+1 while your code is busy with frame k.  This
+%    pays off when frames are read in order with NEXT followed by
+%    GETFRAME (or GETNEXT).  Nothing is read ahead of the last frame,
+%    since a NEXT past the end closes the video, so reading ahead only
+%    happens when the exact frame count is known: with the ffmpeg 
+%    plugins that means 'packetFrameCount',1 and a built frame index,
+%    and with the libmpeg3 plugins a finished table of contents.  Other
+%    videos are read without pipelining.  Any other call on the 
+%    same video has to wait for the speculative request to finish first.
+%    GET then leaves the read-ahead frame in place.  Any other call that
+%    is not a SEEK, SEEKTIME, or CLOSE costs a one-frame backward step 
+%    as well.  Calls on other videos do not disturb it: the server works
+%    on different videos in parallel, so reading several pipelined videos
+%    in lockstep (e.g. two cameras) decodes all of them ahead.  This 
+%    option only exists for the popen2 plugins; the direct plugins ignore
+%    it.  The default value is 0.
+%
+%  vr = videoReader(..., 'decodeThreads',N, ...)
+%    Asks the codec to use N threads for decoding.  N=0 uses one thread
+%    per online CPU.  Whether and how much this helps depends on the
+%    codec and the version of ffmpeg: newer versions can decode several
+%    frames in parallel (e.g. H.264 and MPEG-4), while older versions
+%    only split up the slices of a single frame.  The number of threads
+%    actually in use is reported by GET as 'decodeThreads'.  The default
+%    value is 1.
+%
+%  vr = videoReader(..., 'outputFormat',FMT, ...)
+%    FMT may be 'rgb' (the default) or 'gray'.  With 'gray', GETFRAME
+%    returns a single-plane H x W image taken directly from the decoded
+%    luma (Y) channel, and GET reports the type as 'g'.  This avoids the
+%    color conversion and transfers one third of the data of an RGB frame.
+%    Note that the luma values are not rescaled: for most codecs they lie
+%    in [16,235], so they differ slightly from RGB2GRAY of an RGB frame.
+%
+%  vr = videoReader(..., 'cropRect',[X Y W H], ...)
+%    Only returns the W x H region of each frame whose top-left corner is
+%    at pixel (X,Y), where (0,0) is the top-left pixel of the frame.  The
+%    values may also be given as a string such as '10,20,320,240'.  By
+%    default, the whole frame is returned.
+%
+%  vr = videoReader(..., 'outWidth',W, 'outHeight',H, ...)
+%    Scales the frames (after any cropping) to W x H pixels while
+%    decoding, which is much cheaper than decoding full-sized frames and
+%    calling IMRESIZE.  If only one of the two is given, the other is
+%    chosen to preserve the aspect ratio.  Where the codec supports it,
+%    large reductions are done partly by the decoder itself (GET reports
+%    this as 'lowres').  The 'width' and 'height' reported by GET are
+%    those of the output frames.
+%
+%  SHARED DAEMON:
+%    By default, every Matlab session starts its own server process.  A
+%    single server can instead be left running as a daemon that any 
+%    number of Matlab sessions connect to.  Videos that its clients open
+%    repeatedly (e.g. in batch jobs) then reuse the keyframe indexes it
+%    has already built or loaded, and with 'sharedFrameCache' the frames
+%    it has already decoded.  To use one, start the server from a 
+%    shell, e.g.
+%      mkdir -m 700 /tmp/vio
+%      videoReader_ffmpegPopen2Server --daemon=/tmp/vio/videoReader_ffmpegPopen2Server.sock &
+%    and set the VIDEOIO_DAEMON_DIR environment variable (here /tmp/vio)
+%    before Matlab first uses the plugin.  The mex function connects to 
+%    $VIDEOIO_DAEMON_DIR/<server name>.sock and quietly falls back to 
+%    starting its own server when nothing is listening there.  Videos a
+%    session leaves open are closed when it disconnects.  The daemon must
+%    run on the same machine as Matlab and as the same user.  Its 
+%    directory must belong to that user and be closed to everyone else
+%    (mode 700); otherwise the daemon refuses to start and Matlab does 
+%    not connect to it.  A second daemon started on the same path exits 
+%    with an error; a socket file left by one that died is replaced.
+%
 % SEE ALSO:
 %   buildVideoIO             : how to build the plugin
 %   videoReader              : overview, usage examples, other plugins
@@ -144,32 +144,77 @@ void addFrame(vector<MatArray*> &lhs, int nlhs, Handle handle,
 
   VrRecoverableCheckMsg(rhs[0]->mx() == MatDataTypeConstants::mxUINT8_CLASS,
                         "Only uint8 arrays are supported.");
-  VrRecoverableCheckMsg(rhs[0]->dims().size() == 3, 
-                        "Only color images are supported.");
-  VrRecoverableCheckMsg(rhs[0]->dims()[2] == 3, 
-                        "Only 3-channel color images are supported");
+  VrRecoverableCheckMsg(rhs[0]->dims().size() == 2 || 
+                        rhs[0]->dims().size() == 3, 
+                        "Only grayscale and color images are supported.");
+  int const d = (rhs[0]->dims().size() == 3) ? rhs[0]->dims()[2] : 1;
+  VrRecoverableCheckMsg(d == 1 || d == 3, 
+                        "Only 1- and 3-channel images are supported");
 
   OVideo *vid = oVideoManager()->lookupVideo(handle);
   
   int const h = rhs[0]->dims()[0];
   int const w = rhs[0]->dims()[1];
-  int const d = rhs[0]->dims()[2];
 
-  const size_t N = w*h*d*sizeof(unsigned char);
-  IVideo::Frame data(N);
-  memcpy(&data[0], rhs[0]->data(), N);
-
-  vid->addframe(w, h, d, data);
+  vid->addframe(w, h, d, (unsigned char const*)rhs[0]->data());
 
   // no lhs returned.
 }
 
+/** Adds all the frames of an HxWx3xN or HxWx1xN uint8 array in one 
+ *  request and returns a 1xN double array with the number of bytes written
+ *  for each frame (see OVideo::addframes). */
+void addFrames(vector<MatArray*> &lhs, int nlhs, Handle handle, 
+               vector<MatArray*> const &rhs)
+{ 
+  TRACE;
+  nlhsCheck(nlhs, 1);
+  nrhsCheck(rhs,  1);
+
+  VrRecoverableCheckMsg(rhs[0]->mx() == MatDataTypeConstants::mxUINT8_CLASS,
+                        "Only uint8 arrays are supported.");
+  vector<int> const &dims = rhs[0]->dims();
+  VrRecoverableCheckMsg(dims.size() >= 2 && dims.size() <= 4, 
+                        "Frames must be given as an HxWx3xN or HxWx1xN "
+                        "array.");
+  int const d = (dims.size() >= 3) ? dims[2] : 1;
+  VrRecoverableCheckMsg(d == 1 || d == 3, 
+                        "Only 1- and 3-channel images are supported");
+
+  OVideo *vid = oVideoManager()->lookupVideo(handle);
+  
+  int const h = dims[0];
+  int const w = dims[1];
+  int const n = (dims.size() == 4) ? dims[3] : 1;
+
+  vector<int> encodedBytes;
+  vid->addframes(w, h, d, n, (unsigned char const*)rhs[0]->data(), 
+                 encodedBytes);
+
+  auto_ptr<MatArray> nBytes(
+    new MatArray(MatDataTypeConstants::mxDOUBLE_CLASS, 1, n));
+  for (int i=0; i<n; i++) {
+    ((double*)nBytes->data())[i] = encodedBytes[i];
+  }
+  lhs.push_back(nBytes.release());
+}
+
 void close(vector<MatArray*> &lhs, int nlhs, Handle handle, 
            vector<MatArray*> const &rhs)
 { 
   TRACE;
   nlhsCheck(nlhs, 0);
   nrhsCheck(rhs,  0);
+
+  // Frames may still be waiting to be encoded.  Any error writing them 
+  // is reported here, but the video is released either way.
+  OVideo *vid = oVideoManager()->lookupVideo(handle);
+  try {
+    vid->flush();
+  } catch (...) {
+    oVideoManager()->deleteVideo(handle);
+    throw;
+  }
   oVideoManager()->deleteVideo(handle);  
 }
 
@@ -195,6 +240,7 @@ void VideoIO::handleMexRequest(vector<MatArray*> &lhs,
   else if (op == "open")     { open    (lhs, nlhs, handle, myRhs); } // c'tor
   else if (op == "get")      { get     (lhs, nlhs, handle, myRhs); }
   else if (op == "addframe") { addFrame(lhs, nlhs, handle, myRhs); }
+  else if (op == "addframes") { addFrames(lhs, nlhs, handle, myRhs); }
   else if (op == "close")    { close   (lhs, nlhs, handle, myRhs); }
   else {
     VrRecoverableThrow("Attempt to call unsupported operation: '"<<op<<"'.");
@@ -11,7 +11,8 @@
 %  process to communicate with the ffmpeg libraries.  In contrast,
 %  videoWriter_ffmpegDirect (the 'ffmpegDirect' plugin for videoWriter)
 %  loads the ffmpeg libraries directly in the MEX function.  For more
-%  information, type "help videoReader_ffmpegPopen2".
+%  information, type "help videoReader_ffmpegPopen2".  Its server can
+%  also run as a shared daemon, as described there.
 %
 %  Before using this plugin, the ffmpeg libraries must be installed (see
 %  INSTALL.ffmpeg.txt) and the plugin MEX functions must be built using
@@ -88,6 +89,20 @@
 %    For MPEG-based codecs, B gives the maximum number of bidirectional
 %    frames in a group of pictures (GOP).
 %
+%  vr = videoWriter(..., 'asyncEncode',A, ...)
+%    If A is non-zero, ADDFRAME just copies the frame into a queue and
+%    returns.  A background thread converts, encodes, and writes the
+%    queued frames in order while your code prepares the next frame.  If
+%    writing a frame fails, the error is reported by the next ADDFRAME
+%    or by CLOSE.  The default value is 0 (frames are encoded by
+%    ADDFRAME itself).
+%
+%  vr = videoWriter(..., 'asyncQueueFrames',N, ...)
+%    With 'asyncEncode', at most N frames may wait for the encoder
+%    thread.  When the queue is full, ADDFRAME waits for the encoder to
+%    catch up, so memory use stays bounded at N frames.  The default
+%    value is 4.
+%
 % SEE ALSO:
 %   buildVideoIO             : how to build the plugin
 %   videoWriter              : overview, usage examples, other plugins